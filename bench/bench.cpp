@@ -0,0 +1,220 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+
+/*------------------------ ALLOCATION COUNTING ------------------------*/
+// Replaces global operator new of the whole process (library included)
+
+static std::atomic<uint64_t> allocated{0};
+
+void *operator new(size_t size) {
+  allocated.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, std::align_val_t align) {
+  allocated.fetch_add(1, std::memory_order_relaxed);
+  size_t alignment = static_cast<size_t>(align);
+  size = (size + alignment - 1) / alignment * alignment;
+  if (void *ptr = aligned_alloc(alignment, size ? size : alignment))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t, std::align_val_t) noexcept {
+  free(ptr);
+}
+void operator delete[](void *ptr, size_t, std::align_val_t) noexcept {
+  free(ptr);
+}
+
+uint64_t Bench::allocations() {
+  return allocated.load(std::memory_order_relaxed);
+}
+
+/*----------------------------- MEASURING -----------------------------*/
+
+static double elapsed_ns(const std::function<void(uint64_t)> &body,
+                         uint64_t iterations) {
+  auto start = std::chrono::steady_clock::now();
+  body(iterations);
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+Bench::result Bench::measure(const std::string &name, size_t bytes,
+                             const std::function<void(uint64_t)> &body) {
+  // grow iteration count until a run is long enough to time reliably
+  uint64_t iterations = 1;
+  double ns = elapsed_ns(body, iterations);
+  while (ns < BENCH_MIN_TIME_MS * 1e6 && iterations < (1ULL << 40)) {
+    double scale = ns > 0 ? BENCH_MIN_TIME_MS * 1e6 / ns : 100;
+    iterations = std::max<uint64_t>(
+        iterations + 1, iterations * std::min(std::max(scale, 2.0), 100.0));
+    ns = elapsed_ns(body, iterations);
+  }
+
+  std::vector<double> samples;
+  uint64_t allocs = 0;
+  for (int i = 0; i < BENCH_SAMPLES; ++i) {
+    uint64_t before = allocations();
+    samples.push_back(elapsed_ns(body, iterations) / iterations);
+    allocs += allocations() - before;
+  }
+  std::sort(samples.begin(), samples.end());
+
+  result r;
+  r.name = name;
+  r.iterations = iterations;
+  r.ns_per_op = samples[samples.size() / 2];
+  r.bytes_per_sec = bytes ? bytes * 1e9 / r.ns_per_op : 0;
+  r.allocs_per_op =
+      static_cast<double>(allocs) / (iterations * BENCH_SAMPLES);
+  return r;
+}
+
+Bench::result Bench::latency(const std::string &name,
+                             std::vector<uint64_t> samples) {
+  result r;
+  r.name = name;
+  r.iterations = samples.size();
+  if (samples.empty())
+    return r;
+  std::sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (uint64_t sample : samples)
+    sum += sample;
+  r.ns_per_op = sum / samples.size();
+  r.p50_ns = samples[samples.size() / 2];
+  r.p99_ns = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+  return r;
+}
+
+/*----------------------------- REPORTING -----------------------------*/
+
+void Bench::print(const std::vector<result> &results) {
+  printf("%-36s %12s %12s %10s %10s %10s\n", "benchmark", "ns/op", "MB/s",
+         "allocs/op", "p50 ns", "p99 ns");
+  for (const result &r : results) {
+    printf("%-36s %12.2f ", r.name.c_str(), r.ns_per_op);
+    if (r.bytes_per_sec > 0)
+      printf("%12.1f ", r.bytes_per_sec / 1e6);
+    else
+      printf("%12s ", "-");
+    printf("%10.3f ", r.allocs_per_op);
+    if (r.p50_ns > 0)
+      printf("%10.0f %10.0f\n", r.p50_ns, r.p99_ns);
+    else
+      printf("%10s %10s\n", "-", "-");
+  }
+}
+
+// One benchmark per line, so read_json() needs no real parser
+bool Bench::write_json(const std::string &path,
+                       const std::vector<result> &results) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (!file) {
+    std::cerr << "can't write " << path << " " << strerror(errno) << std::endl;
+    return false;
+  }
+  fprintf(file, "{\"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const result &r = results[i];
+    fprintf(file,
+            "  {\"name\": \"%s\", \"iterations\": %lu, \"ns_per_op\": %.3f, "
+            "\"bytes_per_sec\": %.0f, \"allocs_per_op\": %.4f, "
+            "\"p50_ns\": %.0f, \"p99_ns\": %.0f}%s\n",
+            r.name.c_str(), static_cast<unsigned long>(r.iterations),
+            r.ns_per_op, r.bytes_per_sec, r.allocs_per_op, r.p50_ns,
+            r.p99_ns, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  return fclose(file) == 0;
+}
+
+static bool json_number(const std::string &line, const char *key,
+                        double &value) {
+  size_t at = line.find(std::string("\"") + key + "\":");
+  if (at == std::string::npos)
+    return false;
+  value = strtod(line.c_str() + at + strlen(key) + 3, nullptr);
+  return true;
+}
+
+bool Bench::read_json(const std::string &path, std::vector<result> &results) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "can't read " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t at = line.find("\"name\": \"");
+    if (at == std::string::npos)
+      continue;
+    size_t start = at + 9, end = line.find('"', start);
+    result r;
+    r.name = line.substr(start, end - start);
+    double value;
+    if (!json_number(line, "ns_per_op", r.ns_per_op))
+      continue;
+    if (json_number(line, "iterations", value))
+      r.iterations = static_cast<uint64_t>(value);
+    json_number(line, "bytes_per_sec", r.bytes_per_sec);
+    json_number(line, "allocs_per_op", r.allocs_per_op);
+    json_number(line, "p50_ns", r.p50_ns);
+    json_number(line, "p99_ns", r.p99_ns);
+    results.push_back(r);
+  }
+  return true;
+}
+
+/**
+ * @brief Regression: ns/op slower than threshold %, or more allocations
+ * per op than the baseline had (allocations don't depend on machine load)
+ */
+bool Bench::compare(const std::vector<result> &baseline,
+                    const std::vector<result> &current, double threshold) {
+  bool ok = true;
+  printf("\n%-36s %12s %12s %9s %10s\n", "benchmark", "base ns/op",
+         "ns/op", "change", "allocs/op");
+  for (const result &r : current) {
+    auto base = std::find_if(
+        baseline.begin(), baseline.end(),
+        [&r](const result &b) { return b.name == r.name; });
+    if (base == baseline.end()) {
+      printf("%-36s %12s %12.2f %9s %10.3f\n", r.name.c_str(), "-",
+             r.ns_per_op, "new", r.allocs_per_op);
+      continue;
+    }
+    double change = (r.ns_per_op - base->ns_per_op) / base->ns_per_op * 100;
+    bool slower = change > threshold;
+    bool allocs = r.allocs_per_op > base->allocs_per_op + 0.01;
+    printf("%-36s %12.2f %12.2f %+8.1f%% %10.3f%s\n", r.name.c_str(),
+           base->ns_per_op, r.ns_per_op, change, r.allocs_per_op,
+           slower ? "  REGRESSION" : allocs ? "  MORE ALLOCS" : "");
+    ok &= !slower && !allocs;
+  }
+  return ok;
+}
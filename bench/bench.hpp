@@ -0,0 +1,59 @@
+// bench
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#define BENCH_MIN_TIME_MS 100 // calibrated run lasts at least this long
+#define BENCH_SAMPLES 5       // runs per benchmark, median is reported
+#define BENCH_THRESHOLD 10.0  // % slower than baseline counted as regression
+#define BENCH_CHECKSUM_ROUNDS 20000 // random buffers checksum kernels sum
+
+namespace Bench {
+
+// One line of the report (and of the JSON file)
+struct result {
+  std::string name;
+  uint64_t iterations{0};
+  double ns_per_op{0};
+  double bytes_per_sec{0}; // 0 -> not a byte-oriented benchmark
+  double allocs_per_op{0};
+  double p50_ns{0}, p99_ns{0}; // latency benchmarks only
+};
+
+// Heap allocations so far (every operator new of the process)
+uint64_t allocations();
+
+/**
+ * @brief Time body(iterations) until one call lasts BENCH_MIN_TIME_MS,
+ * then take the median of BENCH_SAMPLES calls with that count.
+ * bytes: processed per iteration (0 -> no bytes/s)
+ */
+result measure(const std::string &name, size_t bytes,
+               const std::function<void(uint64_t)> &body);
+
+// Latency samples (ns) of iterations operations -> mean, p50, p99
+result latency(const std::string &name, std::vector<uint64_t> samples);
+
+// Suites append results of benchmarks whose name contains filter
+void network_suite(const std::string &filter, std::vector<result> &out);
+void threadpool_suite(const std::string &filter, std::vector<result> &out);
+void timer_suite(const std::string &filter, std::vector<result> &out);
+// Loopback bursts through SocketBackend and UringBackend (raw sockets)
+void io_backend_suite(const std::string &filter, std::vector<result> &out);
+
+/*---------------------------- REPORTING ----------------------------*/
+void print(const std::vector<result> &results);
+bool write_json(const std::string &path, const std::vector<result> &results);
+bool read_json(const std::string &path, std::vector<result> &results);
+// Table against baseline, true if nothing got slower than threshold %
+bool compare(const std::vector<result> &baseline,
+             const std::vector<result> &current, double threshold);
+
+// Keep compiler from dropping computations whose result is unused
+template <typename T> inline void keep(T const &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+}; // namespace Bench
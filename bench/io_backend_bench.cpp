@@ -0,0 +1,107 @@
+#include "../shared_resources/include/io_backend.hpp"
+#include "../shared_resources/include/uring_backend.hpp"
+#include "bench.hpp"
+
+#define IO_BENCH_PORT 9099     // loopback port bursts are sent to
+#define IO_BENCH_TIMEOUT_MS 50 // burst given up after this long (lost)
+
+static struct sockaddr_in loopback(int port) {
+  struct sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return addr;
+}
+
+/**
+ * @brief One iteration: BATCH_SIZE packets sent to ourselves over
+ * loopback and received back, the way the event loop drives a backend
+ * (send, flush, receive until the burst is in). Kernel's RSTs to the
+ * source port are dropped by the port filter, so only the burst arrives
+ */
+static void burst(Network::IoBackend &backend, unsigned char **packets,
+                  size_t *lengths, struct sockaddr_in *dests, uint64_t n) {
+  Network::Packet received[BATCH_SIZE];
+  for (uint64_t i = 0; i < n; ++i) {
+    backend.send(packets, lengths, dests, BATCH_SIZE);
+    backend.flush();
+    for (int got = 0, count; got < BATCH_SIZE; got += count) {
+      count =
+          backend.receive(received, BATCH_SIZE - got, IO_BENCH_TIMEOUT_MS);
+      if (count == 0)
+        break;
+    }
+  }
+}
+
+// Raw socket seeing only packets to IO_BENCH_PORT, -1 without CAP_NET_RAW
+static int bench_socket() {
+  int sockfd = socket(AF_INET, SOCK_RAW, IPPROTO_TCP);
+  int on = 1;
+  if (sockfd >= 0 &&
+      (setsockopt(sockfd, IPPROTO_IP, IP_HDRINCL, &on, sizeof(on)) < 0 ||
+       !Network::attach_port_filter(sockfd, IO_BENCH_PORT))) {
+    close(sockfd);
+    sockfd = -1;
+  }
+  return sockfd;
+}
+
+void Bench::io_backend_suite(const std::string &filter,
+                             std::vector<result> &out) {
+  auto wanted = [&filter](const std::string &name) {
+    return name.find(filter) != std::string::npos;
+  };
+  struct sockaddr_in src = loopback(40000), dst = loopback(IO_BENCH_PORT);
+  std::vector<unsigned char> buffers(BATCH_SIZE * DATAGRAM_SIZE);
+  unsigned char *packets[BATCH_SIZE];
+  size_t lengths[BATCH_SIZE];
+  struct sockaddr_in dests[BATCH_SIZE];
+
+  // every raw socket gets a copy of the burst: one socket per backend,
+  // closed before the next backend's runs
+  for (const char *kind : {"socket", "uring"}) {
+    std::vector<size_t> sizes;
+    for (size_t size : {64, 1400})
+      if (wanted(std::string("io_backend/") + kind + "/" +
+                 std::to_string(size)))
+        sizes.push_back(size);
+    if (sizes.empty())
+      continue;
+    int sockfd = bench_socket();
+    if (sockfd < 0) {
+      std::cerr << "io_backend: no raw socket (needs CAP_NET_RAW), skipped"
+                << std::endl;
+      return;
+    }
+    std::unique_ptr<Network::IoBackend> backend;
+    if (std::string(kind) == "socket") {
+      backend = std::make_unique<Network::SocketBackend>(sockfd);
+    } else {
+      auto uring = std::make_unique<Network::UringBackend>();
+      if (uring->open(sockfd))
+        backend = std::move(uring);
+      else
+        std::cerr << "io_backend: no io_uring, skipped" << std::endl;
+    }
+    for (size_t size : sizes) {
+      if (!backend)
+        break;
+      const std::string payload(size, 'x');
+      for (unsigned i = 0; i < BATCH_SIZE; ++i) {
+        packets[i] = buffers.data() + i * DATAGRAM_SIZE;
+        lengths[i] = Network::build_packet(
+            packets[i], DATAGRAM_SIZE, &src, &dst, 200 + i, 101,
+            TH_PUSH | TH_ACK, 0, payload.data(), payload.size());
+        dests[i] = dst;
+      }
+      std::string name =
+          std::string("io_backend/") + kind + "/" + std::to_string(size);
+      out.push_back(measure(name, BATCH_SIZE * lengths[0], [&](uint64_t n) {
+        burst(*backend, packets, lengths, dests, n);
+      }));
+    }
+    backend.reset(); // ring torn down before its socket
+    close(sockfd);
+  }
+}
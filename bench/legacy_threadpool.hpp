@@ -0,0 +1,60 @@
+// legacy thread pool
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The pool before the lock-free rewrite, kept for the benchmarks
+ * only: one mutex-guarded queue of std::function, every enqueue locks
+ * and notifies. threadpool_suite runs it next to ThreadPool
+ */
+class LegacyThreadPool {
+private:
+  std::vector<std::thread> threads;
+  std::queue<std::function<void()>> tasks;
+  std::condition_variable cond;
+  std::mutex qMutex;
+  bool stop{false};
+
+public:
+  explicit LegacyThreadPool(int numThr) {
+    for (int i = 0; i < numThr; ++i) {
+      threads.emplace_back([this]() {
+        while (true) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(qMutex);
+            cond.wait(lock, [this] { return stop || !tasks.empty(); });
+            if (stop && tasks.empty())
+              return;
+            task = std::move(tasks.front());
+            tasks.pop();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  ~LegacyThreadPool() {
+    {
+      std::unique_lock<std::mutex> lock(qMutex);
+      stop = true;
+    }
+    cond.notify_all();
+    for (std::thread &worker : threads)
+      worker.join();
+  }
+
+  void enqueue(std::function<void()> task) {
+    {
+      std::unique_lock<std::mutex> lock(qMutex);
+      tasks.push(std::move(task));
+    }
+    cond.notify_one();
+  }
+};
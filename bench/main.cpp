@@ -0,0 +1,56 @@
+#include "../shared_resources/include/network.hpp"
+#include "bench.hpp"
+#include <iostream>
+#include <thread>
+
+int main(int argc, char *argv[]) {
+  std::string json, baseline, filter;
+  double threshold = BENCH_THRESHOLD;
+  bool valid = true;
+  for (int i = 1; valid && i < argc; ++i) {
+    std::string opt = argv[i];
+    if (opt == "--json" && i + 1 < argc)
+      json = argv[++i];
+    else if (opt == "--compare" && i + 1 < argc)
+      baseline = argv[++i];
+    else if (opt == "--threshold" && i + 1 < argc)
+      threshold = std::stod(argv[++i]);
+    else if (opt == "--filter" && i + 1 < argc)
+      filter = argv[++i];
+    else
+      valid = false;
+  }
+  if (!valid) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--json <file>] [--compare <baseline.json>] "
+                 "[--threshold <percent>] [--filter <name substring>]"
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<Bench::result> base;
+  if (!baseline.empty() && !Bench::read_json(baseline, base))
+    return 1;
+
+  // a fast kernel that sums wrong isn't worth timing
+  if (const char *kernel = Network::checksum_check(BENCH_CHECKSUM_ROUNDS)) {
+    std::cerr << "checksum kernel " << kernel
+              << " differs from checksum_reference" << std::endl;
+    return 3;
+  }
+  std::cout << "checksum kernel: " << Network::checksum_kernel_name()
+            << ", cpus: " << std::thread::hardware_concurrency() << "\n\n";
+  std::vector<Bench::result> results;
+  Bench::network_suite(filter, results);
+  Bench::threadpool_suite(filter, results);
+  Bench::timer_suite(filter, results);
+  Bench::io_backend_suite(filter, results);
+  Bench::print(results);
+
+  if (!json.empty() && !Bench::write_json(json, results))
+    return 1;
+  // non-zero exit lets scripts (and make) fail on regressions
+  if (!baseline.empty() && !Bench::compare(base, results, threshold))
+    return 2;
+  return 0;
+}
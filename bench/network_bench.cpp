@@ -0,0 +1,182 @@
+#include "../shared_resources/include/network.hpp"
+#include "../shared_resources/include/syn_cookie.hpp"
+#include "../shared_resources/include/congestion.hpp"
+#include "bench.hpp"
+#include <cstdlib>
+
+// Addresses and payload every packet benchmark uses
+static struct sockaddr_in address(const char *ip, int port) {
+  struct sockaddr_in addr {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, ip, &addr.sin_addr);
+  return addr;
+}
+
+void Bench::network_suite(const std::string &filter,
+                          std::vector<result> &out) {
+  auto wanted = [&filter](const std::string &name) {
+    return name.find(filter) != std::string::npos;
+  };
+  struct sockaddr_in src = address("10.0.0.1", 40000);
+  struct sockaddr_in dst = address("10.0.0.2", 9000);
+  const std::string payload(64, 'x');
+
+  /*----------------------------- checksum -----------------------------*/
+  std::vector<unsigned char> data(9000);
+  srand(1);
+  for (auto &byte : data)
+    byte = static_cast<unsigned char>(rand());
+  for (unsigned size : {20u, 64u, 512u, 1460u, 9000u}) {
+    std::string name = "checksum/" + std::to_string(size);
+    if (wanted(name))
+      out.push_back(measure(name, size, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i)
+          keep(Network::checksum(data.data(), size));
+      }));
+    name = "checksum_reference/" + std::to_string(size);
+    if (wanted(name))
+      out.push_back(measure(name, size, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i)
+          keep(Network::checksum_reference(data.data(), size));
+      }));
+  }
+
+  /*-------------------------- construction ---------------------------*/
+  if (wanted("create_ack_packet"))
+    out.push_back(measure("create_ack_packet", REQUEST_SIZE, [&](uint64_t n) {
+      std::unique_ptr<unsigned char[]> packet;
+      int size;
+      for (uint64_t i = 0; i < n; ++i) {
+        Network::create_ack_packet(&src, &dst, 200, 101, packet, &size);
+        keep(packet.get());
+      }
+    }));
+  if (wanted("create_data_packet/64"))
+    out.push_back(measure(
+        "create_data_packet/64",
+        sizeof(struct iphdr) + sizeof(struct tcphdr) + payload.size(),
+        [&](uint64_t n) {
+          std::unique_ptr<unsigned char[]> packet;
+          int size;
+          for (uint64_t i = 0; i < n; ++i) {
+            Network::create_data_packet(&src, &dst, 200, 101, payload, packet,
+                                        &size);
+            keep(packet.get());
+          }
+        }));
+  // same packet into caller's buffer, what the serving paths use
+  if (wanted("build_packet/64"))
+    out.push_back(measure(
+        "build_packet/64",
+        sizeof(struct iphdr) + sizeof(struct tcphdr) + payload.size(),
+        [&](uint64_t n) {
+          unsigned char buffer[DATAGRAM_SIZE];
+          for (uint64_t i = 0; i < n; ++i)
+            keep(Network::build_packet(buffer, sizeof(buffer), &src, &dst, 200,
+                                       101, TH_PUSH | TH_ACK, 0,
+                                       payload.data(), payload.size()));
+        }));
+
+  // SYN with every option, ACK with timestamps (fixed layouts)
+  if (wanted("build_packet/syn_options"))
+    out.push_back(measure("build_packet/syn_options", REQUEST_SIZE,
+                          [&](uint64_t n) {
+                            unsigned char buffer[REQUEST_SIZE];
+                            Network::tcp_options syn =
+                                Network::tcp_session::offer();
+                            for (uint64_t i = 0; i < n; ++i)
+                              keep(Network::build_packet<Network::syn_layout>(
+                                  buffer, sizeof(buffer), &src, &dst, 100, 0,
+                                  TH_SYN, syn, TCP_WINDOW_MAX, nullptr, 0));
+                          }));
+  if (wanted("build_segment/timestamps/64"))
+    out.push_back(measure(
+        "build_segment/timestamps/64",
+        PAYLOAD_OFFSET + Network::ts_layout::size + payload.size(),
+        [&](uint64_t n) {
+          unsigned char buffer[DATAGRAM_SIZE];
+          Network::tcp_session session;
+          session.negotiate(Network::tcp_session::offer());
+          for (uint64_t i = 0; i < n; ++i)
+            keep(Network::build_segment(buffer, sizeof(buffer), &src, &dst,
+                                        200, 101, TH_PUSH | TH_ACK, session,
+                                        payload.data(), payload.size()));
+        }));
+
+  /*----------------------------- parsing -----------------------------*/
+  if (wanted("parse_packet/64")) {
+    Network::Packet packet;
+    packet.data.reset(new unsigned char[DATAGRAM_SIZE]);
+    packet.size = Network::build_packet(packet.data.get(), DATAGRAM_SIZE, &src,
+                                        &dst, 200, 101, TH_PUSH | TH_ACK, 0,
+                                        payload.data(), payload.size());
+    out.push_back(measure("parse_packet/64", packet.size, [&](uint64_t n) {
+      uint32_t seq, ack;
+      struct sockaddr_in source {};
+      for (uint64_t i = 0; i < n; ++i)
+        keep(Network::parse_packet(packet, &seq, &ack, source).payload());
+    }));
+  }
+
+  // walk of a SYN's options against the timestamps-only fast path
+  if (wanted("parse_options/syn")) {
+    unsigned char raw[Network::syn_layout::size];
+    Network::syn_layout::write(raw, Network::tcp_session::offer());
+    std::string_view options(reinterpret_cast<char *>(raw), sizeof(raw));
+    out.push_back(measure("parse_options/syn", sizeof(raw), [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i)
+        keep(Network::parse_options(options).tsval);
+    }));
+  }
+  if (wanted("parse_options/timestamps")) {
+    unsigned char raw[Network::ts_layout::size];
+    Network::ts_layout::write(raw, Network::tcp_session().stamp());
+    std::string_view options(reinterpret_cast<char *>(raw), sizeof(raw));
+    out.push_back(
+        measure("parse_options/timestamps", sizeof(raw), [&](uint64_t n) {
+          for (uint64_t i = 0; i < n; ++i)
+            keep(Network::parse_options(options).tsval);
+        }));
+  }
+
+  /*--------------------------- SYN cookies ---------------------------*/
+  // what a flood SYN costs (make) and a returning ACK (check)
+  Network::SynCookies cookies;
+  Network::flow_key key = Network::make_flow_key(src, dst);
+  if (wanted("syn_cookie/make"))
+    out.push_back(measure("syn_cookie/make", 0, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i)
+        keep(cookies.make(key, static_cast<uint32_t>(i)));
+    }));
+  if (wanted("syn_cookie/check")) {
+    uint32_t cookie = cookies.make(key, 100);
+    out.push_back(measure("syn_cookie/check", 0, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i)
+        keep(cookies.check(key, 100, cookie));
+    }));
+  }
+
+  /*------------------------ congestion control ------------------------*/
+  // per response in pipelined mode: ACK of a 64 byte request, a loss
+  // every 1000 ACKs keeps the window in avoidance
+  for (const char *algorithm : {"newreno", "cubic"}) {
+    std::string name = std::string("congestion/") + algorithm;
+    if (!wanted(name))
+      continue;
+    auto cc = Network::make_congestion_control(algorithm);
+    out.push_back(measure(name, 0, [&](uint64_t n) {
+      Network::congestion_state state(LOCAL_MSS);
+      uint32_t seq = 0;
+      uint64_t now = 1;
+      for (uint64_t i = 1; i <= n; ++i) {
+        seq += 64;
+        now += 10000;
+        if (i % 1000 == 0)
+          cc->on_loss(state, seq, now);
+        cc->on_ack(state, seq, 64, 1000000, now);
+      }
+      keep(state.cwnd);
+    }));
+  }
+}
@@ -0,0 +1,66 @@
+#include "../shared_resources/include/threadpool.hpp"
+#include "bench.hpp"
+#include "legacy_threadpool.hpp"
+#include <chrono>
+
+#define LATENCY_ROUNDS 2000 // one task in flight at a time
+
+static uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/**
+ * @brief Same runs for any pool with enqueue(callable), names prefixed
+ * with kind ("threadpool", "legacy_threadpool")
+ */
+template <typename Pool>
+static void pool_runs(const std::string &kind, const std::string &filter,
+                      std::vector<Bench::result> &out) {
+  for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+    std::string throughput = kind + "/enqueue/" + std::to_string(threads);
+    std::string latency_name = kind + "/latency/" + std::to_string(threads);
+    bool want_throughput = throughput.find(filter) != std::string::npos;
+    bool want_latency = latency_name.find(filter) != std::string::npos;
+    if (!want_throughput && !want_latency)
+      continue;
+    Pool pool(threads);
+
+    // tasks submitted from outside the pool, time until all of them ran
+    if (want_throughput) {
+      std::atomic<uint64_t> done{0};
+      out.push_back(Bench::measure(throughput, 0, [&](uint64_t n) {
+        done.store(0);
+        for (uint64_t i = 0; i < n; ++i)
+          pool.enqueue([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        while (done.load(std::memory_order_acquire) < n)
+          std::this_thread::yield();
+      }));
+    }
+
+    // enqueue -> task starts running, workers mostly parked in between
+    if (want_latency) {
+      std::vector<uint64_t> samples;
+      samples.reserve(LATENCY_ROUNDS);
+      std::atomic<uint64_t> started{0};
+      for (int i = 0; i < LATENCY_ROUNDS; ++i) {
+        started.store(0);
+        uint64_t submitted = now_ns();
+        pool.enqueue([&started] { started.store(now_ns()); });
+        uint64_t at;
+        while ((at = started.load(std::memory_order_acquire)) == 0)
+          std::this_thread::yield();
+        samples.push_back(at - submitted);
+      }
+      out.push_back(Bench::latency(latency_name, std::move(samples)));
+    }
+  }
+}
+
+void Bench::threadpool_suite(const std::string &filter,
+                             std::vector<result> &out) {
+  pool_runs<ThreadPool>("threadpool", filter, out);
+  // baseline the lock-free pool replaced
+  pool_runs<LegacyThreadPool>("legacy_threadpool", filter, out);
+}
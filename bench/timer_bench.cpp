@@ -0,0 +1,54 @@
+#include "../shared_resources/include/timer_wheel.hpp"
+#include "bench.hpp"
+#include <memory>
+#include <random>
+
+#define TIMERS_ARMED 100000 // background timers, as many connections
+
+/**
+ * @brief Arm/cancel cost must not grow with timers armed: every
+ * benchmark runs with TIMERS_ARMED others spread over 0..200 s
+ */
+void Bench::timer_suite(const std::string &filter, std::vector<result> &out) {
+  auto wanted = [&filter](const std::string &name) {
+    return name.find(filter) != std::string::npos;
+  };
+  if (!wanted("timer/rearm") && !wanted("timer/arm_cancel") &&
+      !wanted("timer/advance"))
+    return;
+  Network::TimerWheel wheel(0);
+  std::unique_ptr<Network::Timer[]> background(
+      new Network::Timer[TIMERS_ARMED]);
+  std::mt19937_64 random(1);
+  for (size_t i = 0; i < TIMERS_ARMED; ++i)
+    wheel.arm(background[i], random() % 200000 * WHEEL_TICK_NS);
+
+  // connection saw traffic: idle timer pushed back
+  if (wanted("timer/rearm")) {
+    Network::Timer timer;
+    out.push_back(measure("timer/rearm", 0, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i)
+        wheel.arm(timer, (i % 200000 + 1) * WHEEL_TICK_NS);
+    }));
+  }
+
+  // request answered before its RTO
+  if (wanted("timer/arm_cancel")) {
+    Network::Timer timer;
+    out.push_back(measure("timer/arm_cancel", 0, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i) {
+        wheel.arm(timer, RTO_INITIAL_MS * 1000000ULL);
+        wheel.cancel(timer);
+      }
+    }));
+  }
+
+  // one tick of an event loop with nothing due
+  if (wanted("timer/advance")) {
+    uint64_t now = 0;
+    out.push_back(measure("timer/advance", 0, [&](uint64_t n) {
+      for (uint64_t i = 0; i < n; ++i)
+        keep(wheel.advance(now += WHEEL_TICK_NS));
+    }));
+  }
+}
@@ -17,6 +17,7 @@ Client::~Client() { Network::close_socket(this->client_sockfd); }
  * parse packet
  * on receival of ACK send ACK
  * log "ESTABLISHED"
+ * narrow socket filter down to the server
  */
 bool Client::connect() {
   // create client communication socket
@@ -26,36 +27,256 @@ bool Client::connect() {
   // connect client socket to server
   if (!Network::connect_to_server(client_sockfd, clt_addr, srv_addr,
                                   this->ip.c_str(), this->port, &seq_num,
-                                  &ack_num))
+                                  &ack_num, tcp))
     return false;
+  // from now on only the server is of interest
+  Network::attach_port_filter(client_sockfd, ntohs(clt_addr.sin_port),
+                              {srv_addr});
   setuid(getuid()); // no need in sudo privileges anymore
   return true;
 }
 
 /**
  * @brief Send packet to server, increment sequence
+ * packet is built in place, kept until answered for retransmission
  */
 void Client::send_request(const std::string &data) {
   if (this->seq_num != 0)
     this->seq_num++;
   /*---------------------------*/
-  std::unique_ptr<unsigned char[]> packet;
-  int packet_size{0};
-  Network::create_data_packet(&clt_addr, &srv_addr, seq_num, ack_num, data,
-                              packet, &packet_size);
-  Network::send_packet(client_sockfd, packet.get(), packet_size, srv_addr);
+  last_length = Network::build_segment(
+      last_request, sizeof(last_request), &clt_addr, &srv_addr, seq_num,
+      ack_num, TH_PUSH | TH_ACK, tcp, data.data(), data.size());
+  if (last_length == 0)
+    return;
+  last_sent = Network::Metrics::now();
+  Network::send_packet(client_sockfd, last_request, last_length, srv_addr);
 }
 
 /**
  * @brief Listen for all packets, filter by self-port
  * in destination field of TCP header
- * parse and log the packet
+ * parse and log the packet; nothing within RTO -> send request again
+ * with RTO doubled. Round trip is sampled only if nothing was resent
+ * (Karn), segments without payload are skipped
  */
 void Client::receive_response(std::string &data) {
-  auto response = std::make_unique<unsigned char[]>(DATAGRAM_SIZE);
-  Network::receive_packet(client_sockfd, response.get(), DATAGRAM_SIZE,
-                          clt_addr);
+  Network::Packet response;
+  response.data = Network::BufferPool::instance().acquire();
+  data.clear();
+  for (int resent = 0;;) {
+    struct pollfd pfd {};
+    pfd.fd = client_sockfd;
+    pfd.events = POLLIN;
+    if (::poll(&pfd, 1, rtt.rto_ms()) <= 0) {
+      if (last_length == 0 || resent == RETRIES_MAX) {
+        std::cerr << "no response, request resent " << resent << " times"
+                  << std::endl;
+        return;
+      }
+      ++resent;
+      rtt.backoff();
+      if (tcp.timestamps)
+        Network::restamp(last_request, Network::tcp_timestamp());
+      Network::send_packet(client_sockfd, last_request, last_length,
+                           srv_addr);
+      continue;
+    }
+    ssize_t received = Network::receive_packet(
+        client_sockfd, response.data.get(), DATAGRAM_SIZE, clt_addr);
+    if (received < 0) {
+      std::cerr << "no response, receiving failed" << std::endl;
+      return;
+    }
+    response.size = received;
+    Network::PacketView view =
+        Network::parse_packet(response, &seq_num, &ack_num, srv_addr);
+    if (view.payload().empty())
+      continue;
+    sample(tcp.received(view), resent, last_sent);
+    data.assign(view.payload());
+    return;
+  }
+}
+
+/*---------------------------- PIPELINED MODE ----------------------------*/
+
+/**
+ * @brief Requests get sequence numbers of their own (advancing by their
+ * length, as TCP does), Server's response acknowledges them
+ */
+void Client::set_window(unsigned window) {
+  this->window = window ? window : 1;
+  next_seq = seq_num + 1;
+  cc = Network::congestion_state(tcp.mss);
+  if (!backend)
+    backend = std::make_unique<Network::SocketBackend>(client_sockfd);
+}
+
+void Client::use_congestion_control(
+    std::shared_ptr<Network::CongestionControl> algorithm) {
+  congestion = std::move(algorithm);
+}
+
+uint32_t Client::send_window() const {
+  return congestion ? std::min(tcp.snd_wnd, cc.cwnd) : tcp.snd_wnd;
+}
+
+/**
+ * @brief Each request has a timer on the client's wheel, armed with RTO
+ */
+void Client::send_async(const std::string &data, response_callback done) {
+  while (in_flight.size() >= window ||
+         (!in_flight.empty() &&
+          in_flight_bytes + data.size() > send_window()))
+    poll(-1);
+  unsigned char packet[DATAGRAM_SIZE];
+  size_t packet_size = Network::build_segment(
+      packet, sizeof(packet), &clt_addr, &srv_addr, next_seq, ack_num,
+      TH_PUSH | TH_ACK, tcp, data.data(), data.size());
+  if (packet_size == 0) {
+    done(false, {});
+    return;
+  }
+  next_seq += data.size();
+  in_flight_bytes += data.size();
+  pending_request &request = in_flight.emplace_back();
+  pending_iterator it = std::prev(in_flight.end());
+  request.ack = next_seq;
+  request.length = data.size();
+  request.sent = Network::Metrics::now();
+  request.rto = rtt.rto;
+  request.done = std::move(done);
+  request.packet.assign(reinterpret_cast<char *>(packet), packet_size);
+  request.timer.callback = [this, it] { retransmit(it); };
+  timers.arm(request.timer, request.rto);
+  Network::send_packet(client_sockfd, packet, packet_size, srv_addr);
+}
+
+std::future<std::string> Client::send_async(const std::string &data) {
+  auto promise = std::make_shared<std::promise<std::string>>();
+  std::future<std::string> future = promise->get_future();
+  send_async(data, [promise](bool ok, const std::string &response) {
+    if (ok)
+      promise->set_value(response);
+    else
+      promise->set_exception(std::make_exception_ptr(
+          std::runtime_error("no response to pipelined request")));
+  });
+  return future;
+}
+
+// Wait ends early when a retransmission is due
+int Client::poll(int timeout_ms) {
+  size_t before = in_flight.size();
+  int due = timers.timeout_ms();
+  if (due >= 0 && (timeout_ms < 0 || due < timeout_ms))
+    timeout_ms = due;
+  int received = backend->receive(burst, BATCH_SIZE, timeout_ms);
+  while (received > 0) {
+    for (int i = 0; i < received; ++i)
+      complete(burst[i]);
+    if (received < BATCH_SIZE)
+      break;
+    received = backend->receive(burst, BATCH_SIZE, 0);
+  }
+  timers.advance(Network::Metrics::now());
+  return static_cast<int>(before - in_flight.size());
+}
+
+void Client::drain() {
+  while (!in_flight.empty())
+    poll(-1);
+}
 
-  Network::parse_packet(response, &seq_num, &ack_num, srv_addr);
-  data.assign(reinterpret_cast<const char *>(response.get()));
+/**
+ * @brief Response acknowledging a request's last byte completes it.
+ * No exact match (proxy rewrote payload, so lengths Server saw differ)
+ * -> oldest request, responses come back in order. Congestion control
+ * sees the start of the oldest request still unanswered as cumulative
+ * ACK, the way a receiver with a hole would acknowledge
+ */
+void Client::complete(const Network::Packet &packet) {
+  Network::PacketView view =
+      Network::parse_packet(packet, &seq_num, &ack_num, srv_addr);
+  if (!view.valid() || view.payload().empty() || in_flight.empty())
+    return;
+  ack_num = view.seq() + view.payload().size();
+  auto match = in_flight.begin();
+  for (auto it = in_flight.begin(); it != in_flight.end(); ++it)
+    if (it->ack == view.ack_seq()) {
+      match = it;
+      break;
+    }
+  sample(tcp.received(view), match->retries, match->sent);
+  if (match != in_flight.begin() &&
+      ++in_flight.front().skipped == DUPACK_THRESHOLD)
+    fast_retransmit(in_flight.begin());
+  uint32_t acked = match->length;
+  response_callback done = std::move(match->done);
+  in_flight_bytes -= match->length;
+  in_flight.erase(match); // its timer is cancelled with it
+  if (congestion) {
+    uint32_t cumulative = next_seq;
+    if (!in_flight.empty())
+      cumulative = in_flight.front().ack - in_flight.front().length;
+    congestion->on_ack(cc, cumulative, acked, rtt.srtt,
+                       Network::Metrics::now());
+  }
+  done(true, std::string(view.payload()));
+}
+
+/**
+ * @brief RTO passed without response: resend with its RTO doubled, or
+ * give up. Timers of a whole window fire together when the path goes
+ * quiet, so only the oldest request's timeout backs off the shared RTO
+ * and cuts the window - once per timeout episode, not once per request
+ */
+void Client::retransmit(pending_iterator request) {
+  if (request->retries == RETRIES_MAX) {
+    response_callback done = std::move(request->done);
+    in_flight_bytes -= request->length;
+    in_flight.erase(request);
+    done(false, {});
+    return;
+  }
+  ++request->retries;
+  request->rto =
+      std::min<uint64_t>(request->rto * 2, RTO_MAX_MS * 1000000ULL);
+  if (request == in_flight.begin()) {
+    rtt.backoff();
+    if (congestion)
+      congestion->on_timeout(cc, Network::Metrics::now());
+  }
+  resend(*request);
+}
+
+// Window is cut once, retransmission timer starts over (no backoff)
+void Client::fast_retransmit(pending_iterator request) {
+  ++request->retries;
+  request->rto = rtt.rto;
+  if (congestion)
+    congestion->on_loss(cc, next_seq, Network::Metrics::now());
+  resend(*request);
+}
+
+void Client::resend(pending_request &request) {
+  unsigned char *packet = reinterpret_cast<unsigned char *>(&request.packet[0]);
+  if (tcp.timestamps)
+    Network::restamp(packet, Network::tcp_timestamp());
+  Network::send_packet(client_sockfd, packet, request.packet.size(),
+                       srv_addr);
+  timers.arm(request.timer, request.rto);
+}
+
+/**
+ * @brief Echoed TSval tells which transmission was answered, so even a
+ * resent request gives a sample (RFC 7323), ms resolution only
+ */
+void Client::sample(const Network::tcp_options &options, unsigned retries,
+                    uint64_t sent) {
+  if (retries == 0)
+    rtt.sample(Network::Metrics::now() - sent);
+  else if (options.timestamps && options.tsecr != 0)
+    rtt.sample((Network::tcp_timestamp() - options.tsecr) * 1000000ULL);
 }
@@ -1,6 +1,20 @@
 // client
 #pragma once
+#include "../shared_resources/include/buffer_pool.hpp"
+#include "../shared_resources/include/congestion.hpp"
+#include "../shared_resources/include/io_backend.hpp"
+#include "../shared_resources/include/metrics.hpp"
 #include "../shared_resources/include/network.hpp"
+#include "../shared_resources/include/timer_wheel.hpp"
+#include <functional>
+#include <future>
+#include <list>
+#include <poll.h>
+
+// Completion of a pipelined request: ok = false -> no response, even
+// after RETRIES_MAX retransmissions
+using response_callback =
+    std::function<void(bool ok, const std::string &response)>;
 
 class Client {
 public:
@@ -11,17 +25,84 @@ public:
   // TODO: maybe implement some authentication
   //  so the proxy ain't meaningless
   void send_request(const std::string &data);
+  // Request is retransmitted after RTO without response (RETRIES_MAX
+  // times, backing off), data is empty if none ever came
   virtual void receive_response(std::string &data);
 
+  /*------------------------- PIPELINED MODE -------------------------*/
+  // Keep up to window requests in flight instead of stop-and-wait (and
+  // no more bytes than Server's advertised window)
+  void set_window(unsigned window);
+  // Also no more bytes than congestion window of algorithm (none by
+  // default); requests answered out of order count as loss signals
+  void use_congestion_control(
+      std::shared_ptr<Network::CongestionControl> algorithm);
+  // Send as soon as window has room (receiving meanwhile), done runs on
+  // the calling thread from send_async(), poll() or drain() and may send
+  // the next request
+  void send_async(const std::string &data, response_callback done);
+  // Same, response through a future (exception if none came)
+  std::future<std::string> send_async(const std::string &data);
+  // Receive (and retransmit) for at most timeout_ms, returns requests
+  // completed or failed
+  int poll(int timeout_ms);
+  // Until every request completed or failed
+  void drain();
+  size_t outstanding() const { return in_flight.size(); }
+  /*------------------------------------------------------------------*/
+
 protected:
   int client_sockfd;
   struct sockaddr_in srv_addr;
   struct sockaddr_in clt_addr;
+  // batched non-blocking receive (pipelined mode, load generator)
+  std::unique_ptr<Network::IoBackend> backend;
+  // retransmission timers and timeout (pipelined mode, stop-and-wait)
+  Network::TimerWheel timers;
+  Network::RttEstimator rtt;
+  Network::tcp_session tcp; // options negotiated with Server
 
 private:
+  // Request in flight, answered by response acknowledging its bytes
+  struct pending_request {
+    uint32_t ack; // seq + length of request
+    size_t length;
+    uint64_t sent;
+    uint64_t rto; // ns, own copy, doubled by each of its timeouts
+    unsigned retries{0};
+    unsigned skipped{0}; // later requests answered first
+    response_callback done;
+    std::string packet; // as sent, for retransmission
+    Network::Timer timer;
+  };
+  using pending_iterator = std::list<pending_request>::iterator;
+  void complete(const Network::Packet &packet);
+  void retransmit(pending_iterator request);
+  // DUPACK_THRESHOLD later requests answered: resend before RTO
+  void fast_retransmit(pending_iterator request);
+  void resend(pending_request &request);
+  // Bytes allowed in flight: peer's window, congestion window
+  uint32_t send_window() const;
+  // Round trip of a response: from send time unless resent (Karn), then
+  // from the timestamp it echoes, if any
+  void sample(const Network::tcp_options &options, unsigned retries,
+              uint64_t sent);
+
   std::string self_ip;
   std::string ip;
   int port;
 
   uint32_t seq_num, ack_num = 0;
+  // stop-and-wait: last request, resent until answered
+  unsigned char last_request[DATAGRAM_SIZE];
+  size_t last_length{0};
+  uint64_t last_sent{0};
+
+  unsigned window{1};
+  uint32_t next_seq{0}; // of next pipelined request
+  size_t in_flight_bytes{0};
+  std::shared_ptr<Network::CongestionControl> congestion;
+  Network::congestion_state cc;
+  std::list<pending_request> in_flight; // oldest first, nodes stay put
+  Network::Packet burst[BATCH_SIZE];
 };
@@ -0,0 +1,296 @@
+#include "load_generator.hpp"
+#include <algorithm>
+#include <cstdio>
+
+LoadGenerator::LoadGenerator(const std::string &self_ip, const std::string &ip,
+                             int port, const load_options &options)
+    : Client(self_ip, ip, port), local_ip(self_ip), srv_ip(ip),
+      srv_port(port), options(options), payload(options.payload, 'x') {
+  conns.resize(options.connections);
+  for (unsigned i = 0; i < options.connections; ++i)
+    conns[i].port = htons(options.first_port + i);
+}
+
+/**
+ * @brief Create raw socket towards Server, one filter passes Server's
+ * packets to every port of the range (same as Proxy's upstream)
+ */
+bool LoadGenerator::connect() {
+  // flood needs at least one port above the connections'
+  unsigned ports = options.connections + (options.syn_flood > 0 ? 1 : 0);
+  if (options.connections == 0 || options.first_port + ports - 1 > 65535) {
+    std::cerr << "port range doesn't fit " << options.connections
+              << " connections" << std::endl;
+    return false;
+  }
+  if (Network::create_client_socket(client_sockfd, clt_addr,
+                                    local_ip.c_str()) < 0)
+    return false;
+  memset(&(Client::srv_addr), 0, sizeof(Client::srv_addr));
+  Client::srv_addr.sin_family = AF_INET;
+  Client::srv_addr.sin_port = htons(srv_port);
+  if (inet_pton(AF_INET, srv_ip.c_str(), &(Client::srv_addr).sin_addr) != 1) {
+    std::cerr << "destination IP configuration failed" << std::endl;
+    return false;
+  }
+  if (!Network::attach_range_filter(
+          client_sockfd, options.first_port,
+          options.first_port + options.connections - 1, {Client::srv_addr}))
+    return false;
+  // thousands of connections answer in bursts, default buffer drops them
+  int rcvbuf = LOAD_RCVBUF;
+  if (setsockopt(client_sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+                 sizeof(rcvbuf)) < 0)
+    setsockopt(client_sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  backend = std::make_unique<Network::SocketBackend>(client_sockfd);
+  setuid(getuid()); // no need in sudo privileges anymore
+  return true;
+}
+
+/**
+ * @brief Handshakes of every connection (resent until answered), then
+ * load until duration is over, then whatever is still in flight gets
+ * LOAD_TIMEOUT_MS to come back before the summary
+ */
+bool LoadGenerator::run() {
+  uint64_t start = Network::Metrics::now();
+  uint64_t now = start;
+  flood_start = start;
+  while (established < conns.size() &&
+         now - start < LOAD_HANDSHAKE_MS * 1000000ULL) {
+    send_flood(now);
+    send_syns(now);
+    flush();
+    receive(10);
+    now = Network::Metrics::now();
+  }
+  printf("%u/%zu connections established in %.1f ms\n", established,
+         conns.size(), (now - start) / 1e6);
+  if (established == 0)
+    return false;
+
+  start = last_report = now;
+  uint64_t end = start + options.duration * 1000000000ULL;
+  while (now < end) {
+    send_flood(now);
+    send_requests(now, start);
+    flush();
+    receive(options.rate > 0 ? 1 : 10);
+    now = Network::Metrics::now();
+    if (now - last_report >= LOAD_REPORT_MS * 1000000ULL) {
+      expire(now);
+      report(now, start, false);
+    }
+  }
+  uint64_t drain = now + LOAD_TIMEOUT_MS * 1000000ULL;
+  while (in_flight > 0 && now < drain) {
+    receive(10);
+    now = Network::Metrics::now();
+  }
+  expire(drain);
+  report(std::min(now, end), start, true);
+  return true;
+}
+
+// SYN from every connection not answered yet (again after retry period)
+void LoadGenerator::send_syns(uint64_t now) {
+  unsigned burst_left = LOAD_BURST;
+  for (sim_connection &conn : conns) {
+    if (burst_left == 0)
+      return;
+    if (conn.state != sim_connection::State::SynSent ||
+        (conn.syn_sent && now - conn.syn_sent < LOAD_SYN_RETRY_MS * 1000000ULL))
+      continue;
+    conn.syn_sent = now;
+    queue(conn, TH_SYN, nullptr, 0);
+    --burst_left;
+  }
+}
+
+/**
+ * @brief As many SYNs as syn_flood says should have gone out by now,
+ * each from the next port above the connections' with a new ISN
+ */
+void LoadGenerator::send_flood(uint64_t now) {
+  if (options.syn_flood <= 0)
+    return;
+  uint64_t total =
+      static_cast<uint64_t>(options.syn_flood * (now - flood_start) / 1e9);
+  uint64_t due = std::min<uint64_t>(total > flooded ? total - flooded : 0,
+                                    LOAD_BURST);
+  unsigned first = options.first_port + options.connections;
+  unsigned count = 65536 - first;
+  for (; due > 0; --due, ++flooded) {
+    flooder.port = htons(first + flooded % count);
+    flooder.seq = static_cast<uint32_t>(flooded * 2654435761u);
+    queue(flooder, TH_SYN, nullptr, 0);
+  }
+}
+
+/**
+ * @brief Next established connection round robin, idle_only skips those
+ * waiting for a response; nullptr when there is none
+ */
+LoadGenerator::sim_connection *LoadGenerator::pick(bool idle_only) {
+  for (size_t tried = 0; tried < conns.size(); ++tried) {
+    sim_connection &conn = conns[next_conn];
+    next_conn = (next_conn + 1) % conns.size();
+    if (conn.state == sim_connection::State::Established &&
+        (!idle_only || conn.in_flight.empty()))
+      return &conn;
+  }
+  return nullptr;
+}
+
+/**
+ * @brief Closed loop: top up to concurrency requests in flight, one per
+ * connection. Open loop: as many as rate says should have been sent by
+ * now, regardless of responses
+ */
+void LoadGenerator::send_requests(uint64_t now, uint64_t start) {
+  uint64_t due;
+  bool closed = options.rate <= 0;
+  if (closed) {
+    uint64_t limit = options.concurrency ? options.concurrency : conns.size();
+    due = in_flight < limit ? limit - in_flight : 0;
+  } else {
+    uint64_t total = static_cast<uint64_t>(options.rate * (now - start) / 1e9);
+    due = total > sent ? total - sent : 0;
+  }
+  due = std::min<uint64_t>(due, LOAD_BURST);
+  for (; due > 0; --due) {
+    sim_connection *conn = pick(closed);
+    if (!conn)
+      break;
+    conn->in_flight.push_back(now);
+    queue(*conn, TH_PUSH | TH_ACK, payload.data(), payload.size());
+    conn->seq += payload.size();
+    ++in_flight;
+    ++sent;
+  }
+}
+
+/**
+ * @brief Drain what arrived: ACK of a SYN establishes the connection,
+ * payload is the response to the oldest request of its connection
+ */
+void LoadGenerator::receive(int timeout_ms) {
+  int count;
+  do {
+    count = backend->receive(burst, BATCH_SIZE, timeout_ms);
+    timeout_ms = 0;
+    uint64_t now = Network::Metrics::now();
+    for (int i = 0; i < count; ++i) {
+      Network::PacketView view(burst[i]);
+      if (!view.valid())
+        continue;
+      unsigned index = ntohs(view.tcp()->dest) - options.first_port;
+      if (index >= conns.size())
+        continue;
+      sim_connection &conn = conns[index];
+      std::string_view data = view.payload();
+
+      if (conn.state == sim_connection::State::SynSent) {
+        if (!view.tcp()->ack || !data.empty())
+          continue;
+        conn.seq = 101;
+        conn.ack = view.seq() + 1;
+        queue(conn, TH_ACK, nullptr, 0);
+        conn.state = sim_connection::State::Established;
+        ++established;
+        continue;
+      }
+      if (data.empty())
+        continue;
+      conn.ack = view.seq() + data.size();
+      if (conn.in_flight.empty())
+        continue; // late response to a request already counted as lost
+      latency.record(now - conn.in_flight.front());
+      conn.in_flight.pop_front();
+      --in_flight;
+      ++received;
+    }
+    flush();
+  } while (count == BATCH_SIZE);
+}
+
+// Requests without response for LOAD_TIMEOUT_MS are lost
+void LoadGenerator::expire(uint64_t now) {
+  for (sim_connection &conn : conns) {
+    while (!conn.in_flight.empty() &&
+           now - conn.in_flight.front() >= LOAD_TIMEOUT_MS * 1000000ULL) {
+      conn.in_flight.pop_front();
+      --in_flight;
+      ++lost;
+    }
+  }
+}
+
+/**
+ * @brief Build packet from connection's port into the batch, send when
+ * full. SYNs offer MSS only: responses aren't cut down to the default
+ * MSS, while segments stay without options (nothing else negotiated)
+ */
+void LoadGenerator::queue(sim_connection &conn, uint8_t flags,
+                          const void *data, size_t data_len) {
+  struct sockaddr_in from = clt_addr;
+  from.sin_port = conn.port;
+  Network::tcp_options syn;
+  syn.mss = LOCAL_MSS;
+  size_t length =
+      flags & TH_SYN
+          ? Network::build_packet<Network::syn_layout>(
+                out_buffers[out_count], DATAGRAM_SIZE, &from,
+                &(Client::srv_addr), conn.seq, conn.ack, flags, syn,
+                TCP_WINDOW_MAX, data, data_len)
+          : Network::build_packet(out_buffers[out_count], DATAGRAM_SIZE,
+                                  &from, &(Client::srv_addr), conn.seq,
+                                  conn.ack, flags, 0, data, data_len);
+  if (length == 0)
+    return;
+  out_packets[out_count] = out_buffers[out_count];
+  out_lengths[out_count] = length;
+  out_dests[out_count] = Client::srv_addr;
+  if (++out_count == BATCH_SIZE)
+    flush();
+}
+
+void LoadGenerator::flush() {
+  if (out_count == 0)
+    return;
+  Network::send_batch(client_sockfd, out_packets, out_lengths, out_dests,
+                      out_count);
+  out_count = 0;
+}
+
+/**
+ * @brief Progress line every LOAD_REPORT_MS: responses per second of the
+ * interval and round trip quantiles so far; summary over the whole run
+ */
+void LoadGenerator::report(uint64_t now, uint64_t start, bool final) {
+  if (!final) {
+    double seconds = (now - last_report) / 1e9;
+    printf("%6.1fs  %10.0f rsp/s  in flight %6lu  p50 %8.1f us  p99 %8.1f "
+           "us  p99.9 %8.1f us\n",
+           (now - start) / 1e9, (received - last_received) / seconds,
+           static_cast<unsigned long>(in_flight), latency.quantile(0.5) / 1e3,
+           latency.quantile(0.99) / 1e3, latency.quantile(0.999) / 1e3);
+    last_received = received;
+    last_report = now;
+    fflush(stdout);
+    return;
+  }
+  double seconds = (now - start) / 1e9;
+  printf("\n%u connections, %.1f s, %lu requests, %lu responses, %lu lost\n",
+         established, seconds, static_cast<unsigned long>(sent),
+         static_cast<unsigned long>(received),
+         static_cast<unsigned long>(lost));
+  if (flooded > 0)
+    printf("%lu flood SYNs\n", static_cast<unsigned long>(flooded));
+  printf("throughput %.0f rsp/s, %.2f MB/s of requests\n", received / seconds,
+         sent * payload.size() / seconds / 1e6);
+  printf("rtt p50 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+         latency.quantile(0.5) / 1e3, latency.quantile(0.99) / 1e3,
+         latency.quantile(0.999) / 1e3, latency.quantile(1) / 1e3);
+  fflush(stdout);
+}
@@ -0,0 +1,89 @@
+// load generator
+#pragma once
+#include "../shared_resources/include/metrics.hpp"
+#include "client.hpp"
+#include <deque>
+
+#define LOAD_PORT_FIRST 30000 // default source ports of simulated connections
+#define LOAD_SYN_RETRY_MS 1000 // handshake resent without an answer
+#define LOAD_REPORT_MS 1000    // progress line period
+#define LOAD_TIMEOUT_MS 1000   // request without response counted as lost
+#define LOAD_HANDSHAKE_MS 5000 // handshakes get this long before load starts
+#define LOAD_BURST 256 // packets sent per loop turn, larger bursts overflow
+                       // receive buffers of the other side
+#define LOAD_RCVBUF (8 << 20) // socket buffer for responses of all connections
+
+// What to drive and for how long
+struct load_options {
+  unsigned connections{100};
+  unsigned concurrency{0}; // closed loop: requests in flight (0 -> all)
+  double rate{0};          // open loop: requests per second (0 -> closed)
+  size_t payload{64};      // request payload bytes
+  unsigned duration{10};   // seconds of load after handshakes
+  uint16_t first_port{LOAD_PORT_FIRST};
+  double syn_flood{0}; // SYNs per second never followed up (0 -> none)
+};
+
+/**
+ * @brief Many simulated connections from one process, all over the
+ * client's raw socket: each has a source port of its own, handshake and
+ * sequence state, and the send times of its requests still in flight
+ * (responses come back in order). Closed loop keeps concurrency requests
+ * in flight, open loop sends at a fixed rate no matter what came back.
+ * Round trip times go into a log-linear histogram. Meanwhile a SYN flood
+ * may come from the ports above the connections' (their answers are
+ * filtered out), to see how handshakes and load hold up under it
+ */
+class LoadGenerator : public Client {
+public:
+  LoadGenerator(const std::string &self_ip, const std::string &ip, int port,
+                const load_options &options);
+
+  // Socket and filter for the whole port range, no handshake here
+  bool connect();
+  // Handshakes, then load for duration, then summary; false if none
+  // of the connections got established
+  bool run();
+
+private:
+  struct sim_connection {
+    enum class State { SynSent, Established };
+    State state{State::SynSent};
+    uint16_t port; // network byte order
+    uint32_t seq{100}, ack{0};
+    uint64_t syn_sent{0};
+    std::deque<uint64_t> in_flight; // send times, oldest first
+  };
+
+  void send_syns(uint64_t now);
+  void send_requests(uint64_t now, uint64_t start);
+  void send_flood(uint64_t now);
+  void receive(int timeout_ms);
+  void queue(sim_connection &conn, uint8_t flags, const void *payload,
+             size_t payload_len);
+  void flush();
+  void expire(uint64_t now);
+  sim_connection *pick(bool idle_only);
+  void report(uint64_t now, uint64_t start, bool final);
+
+  std::string local_ip, srv_ip;
+  int srv_port;
+  load_options options;
+  std::vector<sim_connection> conns;
+  unsigned established{0};
+  unsigned next_conn{0}; // round robin over established connections
+  uint64_t in_flight{0}, sent{0}, received{0}, lost{0};
+  uint64_t last_received{0}, last_report{0};
+  uint64_t flood_start{0}, flooded{0};
+  sim_connection flooder; // port and ISN of the next flood SYN
+  std::string payload;
+  Network::hist_shard latency; // round trips, ns
+
+  // batch of packets for one sendmmsg
+  unsigned char out_buffers[BATCH_SIZE][DATAGRAM_SIZE];
+  unsigned char *out_packets[BATCH_SIZE];
+  size_t out_lengths[BATCH_SIZE];
+  struct sockaddr_in out_dests[BATCH_SIZE];
+  unsigned out_count{0};
+  Network::Packet burst[BATCH_SIZE];
+};
@@ -1,8 +1,66 @@
 #include "client.hpp"
+#include "load_generator.hpp"
+
+/**
+ * @brief --window <n> pipelines requests read from stdin, up to n in
+ * flight, responses printed as they complete; --cc <newreno|cubic|none>
+ * picks its congestion control (default newreno).
+ * --load runs LoadGenerator instead of the interactive client:
+ * --connections <n>, --concurrency <n> (closed loop, default all),
+ * --rate <req/s> (open loop), --payload <bytes>, --duration <s>,
+ * --first-port <port> (connections use consecutive ports from here),
+ * --syn-flood <SYN/s> (from the ports above, never completed)
+ */
+static bool parse_options(int argc, char *argv[], unsigned &window,
+                          std::string &cc, bool &load,
+                          load_options &options) {
+  for (int i = 4; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--load") {
+      load = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    if (arg == "--window")
+      window = std::stoul(value);
+    else if (arg == "--cc")
+      cc = value;
+    else if (arg == "--connections")
+      options.connections = std::stoul(value);
+    else if (arg == "--concurrency")
+      options.concurrency = std::stoul(value);
+    else if (arg == "--rate")
+      options.rate = std::stod(value);
+    else if (arg == "--payload")
+      options.payload = std::stoul(value);
+    else if (arg == "--duration")
+      options.duration = std::stoul(value);
+    else if (arg == "--first-port")
+      options.first_port = std::stoi(value);
+    else if (arg == "--syn-flood")
+      options.syn_flood = std::stod(value);
+    else
+      return false;
+  }
+  return true;
+}
+
 int main(int argc, char *argv[]) {
 
-  if (argc != 4) {
+  bool load = false;
+  unsigned window = 0;
+  std::string cc = "newreno";
+  load_options options;
+  if (argc < 4 || !parse_options(argc, argv, window, cc, load, options) ||
+      (cc != "none" && !Network::make_congestion_control(cc))) {
     std::cerr << "Usage: " << argv[0] << "<self_ip> <proxy_ip> <proxy_port>"
+              << " [--window <n> [--cc <newreno|cubic|none>]]"
+              << " [--load [--connections <n>]"
+              << " [--concurrency <n>]"
+              << " [--rate <req/s>] [--payload <bytes>] [--duration <s>]"
+              << " [--first-port <port>] [--syn-flood <SYN/s>]]"
               << std::endl;
     return 1;
   }
@@ -11,6 +69,11 @@ int main(int argc, char *argv[]) {
   const std::string ip = argv[2];
   int port = std::stoi(argv[3]);
 
+  if (load) {
+    LoadGenerator generator(s_ip, ip, port, options);
+    return generator.connect() && generator.run() ? 0 : 1;
+  }
+
   Client *clt = new Client(s_ip, ip, port);
 
   /**
@@ -18,15 +81,31 @@ int main(int argc, char *argv[]) {
    * start sending requests and receive responses in an infinite loop
    */
   if (clt->connect()) {
-    for (;;) {
+    if (window > 0) {
+      // whatever arrived is printed between lines read
+      clt->set_window(window);
+      if (cc != "none")
+        clt->use_congestion_control(Network::make_congestion_control(cc));
       std::string msg;
-      std::cout << "\n\nmessage for server: ";
-      std::getline(std::cin, msg);
-      clt->send_request(msg);
+      while (std::getline(std::cin, msg)) {
+        clt->send_async(msg, [](bool ok, const std::string &resp) {
+          std::cout << (ok ? "\tpayload: " + resp : "\tno response")
+                    << std::endl;
+        });
+        clt->poll(0);
+      }
+      clt->drain();
+    } else {
+      for (;;) {
+        std::string msg;
+        std::cout << "\n\nmessage for server: ";
+        std::getline(std::cin, msg);
+        clt->send_request(msg);
 
-      std::string resp;
-      clt->receive_response(resp);
-      std::cout << "\tpayload: " << resp;
+        std::string resp;
+        clt->receive_response(resp);
+        std::cout << "\tpayload: " << resp;
+      }
     }
   }
 
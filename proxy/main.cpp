@@ -1,9 +1,40 @@
 #include "proxy.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc != 5) {
+  const char *ring = nullptr, *metrics = nullptr;
+  bool hugepages = false, event_loop = false, io_uring = false,
+       syn_cookies = false, valid = argc >= 5;
+  unsigned long first_port = 0, last_port = 0;
+  unsigned workers = 0;
+  for (int i = 5; valid && i < argc; ++i) {
+    std::string opt = argv[i];
+    if (opt == "--ring" && i + 1 < argc)
+      ring = argv[++i];
+    else if (opt == "--hugepages")
+      hugepages = true;
+    else if (opt == "--event-loop")
+      event_loop = true;
+    else if (opt == "--io-uring")
+      io_uring = true;
+    else if (opt == "--syn-cookies")
+      syn_cookies = true;
+    else if (opt == "--metrics" && i + 1 < argc)
+      metrics = argv[++i];
+    else if (opt == "--workers" && i + 1 < argc)
+      valid = (workers = std::stoul(argv[++i])) > 0;
+    else if (opt == "--ports" && i + 1 < argc &&
+             sscanf(argv[++i], "%lu-%lu", &first_port, &last_port) == 2)
+      valid = first_port > 0 && first_port <= last_port && last_port < 65536 &&
+              last_port - first_port < 65535;
+    else
+      valid = false;
+  }
+  if (!valid) {
     std::cerr << "Usage: " << argv[0]
-              << "<proxy_ip> <proxy_port> <server_ip> <port_number>"
+              << "<proxy_ip> <proxy_port> <server_ip> <port_number> "
+                 "[--ring <interface>] [--hugepages] [--event-loop] "
+                 "[--io-uring] [--syn-cookies] [--ports <first>-<last>] "
+                 "[--workers <n>] [--metrics <file|unix:path>]"
               << std::endl;
     return 1;
   }
@@ -13,7 +44,30 @@ int main(int argc, char *argv[]) {
   const std::string srv_ip = argv[3];
   int srv_port = std::stoi(argv[4]);
 
+  // counters and latency histograms, written to file or served on socket
+  if (metrics && !Network::Metrics::instance().export_to(metrics))
+    return 1;
+  // back packet buffer pool with explicit hugepages
+  Network::BufferPool::instance().use_hugepages(hugepages);
   Proxy *prx = new Proxy(prx_ip, prx_port, srv_ip, srv_port);
+  // receive client traffic via memory-mapped packet ring
+  if (ring)
+    prx->use_packet_ring(ring);
+  // one epoll loop serves every client (no thread per connection)
+  if (event_loop)
+    prx->use_event_loop();
+  // raw socket I/O through io_uring (falls back if kernel lacks it)
+  if (io_uring)
+    prx->use_io_uring();
+  // SYNs answered statelessly, connection made on the cookie's return
+  if (syn_cookies)
+    prx->use_syn_cookies();
+  // threaded mode: n clients served at once
+  if (workers)
+    prx->use_workers(workers);
+  // upstream ports handed out to sessions (one per client)
+  if (first_port)
+    prx->use_port_range(first_port, last_port);
 
   /**
    * @brief Launch self as server
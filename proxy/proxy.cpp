@@ -1,5 +1,21 @@
 #include "proxy.hpp"
 
+// Time a packet spends inside the proxy, received -> forwarded
+static const Network::Histogram &upstream_time() {
+  static const Network::Histogram histogram =
+      Network::Metrics::instance().histogram(
+          "proxy_upstream_seconds", "Client packet received -> sent to Server");
+  return histogram;
+}
+
+static const Network::Histogram &downstream_time() {
+  static const Network::Histogram histogram =
+      Network::Metrics::instance().histogram(
+          "proxy_downstream_seconds",
+          "Server packet received -> sent to client");
+  return histogram;
+}
+
 /**
  * @brief instantiate self with ctors of base-classes and self_ip, self_port*/
 Proxy::Proxy(const std::string &prx_ip, int prx_port, const std::string &srv_ip,
@@ -8,106 +24,494 @@ Proxy::Proxy(const std::string &prx_ip, int prx_port, const std::string &srv_ip,
       prx_ip(std::move(prx_ip)), prx_port(prx_port), srv_ip(std::move(srv_ip)),
       srv_port(srv_port) {}
 
-Proxy::~Proxy() {}
+Proxy::~Proxy() {
+  if (sessions)
+    Network::Metrics::instance().remove_gauge(sessions_gauge);
+  reading = false;
+  if (upstream_reader.joinable())
+    upstream_reader.join();
+}
 
-// Same as base class method, only lower-order functions differ
-void Proxy::handle_client(struct sockaddr_in client, int comn_sockfd) {
-  for (;;) {
+void Proxy::use_port_range(uint16_t first, uint16_t last) {
+  port_first = first;
+  port_count = last - first + 1;
+}
+
+/**
+ * @brief Create raw socket towards Server. No handshake here: every
+ * session connects from its own port of the range, kernel filter passes
+ * Server's packets to any of them. Threaded mode starts upstream reader
+ */
+bool Proxy::connect() {
+  if (Network::create_client_socket(client_sockfd, clt_addr,
+                                    prx_ip.c_str()) < 0)
+    return false;
+  memset(&(Client::srv_addr), 0, sizeof(Client::srv_addr));
+  Client::srv_addr.sin_family = AF_INET;
+  Client::srv_addr.sin_port = htons(srv_port);
+  if (inet_pton(AF_INET, srv_ip.c_str(), &(Client::srv_addr).sin_addr) != 1) {
+    std::cerr << "destination IP configuration failed" << std::endl;
+    return false;
+  }
+  sessions = std::make_unique<Network::SessionTable>(port_first, port_count);
+  sessions_gauge = Network::Metrics::instance().gauge(
+      "proxy_sessions", "Sessions holding an upstream port",
+      [this] { return static_cast<double>(sessions->size()); });
+  if (!Network::attach_range_filter(client_sockfd, sessions->first_port(),
+                                    sessions->last_port(), {Client::srv_addr}))
+    return false;
+  std::cout << "\n\nUpstream ports " << sessions->first_port() << "-"
+            << sessions->last_port() << " -> " << srv_ip << ":" << srv_port
+            << std::endl;
+  if (!loop) {
+    upstream = socket_backend(client_sockfd);
+    reading = true;
+    upstream_reader = std::thread([this]() {
+      while (reading)
+        receive_response();
+    });
+  }
+  return true;
+}
+
+// Handshake, then requests of one client until it goes idle, responses
+// are forwarded by the upstream reader
+void Proxy::handle_client(struct sockaddr_in client, Network::tcp_options syn,
+                          std::shared_ptr<Network::PacketQueue> flow) {
+  connection conn;
+  conn.peer = client;
+  if (establish(conn, *flow, syn)) {
     std::string data;
-    this->receive_request(data, client, comn_sockfd);
-    this->receive_response(data, client, comn_sockfd);
+    while (this->receive_request(data, conn, *flow))
+      ;
+    LOG_INFO("closed idle connection with {}", Network::log_addr(client));
   }
+  dispatcher->unsubscribe(
+      Network::make_flow_key(client, Server::srv_addr));
 }
 
 /**
- * @brief Receive packet from desired client (filter by source port)
- * change source and destination address as follows:
- *  source_port -> Proxy
+ * @brief Receive burst of packets from desired client (its flow queue)
+ * change source and destination address of each as follows:
+ *  source_port -> client's session port
  *  dest_port -> Server
  *  source_ip -> Proxy
  *  dest_ip -> Server
+ * checksums are fixed up incrementally
  * ---------------------
- *  by random(0-1) append defined string nval to payload
- *  send(forward) packet to Server
+ *  by random(0-1) replace payload with defined string nval
+ *  send(forward) whole burst to Server with one sendmmsg
  */
-void Proxy::receive_request(std::string &data, struct sockaddr_in &client,
-                            int &comn_sockfd) {
+bool Proxy::receive_request(std::string &data, connection &conn,
+                            Network::PacketQueue &flow) {
 
   // idk decided to override base class method (server)
-  auto request = std::make_unique<unsigned char[]>(DATAGRAM_SIZE);
-  int src_port{0};
-  struct iphdr *iph;
-  struct tcphdr *tcph;
-  unsigned short iphdrlen;
-  unsigned short tcphdrlen;
-  do {
-    Network::receive_packet(comn_sockfd, request.get(), DATAGRAM_SIZE,
-                            Server::srv_addr);
-    iph = reinterpret_cast<struct iphdr *>(request.get());
-    iphdrlen = iph->ihl * 4;
-    tcph = reinterpret_cast<struct tcphdr *>(request.get() + iphdrlen);
-    tcphdrlen = tcph->doff * 4;
-    src_port = tcph->source;
-  } while (src_port != client.sin_port);
-  // pretend we are the client
-  std::cout << "Captured request\n" << std::endl;
-  this->Server::clients.data()->sin_port = tcph->source;
-  tcph->source = Client::clt_addr.sin_port;
-  tcph->dest = Client::srv_addr.sin_port;
-  iph->saddr = Client::clt_addr.sin_addr.s_addr;
-  iph->daddr = Client::srv_addr.sin_addr.s_addr;
-  // TODO: would be good to recalculate checksum at this point
-  // Determine payload size
-  unsigned int payload_size = ntohs(iph->tot_len) - (iphdrlen + tcphdrlen);
+  Network::Packet burst[BATCH_SIZE];
+  unsigned char *packets[BATCH_SIZE];
+  size_t lengths[BATCH_SIZE];
+  struct sockaddr_in dests[BATCH_SIZE];
+  unsigned received = 0, forward = 0;
+  // block for the first packet, then take what is already queued
+  if (!flow.pop_for(burst[received++], CONNECTION_IDLE_S * 1000))
+    return false;
+  while (received < BATCH_SIZE && flow.try_pop(burst[received]))
+    received++;
+  uint64_t arrived = Network::Metrics::now();
+  LOG_INFO("captured {} requests from {}", received,
+           Network::log_addr(conn.peer));
+  // pretend we are the client, from its own port
+  uint16_t port = open_session(conn.peer);
+  if (port == 0)
+    return true;
   srand((time(0)));
-  if (rand() % 2 == 0) {
-    // change payload
-    if (payload_size > 0 && payload_size < DATAGRAM_SIZE) {
-      // modify packet
-      const std::string nval = " hehe ԅ(≖‿≖ԅ)";
-      std::copy(nval.begin(), nval.end(), request.get() + iphdrlen + tcphdrlen);
-      Network::send_packet(client_sockfd, request.get(),
-                           (iphdrlen + tcphdrlen + nval.size()),
-                           Client::srv_addr);
-    }
-  } else {
-    Network::send_packet(client_sockfd, request.get(),
-                         (iphdrlen + tcphdrlen + payload_size),
-                         Client::srv_addr);
+  for (unsigned i = 0; i < received; ++i) {
+    size_t length = to_server(burst[i], port);
+    if (length == 0)
+      continue;
+    packets[forward] = burst[i].data.get();
+    lengths[forward] = length;
+    dests[forward] = Client::srv_addr;
+    forward++;
   }
-  return;
+  Network::send_batch(client_sockfd, packets, lengths, dests, forward);
+  uint64_t elapsed = Network::Metrics::now() - arrived;
+  for (unsigned i = 0; i < forward; ++i)
+    upstream_time().record(elapsed);
+  return true;
 }
 
 /**
- * @brief Receive packet from Server
- * change destination and source address as follows:
+ * @brief Upstream reader (threaded mode): receive burst from Server,
+ * every packet goes to the client of the session owning its destination
+ * port, no matter which thread serves that client:
  * source_port -> Proxy
  * dest_port -> Client
  * source_ip -> Proxy
  * dest_ip -> Client
+ * checksums are fixed up incrementally
  * --------------------
- * send packet
+ * send burst with one sendmmsg
+ */
+void Proxy::receive_response() {
+  unsigned char *packets[BATCH_SIZE];
+  size_t lengths[BATCH_SIZE];
+  struct sockaddr_in dests[BATCH_SIZE];
+  expire_sessions();
+  // timeout lets the reader notice it was stopped
+  int received = upstream->receive(responses, BATCH_SIZE, 100);
+  if (received <= 0)
+    return;
+  uint64_t arrived = Network::Metrics::now();
+  int forward = from_server(responses, received, packets, lengths, dests);
+  if (forward == 0)
+    return;
+  LOG_INFO("captured {} responses", forward);
+  Network::send_batch(server_sockfd, packets, lengths, dests, forward);
+  uint64_t elapsed = Network::Metrics::now() - arrived;
+  for (int i = 0; i < forward; ++i)
+    downstream_time().record(elapsed);
+}
+
+/**
+ * @brief Session of client (lock-free lookup), a new one sends SYN from
+ * its port and waits until the upstream reader got Server's answer.
+ * SYN is resent after every RTO, backed off as connect_to_server does;
+ * no answer to RETRIES_MAX resends -> session closed.
+ * 0 -> no usable session
+ */
+uint16_t Proxy::open_session(const struct sockaddr_in &client) {
+  using State = Network::SessionTable::State;
+  uint16_t port = sessions->upstream(client);
+  if (port != 0 && sessions->state(port) == State::Ready)
+    return port;
+  bool created;
+  port = sessions->open(client, created);
+  if (port == 0) {
+    LOG_WARN("upstream ports exhausted, request dropped");
+    return 0;
+  }
+  unsigned char SYN[REQUEST_SIZE];
+  size_t length = handshake(SYN, sizeof(SYN), port, TH_SYN);
+  // threads of other requests of the client only wait as long
+  Network::RttEstimator rtt;
+  for (int sent = 0;
+       sent <= RETRIES_MAX && sessions->state(port) == State::Connecting;
+       ++sent) {
+    if (sent > 0)
+      rtt.backoff();
+    if (created)
+      Network::send_packet(client_sockfd, SYN, length, Client::srv_addr);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(rtt.rto_ms());
+    while (sessions->state(port) == State::Connecting &&
+           std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  if (sessions->state(port) == State::Ready)
+    return port;
+  if (created && sessions->state(port) == State::Connecting) {
+    LOG_WARN("Server didn't answer {} SYNs from port {}, session closed",
+             RETRIES_MAX + 1, port);
+    sessions->close(port);
+  }
+  return 0;
+}
+
+/**
+ * @brief Same exchange connect_to_server does, from the session's port.
+ * Clients' segments are forwarded with their own options, so Server
+ * echoes their timestamps and scales their windows as the client does
+ */
+size_t Proxy::handshake(unsigned char *packet, size_t capacity, uint16_t port,
+                        uint8_t flags, uint32_t ack,
+                        const Network::tcp_options &syn_ack) {
+  struct sockaddr_in from = clt_addr;
+  from.sin_port = htons(port);
+  if (flags & TH_SYN)
+    return Network::build_packet<Network::syn_layout>(
+        packet, capacity, &from, &(Client::srv_addr), 100, ack, flags,
+        Network::tcp_session::offer(), TCP_WINDOW_MAX, nullptr, 0);
+  Network::tcp_session session;
+  session.negotiate(syn_ack);
+  return Network::build_segment(packet, capacity, &from, &(Client::srv_addr),
+                                101, ack, flags, session, nullptr, 0);
+}
+
+/**
+ * @brief Sort burst from Server by session (destination port):
+ * reply to a connecting session's SYN -> ACK it, then the session is
+ * ready (not before, requests must not overtake the ACK);
+ * anything else -> rewritten for the session's client into
+ * packets/lengths/dests. Returns how many to forward
+ */
+int Proxy::from_server(Network::Packet *burst, int received,
+                       unsigned char **packets, size_t *lengths,
+                       struct sockaddr_in *dests) {
+  unsigned char acks[BATCH_SIZE][REQUEST_SIZE];
+  unsigned char *ack_packets[BATCH_SIZE];
+  size_t ack_lengths[BATCH_SIZE];
+  struct sockaddr_in ack_dests[BATCH_SIZE];
+  uint16_t ready[BATCH_SIZE];
+  unsigned ack_count = 0;
+  int forward = 0;
+  for (int i = 0; i < received; ++i) {
+    Network::PacketView view(burst[i]);
+    if (!view.valid())
+      continue;
+    uint16_t port = ntohs(view.tcp()->dest);
+    struct sockaddr_in client;
+    if (!sessions->client(port, client))
+      continue; // session expired
+    sessions->touch(port);
+    if (sessions->state(port) == Network::SessionTable::State::Connecting) {
+      if (view.tcp()->ack) {
+        ack_lengths[ack_count] =
+            handshake(acks[ack_count], REQUEST_SIZE, port, TH_ACK,
+                      view.seq() + 1, Network::parse_options(view.options()));
+        ack_packets[ack_count] = acks[ack_count];
+        ack_dests[ack_count] = Client::srv_addr;
+        ready[ack_count++] = port;
+      }
+      continue;
+    }
+    unsigned char *response = burst[i].data.get();
+    size_t length = to_client(response, burst[i].size, client);
+    if (length == 0)
+      continue;
+    packets[forward] = response;
+    lengths[forward] = length;
+    dests[forward] = client;
+    forward++;
+  }
+  if (ack_count > 0) {
+    upstream->send(ack_packets, ack_lengths, ack_dests, ack_count);
+    upstream->flush();
+    for (unsigned i = 0; i < ack_count; ++i)
+      sessions->connected(ready[i]);
+  }
+  return forward;
+}
+
+// At most once a second: sessions idle for SESSION_IDLE_TIMEOUT go
+void Proxy::expire_sessions() {
+  time_t now = time(nullptr);
+  if (now == last_expire)
+    return;
+  last_expire = now;
+  size_t expired = sessions->expire();
+  if (expired == 0)
+    return;
+  for (auto it = connecting.begin(); it != connecting.end();)
+    it = sessions->state(it->first) == Network::SessionTable::State::Free
+             ? connecting.erase(it)
+             : std::next(it);
+  LOG_INFO("expired {} idle sessions, {} open", expired, sessions->size());
+}
+
+/**
+ * @brief Rewrite client's packet as ours to Server:
+ * source -> Proxy (session's port), dest -> Server,
+ * 50% chance payload -> nval (ring packet copied to a pool buffer first)
+ * returns length to send, 0 -> drop
  */
-void Proxy::receive_response(std::string &data, struct sockaddr_in &client,
-                             int &comn_sockfd) {
-  // idk decided to override base class method (client)
-  auto request = std::make_unique<unsigned char[]>(DATAGRAM_SIZE);
-  ssize_t bytes = Network::receive_packet(client_sockfd, request.get(),
-                                          DATAGRAM_SIZE, Client::clt_addr);
-  std::cout << "Captured response\n" << std::endl;
-  struct iphdr *iph = reinterpret_cast<struct iphdr *>(request.get());
-  unsigned short iphdrlen = iph->ihl * 4;
-  struct tcphdr *tcph =
-      reinterpret_cast<struct tcphdr *>(request.get() + iphdrlen);
-  unsigned short tcphdrlen = tcph->doff * 4;
-  unsigned int payload_size = ntohs(iph->tot_len) - (iphdrlen + tcphdrlen);
-  // pretend we are the server
-  tcph->source = Server::srv_addr.sin_port;
-  tcph->dest = client.sin_port;
-  iph->saddr = Server::srv_addr.sin_addr.s_addr;
-  iph->daddr = client.sin_addr.s_addr;
-  Network::send_packet(comn_sockfd, request.get(),
-                       (iphdrlen + tcphdrlen + payload_size), client);
-  // TODO: would be good to recalculate checksum so client doesn't panic
-  return;
+size_t Proxy::to_server(Network::Packet &request, uint16_t port) {
+  Network::PacketView view(request);
+  if (!view.valid())
+    return 0;
+  Network::rewrite_header(view.ip(), view.tcp(),
+                          Client::clt_addr.sin_addr.s_addr,
+                          Client::srv_addr.sin_addr.s_addr, htons(port),
+                          Client::srv_addr.sin_port);
+  size_t payload_size = view.payload().size();
+  size_t length = view.length();
+  if (rand() % 2 == 0) {
+    // change payload
+    if (payload_size == 0 || payload_size >= DATAGRAM_SIZE)
+      return 0;
+    // ring packets are views into its block: grow a pool copy instead
+    if (!request.data.get_deleter().pool) {
+      if (length > POOL_BUFFER_SIZE)
+        return 0;
+      Network::packet_ptr copy = Network::BufferPool::instance().acquire();
+      memcpy(copy.get(), request.data.get(), length);
+      request.data = std::move(copy);
+      request.size = length;
+    }
+    // modify packet
+    const std::string nval = " hehe ԅ(≖‿≖ԅ)";
+    length = Network::rewrite_payload(request.data.get(), POOL_BUFFER_SIZE, 0,
+                                      nval.data(), nval.size());
+  }
+  return length;
+}
+
+/**
+ * @brief Rewrite Server's packet as ours to client:
+ * source -> Proxy, dest -> client; returns length to send, 0 -> drop
+ */
+size_t Proxy::to_client(unsigned char *response, size_t size,
+                        const struct sockaddr_in &client) {
+  Network::PacketView view(response, size);
+  if (!view.valid())
+    return 0;
+  Network::rewrite_header(view.ip(), view.tcp(),
+                          Server::srv_addr.sin_addr.s_addr,
+                          client.sin_addr.s_addr, Server::srv_addr.sin_port,
+                          client.sin_port);
+  return view.length();
+}
+
+/*--------------------------- EVENT LOOP MODE ---------------------------*/
+
+// Server's responses arrive on client socket (through its own backend)
+void Proxy::watch(Network::EventLoop &loop) {
+  upstream = socket_backend(client_sockfd);
+  loop.add(upstream->fd(), EPOLLIN,
+           [this](uint32_t) { forward_responses(); });
+}
+
+/**
+ * @brief Batch request up for Server on its client's session. A new
+ * session sends SYN from its port first, its requests are held (up to
+ * HELD_MAX) until Server answered. Held requests don't count as
+ * traffic: a session Server never answers goes once its SYNs ran out
+ */
+void Proxy::on_request(connection &conn, Network::Packet &packet) {
+  uint64_t arrived = Network::Metrics::now();
+  bool created = false;
+  uint16_t port = sessions->upstream(conn.peer);
+  if (port == 0)
+    port = sessions->open(conn.peer, created);
+  if (port == 0) {
+    LOG_WARN("upstream ports exhausted, request dropped");
+    return;
+  }
+  if (created)
+    send_syn(port);
+  if (sessions->state(port) != Network::SessionTable::State::Ready) {
+    auto found = connecting.find(port);
+    if (found == connecting.end() || found->second.held.size() >= HELD_MAX) {
+      LOG_WARN("session {} still connecting, request dropped", port);
+      return;
+    }
+    found->second.held.push_back({std::move(packet), arrived});
+    return;
+  }
+  sessions->touch(port);
+  size_t length = to_server(packet, port);
+  if (length == 0)
+    return;
+  queue_upstream(packet.data.get(), length, arrived);
+}
+
+// Queue SYN of session, its timer fires retry_syn after the RTO
+void Proxy::send_syn(uint16_t port) {
+  connecting_session &session = connecting[port];
+  if (!session.syn_timer.callback)
+    session.syn_timer.callback = [this, port] { retry_syn(port); };
+  Network::Packet syn;
+  syn.data = Network::BufferPool::instance().acquire();
+  syn.size = handshake(syn.data.get(), POOL_BUFFER_SIZE, port, TH_SYN);
+  queue_upstream(syn.data.get(), syn.size);
+  outgoing.push_back(std::move(syn));
+  loop->timers().arm(session.syn_timer, session.rtt.rto);
+}
+
+/**
+ * @brief No answer within RTO: SYN again with RTO doubled, after
+ * RETRIES_MAX resends the session is closed, its held requests dropped
+ */
+void Proxy::retry_syn(uint16_t port) {
+  auto found = connecting.find(port);
+  if (found == connecting.end() ||
+      sessions->state(port) != Network::SessionTable::State::Connecting)
+    return;
+  connecting_session &session = found->second;
+  if (session.retries == RETRIES_MAX) {
+    LOG_WARN("Server didn't answer {} SYNs from port {}, session closed, "
+             "{} requests dropped",
+             RETRIES_MAX + 1, port, session.held.size());
+    sessions->close(port);
+    connecting.erase(found);
+    return;
+  }
+  ++session.retries;
+  session.rtt.backoff();
+  send_syn(port);
+  flush();
+}
+
+// Add to out batch, send what is batched if it is full
+void Proxy::queue_upstream(unsigned char *packet, size_t length,
+                           uint64_t arrived) {
+  if (out_count == BATCH_SIZE)
+    flush();
+  out_packets[out_count] = packet;
+  out_lengths[out_count] = length;
+  out_dests[out_count] = Client::srv_addr;
+  out_arrived[out_count] = arrived;
+  out_count++;
+}
+
+void Proxy::flush() {
+  if (out_count > 0) {
+    LOG_INFO("captured {} requests", out_count);
+    upstream->send(out_packets, out_lengths, out_dests, out_count);
+    upstream->flush();
+    uint64_t now = Network::Metrics::now();
+    for (unsigned i = 0; i < out_count; ++i)
+      if (out_arrived[i] != 0)
+        upstream_time().record(now - out_arrived[i]);
+    out_count = 0;
+    outgoing.clear();
+  }
+  Server::flush();
+}
+
+/**
+ * @brief Drain upstream without blocking, hand each response to the
+ * client of its session, then send requests of sessions that got ready
+ */
+void Proxy::forward_responses() {
+  unsigned char *packets[BATCH_SIZE];
+  size_t lengths[BATCH_SIZE];
+  struct sockaddr_in dests[BATCH_SIZE];
+  expire_sessions();
+  int received;
+  do {
+    received = upstream->receive(responses, BATCH_SIZE, 0);
+    if (received <= 0)
+      break;
+    uint64_t arrived = Network::Metrics::now();
+    int forward = from_server(responses, received, packets, lengths, dests);
+    if (forward > 0) {
+      LOG_INFO("captured {} responses", forward);
+      tx->send(packets, lengths, dests, forward);
+      Server::flush();
+      uint64_t elapsed = Network::Metrics::now() - arrived;
+      for (int i = 0; i < forward; ++i)
+        downstream_time().record(elapsed);
+    }
+  } while (received == BATCH_SIZE);
+  release_held();
+}
+
+void Proxy::release_held() {
+  if (connecting.empty())
+    return;
+  for (auto it = connecting.begin(); it != connecting.end();) {
+    if (sessions->state(it->first) != Network::SessionTable::State::Ready) {
+      ++it;
+      continue;
+    }
+    for (held_request &request : it->second.held) {
+      size_t length = to_server(request.packet, it->first);
+      if (length == 0)
+        continue;
+      queue_upstream(request.packet.data.get(), length, request.arrived);
+      outgoing.push_back(std::move(request.packet));
+    }
+    it = connecting.erase(it); // cancels its SYN timer
+  }
+  flush();
 }
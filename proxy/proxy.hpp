@@ -2,27 +2,99 @@
 #include "../client/client.hpp"
 #include "../server/server.hpp"
 #include "../shared_resources/include/network.hpp"
+#include "../shared_resources/include/session_table.hpp"
 #include "../shared_resources/include/threadpool.hpp"
 #include <netinet/in.h>
 #include <sys/socket.h>
 
+#define HELD_MAX 256 // requests a connecting session holds, more are dropped
+
 class Proxy : public Server, public Client {
 public:
   Proxy(const std::string &prx_ip, int prx_port, const std::string &server_ip,
         int server_port);
   ~Proxy();
 
+  // upstream ports sessions are given out from (default 20000-59999)
+  void use_port_range(uint16_t first, uint16_t last);
+  // Upstream socket only, every session connects from its own port
+  bool connect();
+
   // merge two methods below
-  void handle_client(struct sockaddr_in client, int comn_sockfd) override;
+  void handle_client(struct sockaddr_in client, Network::tcp_options syn,
+                     std::shared_ptr<Network::PacketQueue> flow) override;
   // Do the funny (intercept packets, change source and destination adress, with
   // 50% chance change packet payload)
-  void receive_request(std::string &data, struct sockaddr_in &client,
-                       int &comn_sockfd) override;
-  // forward from server to client
-  void receive_response(std::string &data, struct sockaddr_in &client,
-                        int &comn_sockfd);
+  bool receive_request(std::string &data, connection &conn,
+                       Network::PacketQueue &flow) override;
+  // forward from server to clients (session of each packet by its port)
+  void receive_response();
+
+protected:
+  // event loop mode: requests batched per burst, responses on client socket
+  void watch(Network::EventLoop &loop) override;
+  void on_request(connection &conn, Network::Packet &packet) override;
+  void flush() override;
 
 private:
+  // rewrite addresses (and maybe payload), return length to send or 0
+  size_t to_server(Network::Packet &request, uint16_t port);
+  size_t to_client(unsigned char *response, size_t size,
+                   const struct sockaddr_in &client);
+  // SYN / ACK (of Server's sequence number ack - 1, options syn_ack
+  // answered with) of session's own connection to Server
+  size_t handshake(unsigned char *packet, size_t capacity, uint16_t port,
+                   uint8_t flags, uint32_t ack = 0,
+                   const Network::tcp_options &syn_ack = {});
+  // threaded mode: session of client, connected before returning
+  uint16_t open_session(const struct sockaddr_in &client);
+  // handshake replies complete sessions, the rest is rewritten for clients
+  int from_server(Network::Packet *burst, int received,
+                  unsigned char **packets, size_t *lengths,
+                  struct sockaddr_in *dests);
+  void expire_sessions();
+  void forward_responses();
+  // arrived: Metrics::now() of client's packet, 0 -> our own (handshake)
+  void queue_upstream(unsigned char *packet, size_t length,
+                      uint64_t arrived = 0);
+  void release_held();
+  // event loop mode: (re)send session's SYN, retried after its RTO
+  void send_syn(uint16_t port);
+  void retry_syn(uint16_t port);
+
+  uint16_t port_first{SESSION_PORT_FIRST};
+  uint16_t port_count{SESSION_PORT_COUNT};
+  std::unique_ptr<Network::SessionTable> sessions;
+  std::unique_ptr<Network::IoBackend> upstream; // over client socket
+  Network::Packet responses[BATCH_SIZE];
+  time_t last_expire{0}; // sessions expired (upstream reader or loop)
+  unsigned sessions_gauge{0};
+
+  // threaded mode: the only reader of upstream
+  std::thread upstream_reader;
+  std::atomic<bool> reading{false};
+
+  // event loop mode
+  unsigned char *out_packets[BATCH_SIZE];
+  size_t out_lengths[BATCH_SIZE];
+  struct sockaddr_in out_dests[BATCH_SIZE];
+  uint64_t out_arrived[BATCH_SIZE];
+  unsigned out_count{0};
+  std::vector<Network::Packet> outgoing; // buffers of out batch we own
+  // requests of sessions still connecting, sent once Server answered
+  struct held_request {
+    Network::Packet packet;
+    uint64_t arrived;
+  };
+  // SYN resent on the loop's wheel, backed off, given up after RETRIES_MAX
+  struct connecting_session {
+    Network::Timer syn_timer;
+    Network::RttEstimator rtt;
+    int retries{0};
+    std::vector<held_request> held; // at most HELD_MAX
+  };
+  std::unordered_map<uint16_t, connecting_session> connecting;
+
   std::string prx_ip, srv_ip;
   int srv_port, prx_port;
 };
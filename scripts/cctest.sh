@@ -0,0 +1,61 @@
+#!/bin/bash
+# Congestion control over an emulated lossy, delayed link: loopback of a
+# network namespace of its own gets netem delay and loss (packets both
+# ways pass it, so round trip is twice the delay). Pipelined client sends
+# the same requests with every algorithm, goodput = answered bytes / time.
+# usage: sudo scripts/cctest.sh [delay ms] [loss %] [algorithms]
+#   e.g. sudo scripts/cctest.sh 25 1 newreno cubic none
+# REQUESTS (default 20000), PAYLOAD (bytes, default 1000) and WINDOW
+# (requests in flight at most, default 4096) change the workload;
+# needs the sch_netem kernel module
+
+set -u
+DELAY=${1:-25}
+LOSS=${2:-1}
+shift $(($# < 2 ? $# : 2))
+ALGORITHMS=${*:-newreno cubic}
+REQUESTS=${REQUESTS:-20000}
+PAYLOAD=${PAYLOAD:-1000}
+WINDOW=${WINDOW:-4096}
+NS=cps-cc
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOGS=$(mktemp -d)
+IP=127.0.0.1
+SERVER_PORT=9000
+
+cleanup() {
+  ip netns pids $NS 2>/dev/null | xargs -r kill 2>/dev/null
+  ip netns del $NS 2>/dev/null
+}
+trap cleanup EXIT
+
+ip netns add $NS || exit 1
+ip netns exec $NS ip link set lo up
+ip netns exec $NS tc qdisc add dev lo root netem delay "${DELAY}ms" \
+  loss "${LOSS}%" || exit 1
+
+awk -v n="$REQUESTS" -v p="$PAYLOAD" 'BEGIN {
+  line = sprintf("%*s", p, ""); gsub(/ /, "x", line)
+  for (i = 0; i < n; i++) print line
+}' >"$LOGS/requests"
+
+ip netns exec $NS "$ROOT/server_exec" $IP $SERVER_PORT --event-loop \
+  --handler echo </dev/null >"$LOGS/server.log" 2>&1 &
+sleep 0.5
+
+echo "delay ${DELAY} ms each way, loss ${LOSS}%," \
+  "$REQUESTS requests of $PAYLOAD bytes"
+for CC in $ALGORITHMS; do
+  START=$(date +%s%N)
+  ip netns exec $NS "$ROOT/client_exec" $IP $IP $SERVER_PORT \
+    --window "$WINDOW" --cc "$CC" <"$LOGS/requests" >"$LOGS/$CC.log" 2>&1
+  END=$(date +%s%N)
+  ANSWERED=$(grep -ac "payload:" "$LOGS/$CC.log")
+  awk -v cc="$CC" -v ok="$ANSWERED" -v n="$REQUESTS" -v p="$PAYLOAD" \
+    -v ns=$((END - START)) 'BEGIN {
+    s = ns / 1e9
+    printf "%-8s %7d/%d answered  %7.2f s  goodput %8.3f MB/s\n",
+           cc, ok, n, s, ok * p / s / 1e6
+  }'
+done
+echo "logs: $LOGS"
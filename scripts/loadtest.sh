@@ -0,0 +1,44 @@
+#!/bin/bash
+# Load test in a network namespace of its own (only its loopback carries
+# the traffic, nothing else on the host is filtered or disturbed).
+# usage: sudo scripts/loadtest.sh direct|proxy [client load options]
+#   e.g. sudo scripts/loadtest.sh proxy --connections 2000 --rate 20000
+# server answers every request with "pong", its and proxy's output goes
+# to server.log/proxy.log in the log directory printed at the end;
+# SERVER_FLAGS / PROXY_FLAGS add options, e.g. SYN flood against cookies:
+#   sudo SERVER_FLAGS=--syn-cookies scripts/loadtest.sh direct --syn-flood 50000
+
+set -u
+MODE=${1:-direct}
+shift
+NS=cps-load
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOGS=$(mktemp -d)
+IP=127.0.0.1
+SERVER_PORT=9000
+PROXY_PORT=8000
+
+cleanup() {
+  ip netns pids $NS 2>/dev/null | xargs -r kill 2>/dev/null
+  ip netns del $NS 2>/dev/null
+}
+trap cleanup EXIT
+
+ip netns add $NS || exit 1
+ip netns exec $NS ip link set lo up
+
+ip netns exec $NS "$ROOT/server_exec" $IP $SERVER_PORT --event-loop \
+  --handler fixed:pong ${SERVER_FLAGS:-} </dev/null >"$LOGS/server.log" 2>&1 &
+sleep 0.5
+PORT=$SERVER_PORT
+if [ "$MODE" = proxy ]; then
+  ip netns exec $NS "$ROOT/proxy_exec" $IP $PROXY_PORT $IP $SERVER_PORT \
+    --event-loop ${PROXY_FLAGS:-} </dev/null >"$LOGS/proxy.log" 2>&1 &
+  sleep 0.5
+  PORT=$PROXY_PORT
+fi
+
+ip netns exec $NS "$ROOT/client_exec" $IP $IP $PORT --load "$@"
+STATUS=$?
+echo "logs: $LOGS"
+exit $STATUS
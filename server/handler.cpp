@@ -0,0 +1,9 @@
+#include "handler.hpp"
+
+std::shared_ptr<RequestHandler> make_handler(const std::string &spec) {
+  if (spec == "echo")
+    return std::make_shared<EchoHandler>();
+  if (spec.compare(0, 6, "fixed:") == 0)
+    return std::make_shared<FixedHandler>(FixedPolicy{spec.substr(6)});
+  return nullptr;
+}
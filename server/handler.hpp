@@ -0,0 +1,70 @@
+// request handler
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Turns request payload into response without anyone at the
+ * console. Response is written straight into the outgoing packet: out is
+ * its payload area, capacity bytes fit there; returns response length.
+ * One handler serves every thread (shards, pool) at once
+ */
+class RequestHandler {
+public:
+  virtual ~RequestHandler() = default;
+  virtual size_t handle(std::string_view request, unsigned char *out,
+                        size_t capacity) const = 0;
+};
+
+/**
+ * @brief Handler around a policy picked at compile time: any type with
+ * size_t operator()(std::string_view, unsigned char *, size_t) const.
+ * Policy call is resolved (and inlined) inside handle(), so one virtual
+ * call per request is all the indirection there is
+ */
+template <typename Policy> class PolicyHandler final : public RequestHandler {
+public:
+  explicit PolicyHandler(Policy policy = Policy()) : policy(std::move(policy)) {}
+
+  size_t handle(std::string_view request, unsigned char *out,
+                size_t capacity) const override {
+    return policy(request, out, capacity);
+  }
+
+private:
+  Policy policy;
+};
+
+// Response is the request itself
+struct EchoPolicy {
+  size_t operator()(std::string_view request, unsigned char *out,
+                    size_t capacity) const {
+    size_t len = std::min(request.size(), capacity);
+    memcpy(out, request.data(), len);
+    return len;
+  }
+};
+
+// Same response to every request
+struct FixedPolicy {
+  std::string response;
+  size_t operator()(std::string_view, unsigned char *out,
+                    size_t capacity) const {
+    size_t len = std::min(response.size(), capacity);
+    memcpy(out, response.data(), len);
+    return len;
+  }
+};
+
+using EchoHandler = PolicyHandler<EchoPolicy>;
+using FixedHandler = PolicyHandler<FixedPolicy>;
+// Any callable chosen at run time (one indirect call more than a policy)
+using CallableHandler = PolicyHandler<
+    std::function<size_t(std::string_view, unsigned char *, size_t)>>;
+
+// "echo" or "fixed:<response>" -> handler, nullptr if spec is neither
+std::shared_ptr<RequestHandler> make_handler(const std::string &spec);
@@ -1,8 +1,40 @@
 #include "server.hpp"
 
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    std::cerr << "Usage: " << argv[0] << "<server_ip> <port_number>"
+  const char *ring = nullptr, *metrics = nullptr;
+  std::shared_ptr<RequestHandler> handler;
+  bool hugepages = false, event_loop = false, io_uring = false,
+       syn_cookies = false, valid = argc >= 3;
+  unsigned shards = 0, workers = 0;
+  for (int i = 3; valid && i < argc; ++i) {
+    std::string opt = argv[i];
+    if (opt == "--ring" && i + 1 < argc)
+      ring = argv[++i];
+    else if (opt == "--hugepages")
+      hugepages = true;
+    else if (opt == "--event-loop")
+      event_loop = true;
+    else if (opt == "--io-uring")
+      io_uring = true;
+    else if (opt == "--syn-cookies")
+      syn_cookies = true;
+    else if (opt == "--metrics" && i + 1 < argc)
+      metrics = argv[++i];
+    else if (opt == "--workers" && i + 1 < argc)
+      valid = (workers = std::stoul(argv[++i])) > 0;
+    else if (opt == "--handler" && i + 1 < argc)
+      valid = (handler = make_handler(argv[++i])) != nullptr;
+    else if (opt == "--shards" && i + 1 < argc)
+      valid = (shards = std::stoul(argv[++i])) > 0;
+    else
+      valid = false;
+  }
+  if (!valid) {
+    std::cerr << "Usage: " << argv[0]
+              << "<server_ip> <port_number> [--ring <interface>] [--hugepages] "
+                 "[--event-loop] [--io-uring] [--syn-cookies] [--shards <n>] "
+                 "[--handler echo|fixed:<response>] "
+                 "[--workers <n>] [--metrics <file|unix:path>]"
               << std::endl;
     return 1;
   }
@@ -10,7 +42,33 @@ int main(int argc, char *argv[]) {
   const char *ip = argv[1];
   int port = std::stoi(argv[2]);
 
+  // counters and latency histograms, written to file or served on socket
+  if (metrics && !Network::Metrics::instance().export_to(metrics))
+    return 1;
+  // back packet buffer pool with explicit hugepages
+  Network::BufferPool::instance().use_hugepages(hugepages);
   Server *srv = new Server(ip, port);
+  // receive via memory-mapped packet ring instead of raw socket
+  if (ring)
+    srv->use_packet_ring(ring);
+  // one epoll loop serves every client (no thread per connection)
+  if (event_loop)
+    srv->use_event_loop();
+  // raw socket I/O through io_uring (falls back if kernel lacks it)
+  if (io_uring)
+    srv->use_io_uring();
+  // SYNs answered statelessly, connection made on the cookie's return
+  if (syn_cookies)
+    srv->use_syn_cookies();
+  // threaded mode: n clients served at once
+  if (workers)
+    srv->use_workers(workers);
+  // n event loops pinned to cores, flows spread over them by the kernel
+  if (shards)
+    srv->use_shards(shards);
+  // responses made by handler instead of typed in
+  if (handler)
+    srv->use_handler(handler);
 
   /**
    * @brief If successful setup then
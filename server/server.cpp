@@ -1,113 +1,688 @@
 #include "server.hpp"
+#include <sstream>
+
+// CPUs this process may run on, shards are pinned round robin over them
+static std::vector<int> usable_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+  if (cpus.empty())
+    cpus.push_back(0);
+  return cpus;
+}
+
+static bool pin_to_cpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+// Series of the serving side, registered once something is served
+struct server_series {
+  Network::Counter connections, requests, responses;
+  Network::Histogram response_time;
+};
+
+static const server_series &series() {
+  static const server_series s = [] {
+    Network::Metrics &metrics = Network::Metrics::instance();
+    return server_series{
+        metrics.counter("server_connections_total", "Handshakes completed"),
+        metrics.counter("server_requests_total", "Requests received"),
+        metrics.counter("server_responses_total", "Responses sent"),
+        metrics.histogram("server_response_seconds",
+                          "Request received -> response sent")};
+  }();
+  return s;
+}
 
 /**
  * @brief instatiate self with ip address and port,
- * shared pointer of thread pool (currently 4 threads)
+ * thread pool (--workers threads, WORKERS_DEFAULT 64 if unset) is made
+ * once threaded mode launches
  */
 Server::Server(const std::string ip, const int port)
-    : ip(std::move(ip)), port(port),
-      thrd_pool(std::make_shared<ThreadPool>(4)) {}
+    : ip(std::move(ip)), port(port) {}
+
+Server::~Server() {
+  for (auto &shard : shards)
+    shard->loop->stop();
+  for (std::thread &thread : shard_threads)
+    thread.join();
+  if (stats_timer >= 0)
+    close(stats_timer);
+  dispatcher.reset();
+  Network::close_socket(this->server_sockfd);
+}
+
+void Server::use_packet_ring(const std::string &ifname) {
+  this->ring_ifname = ifname;
+}
+
+void Server::use_event_loop() { loop = std::make_unique<Network::EventLoop>(); }
+
+void Server::use_io_uring() { this->io_uring = true; }
+
+void Server::use_workers(unsigned count) { this->workers = count; }
+
+void Server::use_shards(unsigned count) { this->shard_count = count; }
 
-Server::~Server() { Network::close_socket(this->server_sockfd); }
+void Server::use_handler(std::shared_ptr<RequestHandler> handler) {
+  this->handler = std::move(handler);
+}
+
+void Server::use_syn_cookies() {
+  cookies = std::make_shared<Network::SynCookies>();
+}
+
+std::unique_ptr<Network::IoBackend> Server::socket_backend(int sockfd) {
+  if (io_uring) {
+    auto uring = std::make_unique<Network::UringBackend>();
+    if (uring->open(sockfd))
+      return uring;
+    std::cerr << "io_uring unavailable, using recvmmsg/sendmmsg" << std::endl;
+  }
+  return std::make_unique<Network::SocketBackend>(sockfd);
+}
 
 /**
  * @brief Create AF_INET,SOCK_RAW,IPPROTO_TCP socket
  * SET_SOCKOPT IP_HDRINCL // IP header included
  * bind it to desired port
+ * in ring mode receive through packet ring, raw socket only sends
+ * start dispatcher - the only reader of the socket (or ring)
+ * in event loop mode the loop reads the backend itself,
+ * a shard only takes its slice of the flows
  */
 // Initialize and set-up the server
 bool Server::launch() {
+  if (shard_count > 0 && console == this)
+    return launch_shards();
   if (!Network::create_server_socket(this->server_sockfd, this->srv_addr,
                                      this->ip.c_str(), this->port) ||
       !Network::bind_to_port(this->port, server_sockfd, srv_addr)) {
     return false;
   }
+  std::unique_ptr<Network::IoBackend> backend;
+  if (ring_ifname.empty()) {
+    backend = socket_backend(server_sockfd);
+  } else {
+    auto ring = std::make_unique<Network::PacketRing>();
+    if (!ring->open(ring_ifname.c_str(), port) ||
+        !Network::attach_drop_filter(server_sockfd))
+      return false;
+    // every shard's ring joins the same group (one per process)
+    if (shard_count > 0 &&
+        !ring->join_fanout(static_cast<uint16_t>(getpid())))
+      return false;
+    backend = std::move(ring);
+  }
+  if (loop) {
+    // no per-peer narrowing, loop takes every flow to our port
+    if (ring_ifname.empty() &&
+        !Network::attach_port_filter(server_sockfd, port, {}, shard_id,
+                                     std::max(shard_count, 1u)))
+      return false;
+    this->backend = std::move(backend);
+    if (!ring_ifname.empty())
+      ring_tx = std::make_unique<Network::SocketBackend>(server_sockfd);
+    tx = ring_tx ? ring_tx.get() : this->backend.get();
+    return true;
+  }
+  thrd_pool = std::make_shared<ThreadPool>(workers);
+  dispatcher =
+      std::make_unique<Network::Dispatcher>(std::move(backend), srv_addr);
+  dispatcher->start();
   // now we need them for each new socket :)
   // setuid(getuid()); // no need in sudo privileges anymore
   return true;
 }
 
 /**
- * @brief Listen all incoming packets, filter by SYN flag
- * append new client to list(vector) and parse packet
- * create new server socket for communication with client.
- * Listen for all incoming packets, filter by ACK flag
- * enqueue handle of new connection to thread pool
- * erase client from list, reset socket (int)
+ * @brief Listen for packets of unknown flows, filter by SYN flag
+ * subscribe to client's flow, so the dispatcher routes its packets
+ * to a dedicated queue, and hand client and queue to the thread pool
+ * (by value, through its lock-free queue). SYN is answered here, the
+ * worker waits for the ACK, so nothing here waits for a round trip
  */
 // Listen and accept connection
 bool Server::accept() {
+  if (!shards.empty())
+    return run_shards();
+  if (loop)
+    return serve();
   for (;;) {
-
-    if (Network::listen_client(server_sockfd, 4, srv_addr, clients))
-      // create new socket for each connection
-      Network::create_server_socket(this->comn_sockfd, srv_addr, ip.c_str(),
-                                    port);
-    // accept connection on a new socket
-    if (Network::accept_connection(comn_sockfd, srv_addr, clients)) {
-      // handle client on other thread
-      thrd_pool->enqueue(
-          [this]() { handle_client(clients.back(), comn_sockfd); });
-      // wait until thread gets copy of socket and client address and then
-      // erase
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      clients.pop_back();
-      comn_sockfd = 0;
-    }
+    struct sockaddr_in client;
+    Network::tcp_options syn;
+    Network::Packet data; // cookie came back on a request
+    if (cookies ? !Network::listen_stateless(server_sockfd,
+                                             dispatcher->backlog(), srv_addr,
+                                             *cookies, client, syn, data)
+                : !Network::listen_client(dispatcher->backlog(), client, syn))
+      continue;
+    // every further packet of this client goes to its own queue
+    bool created;
+    auto flow = dispatcher->subscribe(
+        Network::make_flow_key(client, srv_addr), &created);
+    // the worker takes the request the cookie came on first
+    if (data.data)
+      flow->push(std::move(data));
+    // SYN (or cookie's ACK) resent before we subscribed: its worker has
+    // it already
+    if (!created)
+      continue;
+    // client's ACK waits in the flow until a worker is free
+    if (!cookies)
+      Network::answer_syn(server_sockfd, srv_addr, client, syn);
+    thrd_pool->enqueue(
+        [this, client, syn, flow]() { handle_client(client, syn, flow); });
   }
   return true;
 }
 
-void Server::handle_client(struct sockaddr_in client, int comn_sockfd) {
-  for (;;) {
+void Server::handle_client(struct sockaddr_in client, Network::tcp_options syn,
+                           std::shared_ptr<Network::PacketQueue> flow) {
+  connection conn;
+  conn.peer = client;
+  if (establish(conn, *flow, syn)) {
     std::string data;
-    this->receive_request(data, client, comn_sockfd);
-    this->send_response();
-  };
-  return;
+    while (this->receive_request(data, conn, *flow)) {
+      uint64_t received = Network::Metrics::now();
+      if (handler)
+        this->send_response(conn, data);
+      else
+        this->send_response(conn);
+      series().response_time.record(Network::Metrics::now() - received);
+    }
+    // idle: thread is free again, a new SYN from client reconnects
+    LOG_INFO("closed idle connection with {}", Network::log_addr(client));
+  }
+  dispatcher->unsubscribe(Network::make_flow_key(client, srv_addr));
+}
+
+// Accept connection on the client's flow
+bool Server::establish(connection &conn, Network::PacketQueue &flow,
+                       const Network::tcp_options &syn) {
+  if (!cookies && !Network::accept_connection(server_sockfd, flow, srv_addr,
+                                              conn.peer, syn, true))
+    return false;
+  conn.tcp.negotiate(syn);
+  conn.state = connection::State::Established;
+  series().connections.add();
+  return true;
 }
 
 /**
- * @brief Listen for all incoming packets
- * filter by current client source port
+ * @brief Take next packet of current client from its queue
+ * (segments without payload, like a repeated ACK, are skipped; so is a
+ * retransmitted request unless a handler answers it again)
  * parse packet and log into console
  */
-void Server::receive_request(std::string &data, struct sockaddr_in &client,
-                             int &comn_sockfd) {
-  auto request = std::make_unique<unsigned char[]>(DATAGRAM_SIZE);
-  struct tcphdr *tcph;
-  struct iphdr *iph;
-  int src_port{0};
-  do {
-    Network::receive_packet(comn_sockfd, request.get(), DATAGRAM_SIZE,
-                            srv_addr);
-    iph = reinterpret_cast<struct iphdr *>(request.get());
-    tcph = reinterpret_cast<struct tcphdr *>(
-        (reinterpret_cast<char *>(request.get() + iph->ihl * 4)));
-
-    src_port = tcph->source;
-  } while (src_port != client.sin_port);
+bool Server::receive_request(std::string &data, connection &conn,
+                             Network::PacketQueue &flow) {
+  Network::Packet request;
+  for (;;) {
+    if (!flow.pop_for(request, CONNECTION_IDLE_S * 1000))
+      return false;
+    Network::PacketView view(request);
+    if (view.payload().empty())
+      continue;
+    if (handler || view.seq() + view.payload().size() != conn.request_end)
+      break;
+    LOG_INFO("retransmitted request from {}, already answered",
+             Network::log_addr(conn.peer));
+  }
 
-  Network::parse_packet(request, &seq_num, &ack_num, *clients.data());
-  data.assign(reinterpret_cast<const char *>(request.get()));
-  std::cout << "\tpayload: " << data;
+  Network::PacketView view =
+      Network::parse_packet(request, &conn.seq_num, &conn.ack_num, conn.peer);
+  conn.tcp.received(view);
+  data.assign(view.payload());
+  // response acknowledges request
+  conn.ack_num = conn.request_end = view.seq() + data.size();
+  series().requests.add();
+  LOG_INFO("payload: {}", data);
+  return true;
 }
 
 /**
  * @brief Increment sequence number
  * send packet to desired client
  */
-void Server::send_response() {
-  if (this->seq_num != 0)
-    this->seq_num++;
+void Server::send_response(connection &conn) {
+  if (conn.seq_num != 0)
+    conn.seq_num++;
   /*---------------------------*/
   std::string resp;
+  // request shows up before the prompt asking to answer it
+  Network::Logger::instance().flush();
   std::cout << "\n\nresponse: ";
   std::getline(std::cin, resp);
-  std::unique_ptr<unsigned char[]> packet;
-  int packet_size{0};
-  Network::create_data_packet(&srv_addr, clients.data(), seq_num, ack_num, resp,
-                              packet, &packet_size);
-  Network::send_packet(server_sockfd, packet.get(), packet_size,
-                       *clients.data());
+  unsigned char packet[DATAGRAM_SIZE];
+  size_t packet_size = Network::build_segment(
+      packet, sizeof(packet), &srv_addr, &conn.peer, conn.seq_num,
+      conn.ack_num, TH_PUSH | TH_ACK, conn.tcp, resp.data(),
+      std::min(resp.size(), conn.tcp.payload_max()));
+  if (packet_size == 0)
+    return;
+  Network::send_packet(server_sockfd, packet, packet_size, conn.peer);
+  series().responses.add();
+}
+
+/**
+ * @brief Same as send_response(), handler writes the response right
+ * where the packet's payload goes
+ */
+void Server::send_response(connection &conn, const std::string &request) {
+  if (conn.seq_num != 0)
+    conn.seq_num++;
+  unsigned char packet[DATAGRAM_SIZE];
+  size_t offset = PAYLOAD_OFFSET + conn.tcp.options_len();
+  size_t len = handler->handle(
+      request, packet + offset,
+      std::min(sizeof(packet) - offset, conn.tcp.payload_max()));
+  size_t packet_size = Network::build_segment(
+      packet, sizeof(packet), &srv_addr, &conn.peer, conn.seq_num,
+      conn.ack_num, TH_PUSH | TH_ACK, conn.tcp, packet + offset, len);
+  if (packet_size == 0)
+    return;
+  Network::send_packet(server_sockfd, packet, packet_size, conn.peer);
+  series().responses.add();
+}
+
+/*--------------------------- EVENT LOOP MODE ---------------------------*/
+
+/**
+ * @brief Single thread serves every connection: backend readable ->
+ * drive connection state machines, extra sources (stdin) -> watch()
+ */
+bool Server::serve() {
+  if (!loop->add(backend->fd(), EPOLLIN, [this](uint32_t) { on_readable(); }))
+    return false;
+  if (console == this && !handler)
+    watch(*loop);
+  if (shard_count > 0)
+    std::cout << "\n\nShard " << shard_id << " serving on cpu " << cpu
+              << std::endl;
+  else
+    std::cout << "\n\nServing connections from event loop..." << std::endl;
+  loop->run();
+  return true;
+}
+
+void Server::watch(Network::EventLoop &loop) {
+  // responses are typed in, one line answers the oldest request
+  int flags = fcntl(STDIN_FILENO, F_GETFL);
+  fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+  if (!loop.add(STDIN_FILENO, EPOLLIN, [this](uint32_t) { on_input(); }))
+    std::cerr << "stdin can't be polled, requests stay unanswered"
+              << std::endl;
+}
+
+/**
+ * @brief Drain backend without blocking, burst by burst.
+ * Buffers stay in burst for reuse by the next receive
+ */
+void Server::on_readable() {
+  int received;
+  do {
+    received = backend->receive(burst, BATCH_SIZE, 0);
+    for (int i = 0; i < received; ++i) {
+      shard_stats::add(stats.bytes, burst[i].size);
+      handle_packet(burst[i]);
+    }
+    if (received > 0)
+      shard_stats::add(stats.packets, received);
+    flush();
+  } while (received == BATCH_SIZE);
+}
+
+/**
+ * @brief Connection state machine, same exchange as listen_client +
+ * accept_connection + receive_request, without blocking on any of them:
+ * SYN (any state)         -> send ACK, SynReceived
+ * ACK in SynReceived      -> Established (its data -> on_request())
+ * data in Established     -> on_request()
+ * no ACK for HANDSHAKE_TIMEOUT_S or no packets for CONNECTION_IDLE_S
+ * -> connection dropped
+ * With SYN cookies SYN only gets its cookie ACK, no state; ACK (data
+ * or not) of an unknown flow with a valid cookie -> Established
+ */
+void Server::handle_packet(Network::Packet &packet) {
+  Network::PacketView view(packet);
+  if (!view.valid() || view.tcp()->dest != srv_addr.sin_port)
+    return;
+  Network::flow_key key = Network::packet_flow_key(packet.data.get());
+  const struct tcphdr *tcph = view.tcp();
+
+  if (tcph->syn && cookies) {
+    struct sockaddr_in peer = view.source();
+    Network::tcp_options syn = Network::parse_options(view.options());
+    unsigned char ACK[REQUEST_SIZE];
+    unsigned char *packets[1] = {ACK};
+    size_t packet_size = Network::build_packet<Network::syn_layout>(
+        ACK, sizeof(ACK), &srv_addr, &peer,
+        cookies->make(key, view.seq(), syn.mss), view.seq() + 1,
+        TH_SYN | TH_ACK, Network::SynCookies::answer(syn), TCP_WINDOW_MAX,
+        nullptr, 0);
+    tx->send(packets, &packet_size, &peer, 1);
+    return;
+  }
+  if (tcph->syn) {
+    connection &conn = connections[key];
+    conn.state = connection::State::SynReceived;
+    conn.seq_num = conn.ack_num = conn.request_end = 0;
+    expire_after(conn, key, HANDSHAKE_TIMEOUT_S);
+    Network::tcp_options syn;
+    Network::parse_packet(packet, &conn.seq_num, &conn.ack_num, conn.peer,
+                          &syn);
+    conn.tcp = {};
+    conn.tcp.negotiate(syn);
+    LOG_INFO("SYN-RECEIVED from {}", Network::log_addr(conn.peer));
+    conn.peer.sin_family = AF_INET;
+    unsigned char ACK[REQUEST_SIZE];
+    unsigned char *packets[1] = {ACK};
+    // same numbers and options accept_connection answers with
+    size_t packet_size = Network::build_packet<Network::syn_layout>(
+        ACK, sizeof(ACK), &srv_addr, &conn.peer, 200, 101, TH_SYN | TH_ACK,
+        Network::tcp_session::offer(&syn), TCP_WINDOW_MAX, nullptr, 0);
+    tx->send(packets, &packet_size, &conn.peer, 1);
+    LOG_INFO("SYN-ACK to {}", Network::log_addr(conn.peer));
+    return;
+  }
+
+  auto found = connections.find(key);
+  if (found == connections.end()) {
+    // SYN cookie mode: first state of a connection is its valid ACK,
+    // bare or carrying the first request
+    if (!cookies || !tcph->ack ||
+        !cookies->check(key, view.seq() - 1, view.ack_seq() - 1) ||
+        !view.checksums_valid())
+      return;
+    found = connections.try_emplace(key).first;
+    found->second.tcp.negotiate(Network::SynCookies::restore(
+        view.ack_seq() - 1, Network::parse_options(view.options())));
+  }
+  connection &conn = found->second;
+  if (conn.state == connection::State::SynReceived) {
+    if (!tcph->ack)
+      return;
+    Network::parse_packet(packet, &conn.seq_num, &conn.ack_num, conn.peer);
+    LOG_INFO("ESTABLISHED with {}", Network::log_addr(conn.peer));
+    conn.state = connection::State::Established;
+    expire_after(conn, key, CONNECTION_IDLE_S);
+    shard_stats::add(stats.connections);
+    series().connections.add();
+    // request carrying the ACK is served right away
+  }
+  if (!view.payload().empty()) {
+    expire_after(conn, key, CONNECTION_IDLE_S);
+    on_request(conn, packet);
+  }
+}
+
+/**
+ * @brief (Re)arm connection's timer on the loop's wheel, O(1) however
+ * many connections there are; connection is dropped when it fires
+ */
+void Server::expire_after(connection &conn, const Network::flow_key &key,
+                          unsigned seconds) {
+  if (!conn.idle.callback)
+    conn.idle.callback = [this, key] {
+      auto found = connections.find(key);
+      if (found == connections.end())
+        return;
+      LOG_INFO("closed idle connection with {}",
+               Network::log_addr(found->second.peer));
+      connections.erase(found);
+    };
+  loop->timers().arm(conn.idle, seconds * 1000000000ULL);
+}
+
+void Server::on_request(connection &conn, Network::Packet &packet) {
+  Network::PacketView view =
+      Network::parse_packet(packet, &conn.seq_num, &conn.ack_num, conn.peer);
+  conn.tcp.received(view);
+  uint32_t end = view.seq() + view.payload().size();
+  if (!handler && end == conn.request_end) {
+    // retransmission of a request the console answers (or did): once
+    conn.ack_num = end;
+    return;
+  }
+  conn.request_end = end;
+  LOG_INFO("payload: {}", view.payload());
+  // response acknowledges this request, so pipelining clients can tell
+  // which one it answers
+  conn.ack_num = view.seq() + view.payload().size();
+  shard_stats::add(stats.requests);
+  series().requests.add();
+  Network::flow_key key = Network::make_flow_key(conn.peer, srv_addr);
+  uint64_t received = Network::Metrics::now();
+  if (handler) {
+    handle(conn, view.payload(), received);
+    return;
+  }
+  if (console == this) {
+    queue_answer({this, key, received, conn.ack_num});
+    return;
+  }
+  Server *target = console;
+  pending_request request{this, key, received, conn.ack_num};
+  console->loop->post([target, request] { target->queue_answer(request); });
+}
+
+void Server::queue_answer(const pending_request &request) {
+  awaiting.push_back(request);
+  answer();
+}
+
+// Read what stdin has, lines wait in input until there is a request
+void Server::on_input() {
+  char buffer[DATAGRAM_SIZE];
+  ssize_t len = read(STDIN_FILENO, buffer, sizeof(buffer));
+  if (len <= 0) {
+    if (len == 0 || (errno != EAGAIN && errno != EINTR))
+      loop->remove(STDIN_FILENO); // EOF, nothing more to answer with
+    return;
+  }
+  input.append(buffer, len);
+  answer();
+  flush();
+  // piped answers run ahead of requests, stop reading until they're used
+  if (input.size() >= INPUT_LIMIT && !input_paused) {
+    input_paused = true;
+    loop->modify(STDIN_FILENO, 0);
+  }
+}
+
+/**
+ * @brief Pair complete input lines with awaiting requests, oldest first
+ * (same order blocking getline in send_response gives).
+ * Requests of shards are answered on the shard's own loop
+ */
+void Server::answer() {
+  size_t start = 0, end;
+  while (!awaiting.empty() &&
+         (end = input.find('\n', start)) != std::string::npos) {
+    pending_request next = awaiting.front();
+    awaiting.pop_front();
+    std::string resp = input.substr(start, end - start);
+    if (next.shard == this) {
+      if (!reply(next, resp))
+        continue;
+    } else {
+      Server *shard = next.shard;
+      shard->loop->post([shard, next, resp] {
+        shard->reply(next, resp);
+        shard->flush();
+      });
+    }
+    start = end + 1;
+  }
+  input.erase(0, start); // once, lines of a whole burst at a time
+  if (input_paused && input.size() < INPUT_LIMIT / 2) {
+    input_paused = false;
+    loop->modify(STDIN_FILENO, EPOLLIN);
+  }
+}
+
+bool Server::reply(const pending_request &request, const std::string &resp) {
+  auto found = connections.find(request.key);
+  if (found == connections.end())
+    return false;
+  unsigned char packet[DATAGRAM_SIZE];
+  // later requests of the connection may have arrived meanwhile
+  found->second.ack_num = request.ack;
+  respond(found->second, packet, resp.data(), resp.size());
+  series().response_time.record(Network::Metrics::now() - request.received);
+  return true;
+}
+
+/**
+ * @brief Handler's response goes into the next slot of the burst's
+ * batch, written in place and sent with the rest on flush()
+ */
+void Server::handle(connection &conn, std::string_view request,
+                    uint64_t received) {
+  if (reply_count == BATCH_SIZE)
+    flush();
+  unsigned char *packet = replies[reply_count];
+  size_t offset = PAYLOAD_OFFSET + conn.tcp.options_len();
+  size_t len = handler->handle(
+      request, packet + offset,
+      std::min(DATAGRAM_SIZE - offset, conn.tcp.payload_max()));
+  if (conn.seq_num != 0)
+    conn.seq_num++;
+  size_t packet_size = Network::build_segment(
+      packet, DATAGRAM_SIZE, &srv_addr, &conn.peer, conn.seq_num,
+      conn.ack_num, TH_PUSH | TH_ACK, conn.tcp, packet + offset, len);
+  if (packet_size == 0)
+    return;
+  reply_packets[reply_count] = packet;
+  reply_lengths[reply_count] = packet_size;
+  reply_dests[reply_count] = conn.peer;
+  ++reply_count;
+  shard_stats::add(stats.responses);
+  series().responses.add();
+  series().response_time.record(Network::Metrics::now() - received);
+}
+
+// send_response() for a given connection, packet is the caller's buffer
+void Server::respond(connection &conn, unsigned char *packet,
+                     const void *payload, size_t payload_len) {
+  if (conn.seq_num != 0)
+    conn.seq_num++;
+  unsigned char *packets[1] = {packet};
+  size_t packet_size = Network::build_segment(
+      packet, DATAGRAM_SIZE, &srv_addr, &conn.peer, conn.seq_num,
+      conn.ack_num, TH_PUSH | TH_ACK, conn.tcp, payload,
+      std::min(payload_len, conn.tcp.payload_max()));
+  if (packet_size == 0)
+    return;
+  tx->send(packets, &packet_size, &conn.peer, 1);
+  shard_stats::add(stats.responses);
+  series().responses.add();
+}
+
+// Push sends queued during the burst (io_uring: one submit for all)
+void Server::flush() {
+  if (reply_count > 0) {
+    tx->send(reply_packets, reply_lengths, reply_dests, reply_count);
+    reply_count = 0;
+  }
+  if (tx)
+    tx->flush();
+}
+
+/*---------------------------- SHARDED MODE ----------------------------*/
+
+/**
+ * @brief Set up shard_count shards: each one is an event loop server of
+ * its own (socket, backend, connections, buffers) taking a slice of the
+ * flows, so shards share nothing. This server stays the console
+ */
+bool Server::launch_shards() {
+  if (!loop)
+    use_event_loop();
+  std::vector<int> cpus = usable_cpus();
+  for (unsigned i = 0; i < shard_count; ++i) {
+    auto shard = std::make_unique<Server>(ip, port);
+    shard->loop = std::make_unique<Network::EventLoop>();
+    shard->ring_ifname = ring_ifname;
+    shard->io_uring = io_uring;
+    shard->handler = handler;
+    shard->cookies = cookies;
+    shard->shard_id = i;
+    shard->shard_count = shard_count;
+    shard->cpu = cpus[i % cpus.size()];
+    shard->console = this;
+    if (!shard->launch())
+      return false;
+    shards.push_back(std::move(shard));
+  }
+  last_packets.assign(shard_count, 0);
+  last_bytes.assign(shard_count, 0);
+  return true;
+}
+
+/**
+ * @brief Run every shard on its own pinned thread, console loop reads
+ * stdin (unless there is a handler) and prints per shard counters once
+ * a second
+ */
+bool Server::run_shards() {
+  for (auto &shard : shards) {
+    Server *s = shard.get();
+    shard_threads.emplace_back([s] {
+      if (!pin_to_cpu(s->cpu))
+        std::cerr << "can't pin shard " << s->shard_id << " to cpu " << s->cpu
+                  << std::endl;
+      s->serve();
+    });
+  }
+  if (!handler)
+    watch(*loop);
+  stats_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  struct itimerspec every {};
+  every.it_interval.tv_sec = every.it_value.tv_sec = 1;
+  if (stats_timer < 0 || timerfd_settime(stats_timer, 0, &every, nullptr) < 0 ||
+      !loop->add(stats_timer, EPOLLIN, [this](uint32_t) {
+        uint64_t ticks;
+        while (read(stats_timer, &ticks, sizeof(ticks)) > 0)
+          ;
+        print_stats();
+      }))
+    std::cerr << "shard stats timer failed " << strerror(errno) << std::endl;
+  loop->run();
+  return true;
+}
+
+// Rates since last tick and totals, only while traffic is flowing
+void Server::print_stats() {
+  std::ostringstream out;
+  bool busy = false;
+  uint64_t total_packets = 0, total_bytes = 0;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    const shard_stats &st = shards[i]->stats;
+    uint64_t packets = st.packets.load(std::memory_order_relaxed);
+    uint64_t bytes = st.bytes.load(std::memory_order_relaxed);
+    busy |= packets != last_packets[i];
+    out << "shard " << i << " (cpu " << shards[i]->cpu
+        << "): " << packets - last_packets[i] << " pkts/s "
+        << (bytes - last_bytes[i]) / 1024 << " KiB/s, "
+        << st.connections.load(std::memory_order_relaxed) << " conns "
+        << st.requests.load(std::memory_order_relaxed) << " requests "
+        << st.responses.load(std::memory_order_relaxed) << " responses\n";
+    total_packets += packets - last_packets[i];
+    total_bytes += bytes - last_bytes[i];
+    last_packets[i] = packets;
+    last_bytes[i] = bytes;
+  }
+  if (busy)
+    std::cout << out.str() << "total: " << total_packets << " pkts/s "
+              << total_bytes / 1024 << " KiB/s" << std::endl;
 }
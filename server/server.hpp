@@ -1,32 +1,172 @@
 // server
 #pragma once
+#include "../shared_resources/include/buffer_pool.hpp"
+#include "../shared_resources/include/dispatcher.hpp"
+#include "../shared_resources/include/event_loop.hpp"
+#include "../shared_resources/include/logger.hpp"
+#include "../shared_resources/include/metrics.hpp"
 #include "../shared_resources/include/network.hpp"
+#include "../shared_resources/include/packet_ring.hpp"
+#include "../shared_resources/include/syn_cookie.hpp"
 #include "../shared_resources/include/threadpool.hpp"
+#include "../shared_resources/include/uring_backend.hpp"
+#include "handler.hpp"
+#include <deque>
+#include <fcntl.h> // for non-blocking stdin
 #include <string>
+#include <sys/timerfd.h> // for shard stats ticks
+
+#define INPUT_LIMIT 65536 // stdin buffered ahead of requests, then paused
+#define CONNECTION_IDLE_S 300 // connection without packets is closed
+#define HANDSHAKE_TIMEOUT_S 30 // SYN answered, but no ACK for this long
+#define WORKERS_DEFAULT 64     // threaded mode: clients served at once
+
+// Connection driven by the event loop (handshake -> requests)
+struct connection {
+  enum class State { SynReceived, Established };
+  State state{State::SynReceived};
+  struct sockaddr_in peer;
+  uint32_t seq_num{0}, ack_num{0};
+  uint32_t request_end{0}; // seq + length of last request, 0 -> none yet
+  Network::tcp_session tcp; // options negotiated on handshake
+  Network::Timer idle; // on the loop's wheel, re-armed by every packet
+};
+
+// Counters of one event loop (shard), written by its thread only
+struct alignas(64) shard_stats {
+  std::atomic<uint64_t> packets{0}, bytes{0}, connections{0}, requests{0},
+      responses{0};
+  // single writer: plain load + store, no locked add
+  static void add(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+};
 
 class Server {
 public:
   Server(const std::string ip, const int port);
   virtual ~Server();
 
+  // receive through TPACKET_V3 ring on interface instead of raw socket
+  void use_packet_ring(const std::string &ifname);
+  // serve every connection from one epoll loop instead of thread per client
+  void use_event_loop();
+  // drive raw sockets through io_uring (falls back to recvmmsg/sendmmsg)
+  void use_io_uring();
+  // threaded mode: workers, each serves one client until it goes idle,
+  // clients beyond that wait for a free worker
+  void use_workers(unsigned count);
+  // count event loops, each pinned to a core with own socket (flows split
+  // by kernel filter or PACKET_FANOUT) and own connections
+  void use_shards(unsigned count);
+  // answer requests with handler instead of stdin (shards share it)
+  void use_handler(std::shared_ptr<RequestHandler> handler);
+  // stateless handshakes: connection exists once the final ACK returns
+  // a valid cookie, SYNs keep nothing (shards share the key)
+  void use_syn_cookies();
   bool launch();
   bool accept();
-  virtual void handle_client(struct sockaddr_in client, int comn_sockfd);
-  void send_response();
-  virtual void receive_request(std::string &data, struct sockaddr_in &client,
-                               int &comn_sockfd);
+  // Worker side of accept: handshake on flow, then requests until idle.
+  // client, its SYN's options and flow are all it gets, nothing shared
+  // with accept()
+  virtual void handle_client(struct sockaddr_in client,
+                             Network::tcp_options syn,
+                             std::shared_ptr<Network::PacketQueue> flow);
+  void send_response(connection &conn);
+  // response made by handler from request, no console involved
+  void send_response(connection &conn, const std::string &request);
+  // false if client sent nothing for CONNECTION_IDLE_S
+  virtual bool receive_request(std::string &data, connection &conn,
+                               Network::PacketQueue &flow);
 
 protected:
-  int server_sockfd;
-  int comn_sockfd;
+  /*------------------------ EVENT LOOP MODE ------------------------*/
+  // Register extra descriptors (server: stdin for responses)
+  virtual void watch(Network::EventLoop &loop);
+  // Data segment of an established connection
+  virtual void on_request(connection &conn, Network::Packet &packet);
+  // End of received burst, send what was batched up
+  virtual void flush();
+  /*-----------------------------------------------------------------*/
+
+  // Threaded mode: wait for client's ACK to SYN ACK accept() sent
+  // (with SYN cookies accept() saw it already), syn's options negotiated
+  bool establish(connection &conn, Network::PacketQueue &flow,
+                 const Network::tcp_options &syn);
+
+  // Backend over raw socket: io_uring if asked for and available
+  std::unique_ptr<Network::IoBackend> socket_backend(int sockfd);
+
+  int server_sockfd{-1};
   struct sockaddr_in srv_addr;
-  std::vector<struct sockaddr_in> clients;
+  // only reader of server_sockfd, routes packets to connections
+  std::unique_ptr<Network::Dispatcher> dispatcher;
+
+  std::unique_ptr<Network::EventLoop> loop;
+  // event loop mode: sends to clients (backend itself, unless packet ring)
+  Network::IoBackend *tx{nullptr};
+  shard_stats stats;
 
 private:
+  bool serve();
+  void on_readable();
+  void on_input();
+  void answer();
+  void handle_packet(Network::Packet &packet);
+  void expire_after(connection &conn, const Network::flow_key &key,
+                    unsigned seconds);
+  void respond(connection &conn, unsigned char *packet, const void *payload,
+               size_t payload_len);
+  void handle(connection &conn, std::string_view request, uint64_t received);
+
+  /*------------------------- SHARDED MODE --------------------------*/
+  // Requests are answered from stdin on the console (parent) thread,
+  // shards hand requests in and get responses back through post()
+  struct pending_request {
+    Server *shard; // loop the connection lives on
+    Network::flow_key key;
+    uint64_t received; // Metrics::now() when request arrived
+    uint32_t ack;      // response acknowledges request's bytes up to here
+  };
+  bool reply(const pending_request &request, const std::string &resp);
+  bool launch_shards();
+  bool run_shards();
+  void queue_answer(const pending_request &request);
+  void print_stats();
+
   std::string ip;
   int port;
-
-  uint32_t seq_num, ack_num = 0;
+  std::string ring_ifname; // empty -> raw socket receive
+  bool io_uring{false};
+  std::shared_ptr<RequestHandler> handler; // nullptr -> answers from stdin
+  std::shared_ptr<Network::SynCookies> cookies; // nullptr -> SYN keeps state
 
   std::shared_ptr<ThreadPool> thrd_pool;
+  unsigned workers{WORKERS_DEFAULT};
+
+  unsigned shard_count{0}; // 0 -> not sharded
+  unsigned shard_id{0};
+  int cpu{-1};             // shard is pinned to
+  Server *console{this};   // where requests get answered
+  std::vector<std::unique_ptr<Server>> shards;
+  std::vector<std::thread> shard_threads;
+  int stats_timer{-1};
+  std::vector<uint64_t> last_packets, last_bytes; // at previous tick
+
+  // event loop mode: loop thread is the only reader of backend
+  std::unique_ptr<Network::IoBackend> backend;
+  std::unique_ptr<Network::IoBackend> ring_tx; // packet ring can't send
+  std::unordered_map<Network::flow_key, connection, Network::flow_key_hash>
+      connections;
+  std::deque<pending_request> awaiting; // requests without response yet
+  std::string input;                   // stdin up to incomplete line
+  bool input_paused{false};            // input full, stdin not polled
+  // handler's responses of the burst, built in place, sent on flush()
+  unsigned char replies[BATCH_SIZE][DATAGRAM_SIZE];
+  unsigned char *reply_packets[BATCH_SIZE];
+  size_t reply_lengths[BATCH_SIZE];
+  struct sockaddr_in reply_dests[BATCH_SIZE];
+  unsigned reply_count{0};
+  Network::Packet burst[BATCH_SIZE];
 };
@@ -0,0 +1,70 @@
+// buffer pool
+#pragma once
+#include "network.hpp"
+#include <atomic>
+#include <mutex>
+
+namespace Network {
+
+#define CACHE_LINE 64
+#define POOL_BUFFER_SIZE 2048 // MTU-sized datagram, multiple of cache line
+#define POOL_SLAB_SIZE (2 << 20) // one (huge)page-sized slab per refill
+#define POOL_CACHE_SIZE 64       // buffers a thread keeps for itself
+
+// Occupancy snapshot, all counts are buffers
+struct pool_stats {
+  size_t capacity;     // carved out of slabs so far
+  size_t in_use;       // handed out and not yet released
+  size_t peak_in_use;  // high-water mark of in_use
+  size_t free_central; // in the shared free list
+  size_t free_cached;  // in per-thread caches
+  size_t slabs;
+  size_t huge_slabs; // slabs backed by explicit hugepages
+};
+
+/**
+ * @brief Process-wide pool of fixed-size, cache-line aligned packet
+ * buffers carved out of mmap'ed slabs (optionally hugepage backed).
+ * Each thread keeps a small free list of its own and only touches the
+ * shared list (under mutex) to refill or spill half of it at once.
+ * Buffers are handed out as packet_ptr, dropping it returns the buffer.
+ */
+class BufferPool {
+public:
+  static BufferPool &instance();
+
+  // Back slabs allocated from now on with hugepages (falls back to THP)
+  void use_hugepages(bool enable);
+
+  packet_ptr acquire();
+  void release(unsigned char *buffer);
+  pool_stats stats();
+
+  struct thread_cache; // per-thread free list and counters
+
+private:
+  BufferPool() = default;
+  ~BufferPool();
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  thread_cache &local();
+  void export_stats(); // registers gauges, once
+  void refill(thread_cache &cache);
+  void spill(thread_cache &cache);
+  void grow(); // call with poolMutex held
+  void retire(thread_cache &cache);
+  size_t used() const;
+
+  std::mutex poolMutex; // guards everything below
+  std::vector<unsigned char *> free_list;
+  std::vector<std::pair<void *, size_t>> slabs;
+  std::vector<thread_cache *> caches;
+  size_t huge_slabs{0};
+  size_t capacity{0};
+  uint64_t retired_acquired{0}, retired_released{0};
+  bool hugepages{false};
+
+  std::atomic<size_t> peak{0};
+};
+}; // namespace Network
@@ -0,0 +1,100 @@
+// congestion control
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <netinet/tcp.h> // for TCP_MSS_DEFAULT
+#include <string>
+
+namespace Network {
+
+#define CWND_INITIAL 10    // segments before anything was acknowledged
+#define DUPACK_THRESHOLD 3 // later requests answered -> oldest one is lost
+#define CUBIC_C 0.4        // window growth scale, segments / s^3
+#define CUBIC_BETA 0.7     // window kept on loss
+
+/**
+ * @brief Congestion window of one connection, bytes. State machine:
+ * SlowStart   - window grows by what is acknowledged (doubles per RTT)
+ *               until ssthresh, then Avoidance
+ * Avoidance   - algorithm's growth (NewReno: one segment per RTT)
+ * Recovery    - loss seen: window cut once, until everything in flight
+ *               at the time is acknowledged (NewReno, RFC 6582)
+ * timeout     - any phase: one segment, SlowStart again (RFC 5681)
+ */
+struct congestion_state {
+  enum class Phase { SlowStart, Avoidance, Recovery };
+  Phase phase{Phase::SlowStart};
+  uint32_t mss;
+  uint32_t cwnd;
+  uint32_t ssthresh{UINT32_MAX};
+  uint32_t recover{0}; // next sequence number when loss was seen
+  double growth{0};    // avoidance bytes not added to cwnd yet
+  // CUBIC (RFC 9438), windows in segments
+  double w_max{0};         // window before the last cut
+  double w_est{0};         // what Reno would have by now
+  double k{0};             // s after epoch_start window is back at w_max
+  uint64_t epoch_start{0}; // ns, avoidance since, 0 -> not started
+
+  explicit congestion_state(uint32_t mss = TCP_MSS_DEFAULT)
+      : mss(mss), cwnd(CWND_INITIAL * mss) {}
+};
+
+/**
+ * @brief Algorithm growing and cutting congestion windows. Phases are
+ * the same for every algorithm, only avoidance growth and window after
+ * a cut differ. Keeps nothing per connection, so one instance serves
+ * every connection of the process
+ */
+class CongestionControl {
+public:
+  virtual ~CongestionControl() = default;
+  virtual const char *name() const = 0;
+
+  // acked new bytes, acknowledgement up to ack; srtt_ns 0 -> no estimate
+  void on_ack(congestion_state &state, uint32_t ack, uint32_t acked,
+              uint64_t srtt_ns, uint64_t now_ns) const;
+  // DUPACK_THRESHOLD later requests answered first; snd_nxt: next
+  // sequence number to send. Once per window of data
+  void on_loss(congestion_state &state, uint32_t snd_nxt,
+               uint64_t now_ns) const;
+  // Retransmission timeout
+  void on_timeout(congestion_state &state, uint64_t now_ns) const;
+
+protected:
+  virtual void grow(congestion_state &state, uint32_t acked,
+                    uint64_t srtt_ns, uint64_t now_ns) const = 0;
+  // ssthresh after a loss
+  virtual uint32_t cut(congestion_state &state, uint64_t now_ns) const = 0;
+};
+
+// RFC 5681 / 6582: one segment per RTT, half the window on loss
+class NewReno final : public CongestionControl {
+public:
+  const char *name() const override { return "newreno"; }
+
+protected:
+  void grow(congestion_state &state, uint32_t acked, uint64_t srtt_ns,
+            uint64_t now_ns) const override;
+  uint32_t cut(congestion_state &state, uint64_t now_ns) const override;
+};
+
+/**
+ * @brief RFC 9438: window follows a cubic of time since the last loss,
+ * flat around the window it was lost at, so it is regained quickly on
+ * long round trips, where NewReno needs one RTT per segment; never
+ * slower than Reno would be
+ */
+class Cubic final : public CongestionControl {
+public:
+  const char *name() const override { return "cubic"; }
+
+protected:
+  void grow(congestion_state &state, uint32_t acked, uint64_t srtt_ns,
+            uint64_t now_ns) const override;
+  uint32_t cut(congestion_state &state, uint64_t now_ns) const override;
+};
+
+// "newreno" or "cubic" -> algorithm, nullptr if neither
+std::shared_ptr<CongestionControl>
+make_congestion_control(const std::string &name);
+}; // namespace Network
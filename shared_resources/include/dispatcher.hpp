@@ -0,0 +1,96 @@
+// dispatcher
+#pragma once
+#include "io_backend.hpp"
+#include "network.hpp"
+#include <atomic>             // for stop flag
+#include <condition_variable> // for blocking pop
+#include <deque>
+#include <mutex>
+#include <shared_mutex> // for flow table (many readers, rare writers)
+#include <thread>
+#include <unordered_map>
+
+namespace Network {
+
+// Connection 4-tuple, all fields in network byte order
+struct flow_key {
+  uint32_t saddr;
+  uint32_t daddr;
+  uint16_t sport;
+  uint16_t dport;
+
+  bool operator==(const flow_key &other) const {
+    return saddr == other.saddr && daddr == other.daddr &&
+           sport == other.sport && dport == other.dport;
+  }
+};
+
+struct flow_key_hash {
+  size_t operator()(const flow_key &key) const;
+};
+
+//----------------------------------------------------------------------|
+// Key of a flow travelling from src to dst
+flow_key make_flow_key(const struct sockaddr_in &src,
+                       const struct sockaddr_in &dst);
+//----------------------------------------------------------------------|
+// Key read from ip, tcp headers of a received packet
+flow_key packet_flow_key(const unsigned char *packet);
+//----------------------------------------------------------------------|
+
+// Queue of packets of a single connection, filled by Dispatcher
+class PacketQueue {
+public:
+  void push(Packet packet);
+  Packet pop(); // block until packet is available
+  bool try_pop(Packet &packet);
+  // Block at most timeout_ms, false if nothing came
+  bool pop_for(Packet &packet, int timeout_ms);
+  size_t size(); // packets waiting
+
+private:
+  std::deque<Packet> packets;
+  std::condition_variable cond;
+  std::mutex qMutex;
+};
+
+/**
+ * @brief Single reader of a raw socket (or packet ring).
+ * Every packet designated to local_addr port is copied to user space once,
+ * looked up by its 4-tuple in the flow table and pushed into the queue of
+ * its connection. Packets of unknown flows (handshakes) go to the backlog.
+ */
+class Dispatcher {
+public:
+  Dispatcher(std::unique_ptr<IoBackend> backend,
+             const struct sockaddr_in &local_addr);
+  ~Dispatcher();
+
+  void start();
+  void stop();
+
+  // Route packets of given flow into returned queue, created: false if
+  // flow was subscribed already (same queue returned)
+  std::shared_ptr<PacketQueue> subscribe(const flow_key &key,
+                                         bool *created = nullptr);
+  void unsubscribe(const flow_key &key);
+  // Packets of not (yet) subscribed flows
+  PacketQueue &backlog();
+
+private:
+  void run();
+  void dispatch(Packet &packet);
+  void refresh_filter(); // call with flowsMutex held
+
+  std::unique_ptr<IoBackend> backend;
+  struct sockaddr_in local_addr;
+  std::unordered_map<flow_key, std::shared_ptr<PacketQueue>, flow_key_hash>
+      flows;
+  std::shared_mutex flowsMutex;
+  bool filter_open{false}; // more flows than filter matches, passes all
+  PacketQueue unmatched;
+  std::atomic<bool> running{false};
+  std::thread reader;
+  unsigned depth_gauges[3]; // metrics of queued packets and flows
+};
+}; // namespace Network
@@ -0,0 +1,60 @@
+// event loop
+#pragma once
+#include "timer_wheel.hpp"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sys/epoll.h>
+#include <unordered_map>
+#include <vector>
+
+namespace Network {
+
+#define LOOP_MAX_EVENTS 64 // events taken per epoll_wait
+
+/**
+ * @brief Single-threaded reactor over epoll (level triggered).
+ * Handlers run on the thread calling run(), one descriptor at a time,
+ * so state they touch needs no locking. Other threads hand work in
+ * with post(), which wakes the loop through an eventfd. Timers of the
+ * loop's wheel fire on the loop thread too, between waits.
+ */
+class EventLoop {
+public:
+  using Handler = std::function<void(uint32_t events)>;
+
+  EventLoop();
+  ~EventLoop();
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  // Watch fd for events (EPOLLIN...), false if fd can't be polled
+  bool add(int fd, uint32_t events, Handler handler);
+  bool modify(int fd, uint32_t events);
+  void remove(int fd);
+
+  // Run task on loop thread (callable from any thread)
+  void post(std::function<void()> task);
+
+  // Dispatch events until stop(), timeout_ms bounds each wait
+  void run(int timeout_ms = -1);
+  void stop(); // callable from any thread, also before run()
+
+  // Loop thread only (arm from elsewhere through post())
+  TimerWheel &timers() { return wheel; }
+
+private:
+  void wake();
+  void drain_posted();
+
+  int epfd{-1};
+  int wakefd{-1};
+  // shared, so a handler removing itself is kept alive until it returns
+  std::unordered_map<int, std::shared_ptr<Handler>> handlers;
+  std::vector<std::function<void()>> posted;
+  std::mutex postMutex; // guards posted
+  std::atomic<bool> stopping{false}; // set by stop(), never cleared
+  TimerWheel wheel;
+};
+}; // namespace Network
@@ -0,0 +1,36 @@
+// io backend
+#pragma once
+#include "network.hpp"
+
+namespace Network {
+
+// Source of received packets, polled by Dispatcher (or event loop)
+class IoBackend {
+public:
+  virtual ~IoBackend() = default;
+
+  // Descriptor to wait on
+  virtual int fd() const = 0;
+  // Descriptor to attach kernel filter to
+  virtual int filter_fd() const { return fd(); }
+  // Wait at most timeout_ms for traffic, then hand out up to max packets
+  virtual int receive(Packet *out, int max, int timeout_ms) = 0;
+  // Send packets (caller's buffers are free again on return), backends
+  // that queue sends push them to the kernel on flush()
+  virtual int send(unsigned char **packets, size_t *lengths,
+                   struct sockaddr_in *dests, unsigned count);
+  virtual void flush() {}
+};
+
+// Raw socket: packets copied to user space with recvmmsg, sent with sendmmsg
+class SocketBackend : public IoBackend {
+public:
+  explicit SocketBackend(int sockfd);
+
+  int fd() const override;
+  int receive(Packet *out, int max, int timeout_ms) override;
+
+private:
+  int sockfd;
+};
+}; // namespace Network
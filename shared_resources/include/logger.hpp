@@ -0,0 +1,190 @@
+// logger
+#pragma once
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Network {
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+#ifndef LOG_LEVEL // lowest level compiled in (make CXXFLAGS+=-DLOG_LEVEL=0)
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_SIZE 1024   // records per thread (power of 2)
+#define LOG_RECORD_SIZE 256  // bytes per record, arguments and copied text
+#define LOG_MAX_ARGS 8       // arguments per record
+#define LOG_BATCH_BYTES (64 << 10) // formatted bytes per write()
+
+/**
+ * @brief Log call site: LOG_INFO("source {} seq {}", log_addr(src), seq).
+ * Levels below LOG_LEVEL are discarded at compile time, their arguments
+ * are never evaluated. Format must be a string literal, every {} takes
+ * the next argument
+ */
+#define LOG_AT(level, ...)                                                     \
+  do {                                                                         \
+    if constexpr (LOG_LEVEL_##level >= LOG_LEVEL)                              \
+      ::Network::Logger::log(LOG_LEVEL_##level, __VA_ARGS__);                  \
+  } while (0)
+#define LOG_TRACE(...) LOG_AT(TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(ERROR, __VA_ARGS__)
+
+// ip:port argument (network byte order, as in sockaddr_in)
+struct log_addr {
+  uint32_t ip;
+  uint16_t port;
+  explicit log_addr(const struct sockaddr_in &addr)
+      : ip(addr.sin_addr.s_addr), port(addr.sin_port) {}
+  log_addr(uint32_t ip, uint16_t port) : ip(ip), port(port) {}
+};
+
+/**
+ * @brief Fixed-size binary record, formatting is left to the writer.
+ * Numbers are stored as they are, strings are copied into text
+ * (truncated once it is full)
+ */
+struct log_record {
+  enum Type : uint8_t { Signed, Unsigned, Double, Text, Addr };
+
+  uint64_t time; // steady clock, ns
+  const char *format;
+  uint64_t args[LOG_MAX_ARGS]; // Text: offset << 16 | length
+  uint8_t types[LOG_MAX_ARGS];
+  uint8_t level;
+  uint8_t argc;
+  uint8_t text_len;
+  char text[LOG_RECORD_SIZE - 2 * sizeof(uint64_t) -
+            LOG_MAX_ARGS * (sizeof(uint64_t) + 1) - 3];
+
+  template <typename T> void put(const T &value) {
+    if constexpr (std::is_same<T, bool>::value || std::is_unsigned<T>::value)
+      push(Unsigned, static_cast<uint64_t>(value));
+    else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value)
+      push(Signed, static_cast<uint64_t>(static_cast<int64_t>(value)));
+    else if constexpr (std::is_floating_point<T>::value) {
+      uint64_t bits;
+      double d = value;
+      memcpy(&bits, &d, sizeof(bits));
+      push(Double, bits);
+    } else if constexpr (std::is_same<T, log_addr>::value)
+      push(Addr, static_cast<uint64_t>(value.ip) << 16 | value.port);
+    else
+      put_text(std::string_view(value));
+  }
+  void put_text(std::string_view value);
+
+private:
+  void push(Type type, uint64_t value) {
+    types[argc] = type;
+    args[argc++] = value;
+  }
+};
+static_assert(sizeof(log_record) == LOG_RECORD_SIZE, "log_record size");
+
+/**
+ * @brief Single producer (owning thread), single consumer (writer) ring.
+ * A full ring drops the record and counts it, the producer never waits
+ */
+struct LogRing {
+  log_record records[LOG_RING_SIZE];
+  alignas(64) std::atomic<uint64_t> head{0}; // next record writer reads
+  alignas(64) std::atomic<uint64_t> tail{0}; // next record owner fills
+  uint64_t head_cache{0};                    // owner's view of head
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> closed{false}; // owner exited, freed once drained
+
+  log_record *reserve() {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t - head_cache == LOG_RING_SIZE) {
+      head_cache = head.load(std::memory_order_acquire);
+      if (t - head_cache == LOG_RING_SIZE) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+    }
+    return &records[t & (LOG_RING_SIZE - 1)];
+  }
+  void commit() {
+    tail.store(tail.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  }
+};
+
+/**
+ * @brief Process-wide asynchronous logger. Every logging thread gets a
+ * ring of its own (registered once, under mutex), a background thread
+ * drains all rings, merges records by time, formats them and writes
+ * them to stdout in batches. Records lost to full rings are reported.
+ * Started by the first record, flushed and stopped at exit
+ */
+class Logger {
+public:
+  static Logger &instance();
+
+  template <typename... Args>
+  static void log(uint8_t level, const char *format, const Args &...args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    LogRing &ring = instance().local();
+    log_record *record = ring.reserve();
+    if (!record)
+      return;
+    record->time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+    record->format = format;
+    record->level = level;
+    record->argc = 0;
+    record->text_len = 0;
+    (record->put(args), ...);
+    ring.commit();
+  }
+
+  // Write out everything logged so far (blocks until written)
+  void flush();
+  // Records lost to full rings since start
+  uint64_t dropped();
+
+  struct ring_owner; // per-thread handle, closes ring on thread exit
+
+private:
+  Logger();
+  ~Logger() = default;
+  Logger(const Logger &) = delete;
+  Logger &operator=(const Logger &) = delete;
+
+  LogRing &local();
+  void run();
+  // drain every ring once, returns number of records written
+  size_t drain();
+  void format(const log_record &record, std::string &out) const;
+  void write_out(std::string &out);
+  static void stop();
+
+  std::mutex ringsMutex; // guards rings
+  std::vector<LogRing *> rings;
+  std::mutex drainMutex; // one drain at a time (writer or flush)
+  uint64_t retired_dropped{0}, reported_dropped{0};
+  std::chrono::system_clock::time_point wall_start;
+  uint64_t steady_start;
+  std::atomic<bool> running{true};
+  std::thread writer;
+};
+}; // namespace Network
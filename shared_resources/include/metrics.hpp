@@ -0,0 +1,154 @@
+// metrics
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Network {
+
+#define METRICS_MAX_COUNTERS 64   // counters in the registry
+#define METRICS_MAX_HISTOGRAMS 16 // histograms in the registry
+#define METRICS_INTERVAL 1        // seconds between writes of export file
+#define HIST_SUB_BITS 4  // 2^4 sub-buckets per power of two (~6% error)
+#define HIST_MAX_BITS 40 // values up to 2^40 (ns: ~18 minutes)
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+// Log-linear (HDR) histogram of one thread, written by that thread only
+struct hist_shard {
+  std::atomic<uint64_t> buckets[HIST_BUCKETS];
+  std::atomic<uint64_t> count{0}, sum{0}, max{0};
+
+  hist_shard();
+  void record(uint64_t value);
+  void reset();
+  void merge(const hist_shard &other);
+  // value at quantile q (0..1], within bucket precision
+  uint64_t quantile(double q) const;
+  static unsigned bucket(uint64_t value);
+  static uint64_t highest(unsigned bucket); // largest value in bucket
+};
+
+// Values of one thread, never shared with other writers
+struct metrics_block {
+  std::atomic<uint64_t> counters[METRICS_MAX_COUNTERS];
+  std::atomic<hist_shard *> histograms[METRICS_MAX_HISTOGRAMS];
+  bool registered{false};
+
+  metrics_block();
+  ~metrics_block();
+};
+
+// Monotonic counter, add() touches the calling thread's slot only
+struct Counter {
+  uint16_t id;
+  void add(uint64_t n = 1) const;
+};
+
+// Latency (or any value) distribution, record() in ns for _seconds series
+struct Histogram {
+  uint16_t id;
+  void record(uint64_t value) const;
+};
+
+/**
+ * @brief Process-wide metrics registry. Counters and histograms are
+ * sharded per thread (single writer, no locked instructions), merged
+ * only when rendered. Gauges are callbacks sampled at render time.
+ * Rendered in Prometheus text format, periodically written to a file
+ * or served to whoever connects to a UNIX socket
+ */
+class Metrics {
+public:
+  static Metrics &instance();
+
+  // Registering a name again returns the same series
+  Counter counter(const std::string &name, const std::string &help);
+  Histogram histogram(const std::string &name, const std::string &help);
+  // read() runs on the exporting thread (registry locked), gauges with
+  // the same name are summed; returns id for remove_gauge()
+  unsigned gauge(const std::string &name, const std::string &help,
+                 std::function<double()> read);
+  void remove_gauge(unsigned id);
+
+  std::string render();
+  // target: file path (rewritten every interval seconds) or unix:<path>
+  bool export_to(const std::string &target,
+                 unsigned interval = METRICS_INTERVAL);
+
+  static uint64_t now(); // steady clock, ns
+  static metrics_block &local();
+
+private:
+  friend struct metrics_block;
+  Metrics();
+  ~Metrics() = default;
+  Metrics(const Metrics &) = delete;
+  Metrics &operator=(const Metrics &) = delete;
+
+  struct series {
+    std::string name, help;
+  };
+  struct gauge_entry {
+    unsigned id;
+    std::string name, help;
+    std::function<double()> read;
+  };
+
+  void enroll(metrics_block &block);
+  void retire(metrics_block &block);
+  uint16_t find_or_add(std::vector<series> &list, size_t limit,
+                       const std::string &name, const std::string &help);
+  void run_export();
+  static void stop();
+
+  std::mutex metricsMutex; // guards everything below
+  std::vector<series> counters, histograms;
+  std::vector<gauge_entry> gauges;
+  unsigned next_gauge{0};
+  std::vector<metrics_block *> blocks;
+  // values of exited threads
+  uint64_t retired_counters[METRICS_MAX_COUNTERS]{};
+  std::unique_ptr<hist_shard> retired_histograms[METRICS_MAX_HISTOGRAMS];
+
+  std::string target;
+  unsigned interval{METRICS_INTERVAL};
+  int listen_fd{-1}; // unix socket target
+  std::atomic<bool> exporting{false};
+  std::thread exporter;
+};
+
+inline metrics_block &Metrics::local() {
+  thread_local metrics_block block;
+  if (!block.registered)
+    instance().enroll(block);
+  return block;
+}
+
+inline void Counter::add(uint64_t n) const {
+  std::atomic<uint64_t> &slot = Metrics::local().counters[id];
+  slot.store(slot.load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+}
+
+inline void Histogram::record(uint64_t value) const {
+  std::atomic<hist_shard *> &slot = Metrics::local().histograms[id];
+  hist_shard *shard = slot.load(std::memory_order_relaxed);
+  if (!shard) {
+    shard = new hist_shard();
+    slot.store(shard, std::memory_order_release);
+  }
+  shard->record(value);
+}
+
+// Series every component feeds
+namespace metric {
+extern const Counter packets_in, bytes_in, packets_out, bytes_out;
+extern const Counter checksum_failures, malformed, filtered_out;
+extern const Counter backlog_dropped;
+}; // namespace metric
+}; // namespace Network
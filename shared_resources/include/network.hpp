@@ -10,30 +10,265 @@
 #include <netinet/tcp.h> // For tcphdr
 #include <string.h>      // for logging with strerror
 #include <string>
-#include <sys/types.h> // For socket types
+#include <string_view> // for PacketView payload/options
+#include <sys/socket.h> // For recvmmsg/sendmmsg
+#include <sys/types.h>  // For socket types
 #include <thread>      // for timeouts
 #include <unistd.h>    // POSIX
 #include <vector> // for accepting std::vector<struct sockaddr_in> as parameter
 
 namespace Network {
 
+class PacketQueue; // dispatcher.hpp
+class PacketRing;  // packet_ring.hpp
+class BufferPool;  // buffer_pool.hpp
+class SynCookies;  // syn_cookie.hpp
+
 #define DATAGRAM_SIZE 1460 // standard packet size(length)
-#define OPT_SIZE 20        // TCP options size(length)
+#define OPT_SIZE 20        // TCP options size(length) of SYN, syn_layout
+#define FILTER_MAX_PEERS 512 // peers matched by socket filter individually
+#define BATCH_SIZE 32        // packets per recvmmsg/sendmmsg call
+#define BACKLOG_MAX 4096     // unknown-flow packets queued, more dropped
+#define CHECKSUM_CHECK_LEN 9000 // longest buffer checksum_check tries
+#define CHECKSUM_SHORT_LEN 128  // shorter buffers skip the vector kernels
 
 #define REQUEST_SIZE                                                           \
   (sizeof(struct iphdr) + sizeof(struct tcphdr) +                              \
    OPT_SIZE) // size of typical SYN/ACK-only packet
+#define PAYLOAD_OFFSET                                                         \
+  (sizeof(struct iphdr) + sizeof(struct tcphdr)) // payload without options
+
+// TCP_MSS_DEFAULT (netinet/tcp.h, 536): peer's SYN had no MSS option
+#define TCP_WINDOW_MAX 65535 // largest window field, unscaled
+#define TCP_WSCALE_MAX 14    // larger shifts are taken as 14 (RFC 7323)
+#define LOCAL_MSS (DATAGRAM_SIZE - PAYLOAD_OFFSET) // we take full datagrams
+#define LOCAL_WSCALE 7          // our window field counts 128 byte units
+#define LOCAL_WINDOW (1u << 20) // bytes we take in flight once scaled
+
+// Gives packet memory back to where it came from: heap, ring block or pool
+struct packet_release {
+  PacketRing *ring{nullptr};
+  BufferPool *pool{nullptr};
+
+  packet_release() = default;
+  packet_release(std::default_delete<unsigned char[]>) {}
+  explicit packet_release(PacketRing *ring) : ring(ring) {}
+  explicit packet_release(BufferPool *pool) : pool(pool) {}
+  void operator()(unsigned char *data) const;
+};
+using packet_ptr = std::unique_ptr<unsigned char[], packet_release>;
+
+// Received datagram (ip header onwards)
+struct Packet {
+  packet_ptr data;
+  size_t size{0};
+};
+
+/**
+ * @brief Non-owning view of an ip/tcp datagram laid out in some buffer
+ * (pool buffer, ring block, stack). Header lengths are read and checked
+ * against the buffer once, accessors are plain pointer arithmetic.
+ * View is only valid while the buffer it points into is alive.
+ */
+class PacketView {
+public:
+  PacketView() = default;
+  PacketView(unsigned char *data, size_t size);
+  explicit PacketView(const Packet &packet);
+
+  // Headers fit into buffer and lengths are consistent
+  bool valid() const { return tcphdrlen != 0; }
+
+  struct iphdr *ip() const {
+    return reinterpret_cast<struct iphdr *>(data);
+  }
+  struct tcphdr *tcp() const {
+    return reinterpret_cast<struct tcphdr *>(data + iphdrlen);
+  }
+  size_t ip_len() const { return iphdrlen; }
+  size_t tcp_len() const { return tcphdrlen; }
+  // Whole datagram length as stated by ip header (clamped to buffer)
+  size_t length() const { return iphdrlen + tcphdrlen + payload_len; }
+
+  // Tcp options (bytes between fixed header and payload)
+  std::string_view options() const;
+  std::string_view payload() const;
+
+  // Host byte order
+  uint32_t seq() const { return ntohl(tcp()->seq); }
+  uint32_t ack_seq() const { return ntohl(tcp()->ack_seq); }
+  uint16_t window() const { return ntohs(tcp()->window); }
+  struct sockaddr_in source() const;
 
-// pseudo header needed for checksum calculation
-struct pseudo_header {
-  u_int32_t src_addr;
-  u_int32_t dst_addr;
-  u_int8_t placeholder;
-  u_int8_t protocol;
-  u_int16_t tcp_length;
+  // Verify ip and tcp checksums over the buffer as is (read only)
+  bool checksums_valid() const;
+
+private:
+  unsigned char *data{nullptr};
+  uint16_t iphdrlen{0};
+  uint16_t tcphdrlen{0};
+  size_t payload_len{0};
+};
+
+/*---------------------------- TCP OPTIONS ----------------------------*/
+// Options of one segment, host byte order
+struct tcp_options {
+  uint16_t mss{0};   // 0 -> not present
+  int8_t wscale{-1}; // -1 -> not present
+  bool sack_permitted{false};
+  bool timestamps{false};
+  uint32_t tsval{0}, tsecr{0};
+};
+
+static inline void store16(unsigned char *out, uint16_t value) {
+  out[0] = value >> 8;
+  out[1] = value;
+}
+static inline void store32(unsigned char *out, uint32_t value) {
+  store16(out, value >> 16);
+  store16(out + 2, value);
+}
+
+/**
+ * @brief Option layouts fixed at compile time: every option has its slot
+ * at a constant offset, so writing them is a few stores and the header
+ * length never depends on what was negotiated. Option left out of
+ * tcp_options (mss 0, wscale -1, ...) is written as NOPs in its slot.
+ * SYN: MSS, SACK permitted, timestamps, NOP, window scale (Linux order)
+ */
+struct syn_layout {
+  static constexpr uint16_t size = 20;
+  static constexpr size_t tsval_at = 8;
+
+  static void write(unsigned char *out, const tcp_options &options) {
+    memset(out, TCPOPT_NOP, size);
+    if (options.mss != 0) {
+      out[0] = TCPOPT_MAXSEG;
+      out[1] = TCPOLEN_MAXSEG;
+      store16(out + 2, options.mss);
+    }
+    if (options.sack_permitted) {
+      out[4] = TCPOPT_SACK_PERMITTED;
+      out[5] = TCPOLEN_SACK_PERMITTED;
+    }
+    if (options.timestamps) {
+      out[6] = TCPOPT_TIMESTAMP;
+      out[7] = TCPOLEN_TIMESTAMP;
+      store32(out + tsval_at, options.tsval);
+      store32(out + tsval_at + 4, options.tsecr);
+    }
+    if (options.wscale >= 0) {
+      out[17] = TCPOPT_WINDOW;
+      out[18] = TCPOLEN_WINDOW;
+      out[19] = options.wscale;
+    }
+  }
+};
+static_assert(syn_layout::size == OPT_SIZE, "SYN options fill OPT_SIZE");
+
+// Segments of a connection with timestamps: NOP, NOP, timestamps
+struct ts_layout {
+  static constexpr uint16_t size = 12;
+  static constexpr size_t tsval_at = 4;
+
+  static void write(unsigned char *out, const tcp_options &options) {
+    out[0] = out[1] = TCPOPT_NOP;
+    out[2] = TCPOPT_TIMESTAMP;
+    out[3] = TCPOLEN_TIMESTAMP;
+    store32(out + tsval_at, options.tsval);
+    store32(out + tsval_at + 4, options.tsecr);
+  }
 };
 
+// Decode options (ts_layout is recognized without walking them),
+// unknown and malformed ones are skipped
+tcp_options parse_options(std::string_view raw);
+//----------------------------------------------------------------------|
+// TSval clock: milliseconds of the steady clock
+uint32_t tcp_timestamp();
+
+/**
+ * @brief What the handshake settled for one connection: an option is
+ * used only if both SYNs carried it (window scaling RFC 7323). Our SYN
+ * offers every option but SACK permitted (no SACK blocks are sent or
+ * read), so the peer's SYN decides
+ */
+struct tcp_session {
+  uint16_t mss{TCP_MSS_DEFAULT}; // peer's: payload + options per segment
+  uint8_t snd_wscale{0};         // peer's window field << snd_wscale
+  uint8_t rcv_wscale{0};         // our window field << rcv_wscale
+  bool timestamps{false};
+  uint32_t ts_recent{0};            // peer's latest TSval, echoed back
+  uint32_t snd_wnd{TCP_WINDOW_MAX}; // bytes peer takes in flight
+
+  // Options of our SYN; answering peer's (SYN ACK) - what syn offered
+  static tcp_options offer(const tcp_options *syn = nullptr);
+  void negotiate(const tcp_options &syn);
+  // Segment from peer: window, TSval to echo. Returns its options
+  // (only parsed with timestamps on)
+  tcp_options received(const PacketView &view);
+
+  // Window field of our segments
+  uint16_t window() const;
+  // Options of our next segment: TSval now, echoing ts_recent
+  tcp_options stamp() const;
+  uint16_t options_len() const { return timestamps ? ts_layout::size : 0; }
+  // Payload peer takes per segment
+  size_t payload_max() const { return mss - options_len(); }
+};
+/*--------------------------------------------------------------------*/
+
 /*------------------- PACKET TYPES CONSTRUCTION -----------------------*/
+// Write packet into caller's buffer (no allocation), flags - TH_* bits,
+// options_len zeroed bytes of tcp options, returns size or 0 if too small;
+// payload already in place (written at its offset in buffer) isn't copied
+size_t build_packet(unsigned char *buffer, size_t capacity,
+                    const struct sockaddr_in *src,
+                    const struct sockaddr_in *dst, uint32_t seq,
+                    uint32_t ack_seq, uint8_t flags, uint16_t options_len,
+                    const void *payload, size_t payload_len,
+                    uint16_t window = TCP_WINDOW_MAX);
+//----------------------------------------------------------------------|
+// build_packet in two steps: headers and payload, checksums at last
+size_t lay_out_packet(unsigned char *buffer, size_t capacity,
+                      const struct sockaddr_in *src,
+                      const struct sockaddr_in *dst, uint32_t seq,
+                      uint32_t ack_seq, uint8_t flags, uint16_t options_len,
+                      const void *payload, size_t payload_len,
+                      uint16_t window);
+void seal_packet(unsigned char *buffer, size_t size);
+//----------------------------------------------------------------------|
+// Same with options written in Layout (syn_layout, ts_layout)
+template <typename Layout>
+size_t build_packet(unsigned char *buffer, size_t capacity,
+                    const struct sockaddr_in *src,
+                    const struct sockaddr_in *dst, uint32_t seq,
+                    uint32_t ack_seq, uint8_t flags,
+                    const tcp_options &options, uint16_t window,
+                    const void *payload, size_t payload_len) {
+  size_t size =
+      lay_out_packet(buffer, capacity, src, dst, seq, ack_seq, flags,
+                     Layout::size, payload, payload_len, window);
+  if (size != 0) {
+    Layout::write(buffer + PAYLOAD_OFFSET, options);
+    seal_packet(buffer, size);
+  }
+  return size;
+}
+//----------------------------------------------------------------------|
+// Segment of an established connection: timestamps if the session has
+// them (payload at PAYLOAD_OFFSET + session.options_len()), its window
+size_t build_segment(unsigned char *buffer, size_t capacity,
+                     const struct sockaddr_in *src,
+                     const struct sockaddr_in *dst, uint32_t seq,
+                     uint32_t ack_seq, uint8_t flags,
+                     const tcp_session &session, const void *payload,
+                     size_t payload_len);
+//----------------------------------------------------------------------|
+// New TSval for a segment built by build_segment with timestamps
+// (retransmission), tcp checksum fixed incrementally
+void restamp(unsigned char *packet, uint32_t tsval);
+//----------------------------------------------------------------------|
 // Create connection request packet
 void create_syn_packet(struct sockaddr_in *src, struct sockaddr_in *dst,
                        std::unique_ptr<unsigned char[]> &packet,
@@ -68,33 +303,96 @@ int create_client_socket(int &client_sockfd, struct sockaddr_in &client_addr,
 //---------------------------------------------------------------------|
 // Bind server's socket
 bool bind_to_port(int port, int &sockfd, struct sockaddr_in &addr);
+//---------------------------------------------------------------------|
+// Attach (or atomically replace) kernel BPF filter: pass TCP to port,
+// drop RSTs, with peers given - only SYNs and packets from known peers,
+// with shards > 1 - only flows hashing to shard
+bool attach_port_filter(int sockfd, int port,
+                        const std::vector<struct sockaddr_in> &peers = {},
+                        unsigned shard = 0, unsigned shards = 1);
+//---------------------------------------------------------------------|
+// Same for every port from first_port to last_port (proxy's upstream range)
+bool attach_range_filter(int sockfd, int first_port, int last_port,
+                         const std::vector<struct sockaddr_in> &peers = {});
 /*--------------------------------------------------------------------*/
 
 //------------------------------------------------------------------------------|
 
 /*--------------------  COMMUNICATION INTERFACE ----------------------*/
-// Read ip, tcp headers, checksum etc.
-void parse_packet(std::unique_ptr<unsigned char[]> &packet, uint32_t *seq,
-                  uint32_t *ack, struct sockaddr_in &source);
+// Read ip, tcp headers (options too if asked for), verify checksums,
+// log; packet is left untouched
+PacketView parse_packet(const Packet &packet, uint32_t *seq, uint32_t *ack,
+                        struct sockaddr_in &source,
+                        tcp_options *options = nullptr);
 //----------------------------------------------------------------------|
-// Calculate checksum of packet
+// Calculate checksum of packet (widest kernel the cpu supports)
 unsigned short checksum(void *buffer, unsigned len);
 //----------------------------------------------------------------------|
-// Listen for incoming connections
-bool listen_client(int &server_sockfd, int numcl,
-                   struct sockaddr_in &server_addr,
-                   std::vector<struct sockaddr_in> &clients);
+// TCP checksum over segment in place, pseudo header taken from iph
+// (tcph->check must be 0)
+uint16_t tcp_checksum(const struct iphdr *iph, const struct tcphdr *tcph,
+                      size_t tcp_len);
+//----------------------------------------------------------------------|
+// Original 16 bits at a time routine, reference for faster kernels
+unsigned short checksum_reference(void *buffer, unsigned len);
+//----------------------------------------------------------------------|
+// Name of kernel checksum() dispatches to ("avx2", "sse2", "scalar64")
+const char *checksum_kernel_name();
+//----------------------------------------------------------------------|
+// Every kernel the cpu supports against checksum_reference over random
+// lengths and alignments; name of first kernel that differs, else nullptr
+const char *checksum_check(unsigned rounds, unsigned seed = 1);
+//----------------------------------------------------------------------|
+// Incremental checksum update for changed 16/32-bit field (RFC 1624)
+uint16_t checksum_update16(uint16_t check, uint16_t old_val,
+                           uint16_t new_val);
+uint16_t checksum_update32(uint16_t check, uint32_t old_val,
+                           uint32_t new_val);
+//----------------------------------------------------------------------|
+// Rewrite addresses and ports (network byte order) of received packet,
+// fix ip and tcp checksums incrementally
+void rewrite_header(struct iphdr *iph, struct tcphdr *tcph, uint32_t saddr,
+                    uint32_t daddr, uint16_t sport, uint16_t dport);
+//----------------------------------------------------------------------|
+// Replace payload from offset on with data, fix lengths and checksums
+// incrementally, returns new packet length or 0 if over capacity
+size_t rewrite_payload(unsigned char *packet, size_t capacity, size_t offset,
+                       const void *data, size_t len);
+//----------------------------------------------------------------------|
+// Listen for incoming connections (packets of unknown flows),
+// client: address of the next SYN's sender, syn: its options
+bool listen_client(PacketQueue &backlog, struct sockaddr_in &client,
+                   tcp_options &syn);
+// Same with SYN cookies: every SYN is answered at once and forgotten,
+// client: sender of the first ACK carrying a valid cookie (established),
+// syn: its SYN's options as far as cookie and ACK restore them,
+// data: that ACK if it carries payload (first request), else left empty
+bool listen_stateless(int &server_sockfd, PacketQueue &backlog,
+                      struct sockaddr_in &server_addr,
+                      const SynCookies &cookies, struct sockaddr_in &client,
+                      tcp_options &syn, Packet &data);
 //---------------------------------------------------------------------|
 // Make connection request
-// Send SYN signal and listen for SYN ACK
+// Send SYN signal and listen for SYN ACK, SYN is resent with exponential
+// backoff (RTO_INITIAL_MS doubling), false after RETRIES_MAX resends.
+// Options SYN ACK answered with are negotiated into session
 bool connect_to_server(int &client_sockfd, struct sockaddr_in &client_addr,
                        struct sockaddr_in &server_addr, const char *ip,
-                       int port, uint32_t *seq_num, uint32_t *ack_num);
+                       int port, uint32_t *seq_num, uint32_t *ack_num,
+                       tcp_session &session);
+//---------------------------------------------------------------------|
+// Answer client's SYN (options syn) with SYN ACK
+void answer_syn(int &server_sockfd, struct sockaddr_in &server_addr,
+                struct sockaddr_in &client, const tcp_options &syn);
 //---------------------------------------------------------------------|
 // Accept pending connection request
-// Respond to SYN with SYN ACK
-int accept_connection(int &server_sockfd, struct sockaddr_in &server_addr,
-                      std::vector<struct sockaddr_in> &clients);
+// Respond to SYN with SYN ACK (unless answered already), wait for ACK on
+// client's flow, SYN ACK resent like connect_to_server's SYN, false if
+// client never ACKs
+int accept_connection(int &server_sockfd, PacketQueue &flow,
+                      struct sockaddr_in &server_addr,
+                      struct sockaddr_in &client, const tcp_options &syn,
+                      bool answered = false);
 //---------------------------------------------------------------------|
 // Send raw packet with some logging if exception
 ssize_t send_packet(int sockfd, void *packet, size_t packet_len,
@@ -104,6 +402,20 @@ ssize_t send_packet(int sockfd, void *packet, size_t packet_len,
 ssize_t receive_packet(int sockfd, void *buffer, size_t buffer_len,
                        struct sockaddr_in &dest_addr);
 //---------------------------------------------------------------------|
+// Receive up to count packets with one recvmmsg call, returns number of
+// packets, their lengths and (if sources != nullptr) senders
+int receive_batch(int sockfd, unsigned char **buffers, size_t buffer_len,
+                  size_t *lengths, struct sockaddr_in *sources,
+                  unsigned count, int flags = MSG_WAITFORONE);
+//---------------------------------------------------------------------|
+// Send count packets with as few sendmmsg calls as possible,
+// returns number of packets sent
+int send_batch(int sockfd, unsigned char **packets, const size_t *lengths,
+               struct sockaddr_in *dests, unsigned count);
+//---------------------------------------------------------------------|
+// Socket is used for sending only, let the kernel drop what it receives
+bool attach_drop_filter(int sockfd);
+//---------------------------------------------------------------------|
 // Close socket
 void close_socket(int socket_fd);
 /*--------------------------------------------------------------------*/
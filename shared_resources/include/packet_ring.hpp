@@ -0,0 +1,53 @@
+// packet ring
+#pragma once
+#include "io_backend.hpp"
+#include <atomic>
+#include <linux/if_packet.h> // for TPACKET_V3
+
+namespace Network {
+
+#define RING_BLOCK_SIZE (1 << 20) // bytes per ring block
+#define RING_BLOCK_NR 64          // blocks in ring
+#define RING_FRAME_SIZE 2048      // nominal frame size (V3 packs variable)
+#define RING_RETIRE_TOV 10        // ms before kernel hands out partial block
+
+/**
+ * @brief AF_PACKET socket with TPACKET_V3 memory-mapped block ring.
+ * Packets are handed out as views into the ring (no copy), each view holds
+ * a reference to its block. Block goes back to the kernel once the reader
+ * moved past it and every view into it was released.
+ * Receive only - packets are sent through the raw socket.
+ */
+class PacketRing : public IoBackend {
+public:
+  PacketRing() = default;
+  ~PacketRing();
+  PacketRing(const PacketRing &) = delete;
+  PacketRing &operator=(const PacketRing &) = delete;
+
+  // Open ring on interface (e.g. "lo"), kernel filter passes TCP to port
+  bool open(const char *ifname, int port);
+  // Join PACKET_FANOUT group (after open): kernel spreads flows over
+  // every ring of the group by flow hash, a flow stays on one ring
+  bool join_fanout(uint16_t group);
+
+  int fd() const override;
+  int receive(Packet *out, int max, int timeout_ms) override;
+  // Called by packet_release when a view is dropped
+  void release(const unsigned char *data);
+
+private:
+  struct tpacket_block_desc *block(unsigned index) const;
+  void put_block(unsigned index);
+
+  int sockfd{-1};
+  unsigned char *map{nullptr};
+  size_t map_size{0};
+  // views handed out + 1 while reader is inside the block
+  std::unique_ptr<std::atomic<unsigned>[]> refs;
+
+  unsigned current{0};              // block being read
+  unsigned remaining{0};            // packets left in current block
+  struct tpacket3_hdr *next{nullptr}; // next packet in current block
+};
+}; // namespace Network
@@ -0,0 +1,86 @@
+// session table
+#pragma once
+#include "network.hpp"
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace Network {
+
+#define SESSION_PORT_FIRST 20000  // default range of upstream ports
+#define SESSION_PORT_COUNT 40000  // (one session each)
+#define SESSION_IDLE_TIMEOUT 300  // seconds without traffic before expiry
+
+/**
+ * @brief NAT table of the proxy: client (ip, port) <-> upstream port.
+ * Every session owns one port of a managed range, so the range bounds the
+ * number of sessions. Lookups in both directions are lock-free and O(1):
+ * the upstream port indexes the session arrays directly, the client
+ * address is found in an open addressing (linear probing) index.
+ * Writers (open, close, expire) are serialized by a mutex.
+ * Ports are in host byte order.
+ */
+class SessionTable {
+public:
+  enum class State : uint8_t { Free, Connecting, Ready };
+
+  SessionTable(uint16_t first_port = SESSION_PORT_FIRST,
+               uint16_t count = SESSION_PORT_COUNT);
+  SessionTable(const SessionTable &) = delete;
+  SessionTable &operator=(const SessionTable &) = delete;
+
+  // Port of client's session, new (Connecting) session if it has none,
+  // created tells which. 0 if every port is taken
+  uint16_t open(const struct sockaddr_in &client, bool &created);
+  void close(uint16_t port);
+  // Close sessions without traffic for idle_seconds, returns how many
+  size_t expire(uint32_t idle_seconds = SESSION_IDLE_TIMEOUT);
+
+  /*---------------------- lock-free lookups -----------------------*/
+  uint16_t upstream(const struct sockaddr_in &client) const; // 0 -> none
+  bool client(uint16_t port, struct sockaddr_in &client) const;
+  State state(uint16_t port) const;
+  // Connecting -> Ready, true only for the caller making the transition
+  bool connected(uint16_t port);
+  // Traffic seen, keeps session from expiring
+  void touch(uint16_t port);
+  bool owns(uint16_t port) const; // port inside the range
+
+  uint16_t first_port() const { return first; }
+  uint16_t last_port() const { return first + count - 1; }
+  size_t size() const { return live.load(std::memory_order_relaxed); }
+
+private:
+  // index slot: client key << 16 | port offset
+  static constexpr uint64_t EMPTY = 0, DELETED = ~0ULL;
+
+  static uint64_t pack(const struct sockaddr_in &client);
+  static size_t hash(uint64_t key);
+  static uint32_t now();
+  // writer side, writeMutex held
+  void insert(uint64_t key, uint16_t offset);
+  void erase(uint64_t key);
+  void rebuild();
+  void release(uint16_t offset);
+
+  uint16_t first, count;
+  // by port offset: packed client (0 -> free), state, last traffic
+  std::unique_ptr<std::atomic<uint64_t>[]> clients;
+  std::unique_ptr<std::atomic<State>[]> states;
+  std::unique_ptr<std::atomic<uint32_t>[]> seen;
+
+  // Two index buffers: readers probe the current one, deleted slots
+  // pile up and the other is rebuilt and swapped in. Memory is never
+  // freed, so a reader still on the old buffer reads stale (not freed)
+  // slots - hits are checked against clients[]
+  std::unique_ptr<std::atomic<uint64_t>[]> buffers[2];
+  std::atomic<std::atomic<uint64_t> *> index;
+  size_t mask;
+  size_t used{0}; // live + deleted slots of current index
+
+  std::deque<uint16_t> free_ports; // offsets, oldest released first
+  std::atomic<size_t> live{0};
+  std::mutex writeMutex;
+};
+}; // namespace Network
@@ -0,0 +1,46 @@
+// syn cookies
+#pragma once
+#include "dispatcher.hpp"
+#include <cstdint>
+
+namespace Network {
+
+#define COOKIE_PERIOD_S 64 // timestamp unit of a cookie
+#define COOKIE_AGE_MAX 2   // periods an ACK may come after its SYN ACK
+
+/**
+ * @brief Stateless handshake: SYN ACK's sequence number carries all that
+ * is needed to accept the final ACK, so a SYN costs no memory.
+ * Cookie = 5 bit timestamp (COOKIE_PERIOD_S units) | 2 bit MSS index |
+ * 25 bit SipHash-2-4 of 4-tuple, client's initial sequence number,
+ * timestamp and MSS index under a key drawn at start. Window scale
+ * rides in the low bits of our TSval, echoed by the ACK (as Linux
+ * does), so it survives only with timestamps.
+ * Never changes after construction, so any number of threads (shards,
+ * accept loop) may share one
+ */
+class SynCookies {
+public:
+  SynCookies();
+
+  // Sequence number of SYN ACK answering client_isn on flow key,
+  // client's MSS rounded down to one the cookie can carry
+  uint32_t make(const flow_key &key, uint32_t client_isn,
+                uint16_t mss = TCP_MSS_DEFAULT) const;
+  // Final ACK: its seq - 1 and ack_seq - 1. True if cookie was made for
+  // this flow and ISN at most COOKIE_AGE_MAX periods ago
+  bool check(const flow_key &key, uint32_t client_isn, uint32_t cookie) const;
+
+  // Options of SYN ACK answering syn: what restore() gets back only
+  static tcp_options answer(const tcp_options &syn);
+  // SYN's options from a checked cookie and the final ACK's options
+  static tcp_options restore(uint32_t cookie, const tcp_options &ack);
+
+private:
+  uint32_t hash(const flow_key &key, uint32_t client_isn, uint32_t period,
+                uint32_t mss_index) const;
+  static uint32_t period_now();
+
+  uint64_t secret[2];
+};
+}; // namespace Network
@@ -1,26 +1,194 @@
 #pragma once
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-class ThreadPool {
+#define TASK_INLINE_SIZE 64     // callable bytes stored without allocation
+#define POOL_TASK_NODES 4096    // preallocated task nodes per pool
+#define POOL_DEQUE_SIZE 1024    // per-worker deque capacity (power of 2)
+#define POOL_INJECT_SIZE 4096   // queue for tasks from non-workers (power of 2)
+#define POOL_SPIN_ROUNDS 64     // empty scans before a worker parks
+
+/**
+ * @brief Move-only type-erased callable. Callables of up to
+ * TASK_INLINE_SIZE bytes (nothrow movable) live inside the task,
+ * bigger ones are boxed on the heap.
+ */
+class Task {
+public:
+  Task() = default;
+  template <typename F, typename = std::enable_if_t<
+                            !std::is_same<std::decay_t<F>, Task>::value>>
+  Task(F &&f) {
+    using Fn = std::decay_t<F>;
+    if constexpr (sizeof(Fn) <= TASK_INLINE_SIZE &&
+                  alignof(Fn) <= alignof(std::max_align_t) &&
+                  std::is_nothrow_move_constructible<Fn>::value) {
+      new (storage) Fn(std::forward<F>(f));
+      ops = &inline_ops<Fn>;
+    } else {
+      *reinterpret_cast<Fn **>(storage) = new Fn(std::forward<F>(f));
+      ops = &boxed_ops<Fn>;
+    }
+  }
+  Task(Task &&other) noexcept { take(other); }
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      reset();
+      take(other);
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() { reset(); }
+
+  explicit operator bool() const { return ops != nullptr; }
+  void operator()() { ops->invoke(storage); }
+  void reset() {
+    if (ops)
+      ops->destroy(storage);
+    ops = nullptr;
+  }
+
+private:
+  struct task_ops {
+    void (*invoke)(void *);
+    void (*move)(void *dst, void *src); // move-construct, destroy source
+    void (*destroy)(void *);
+  };
+
+  template <typename Fn> static const task_ops inline_ops;
+  template <typename Fn> static const task_ops boxed_ops;
+
+  void take(Task &other) {
+    ops = other.ops;
+    if (ops)
+      ops->move(storage, other.storage);
+    other.ops = nullptr;
+  }
+
+  alignas(std::max_align_t) unsigned char storage[TASK_INLINE_SIZE];
+  const task_ops *ops{nullptr};
+};
+
+template <typename Fn>
+const Task::task_ops Task::inline_ops = {
+    [](void *p) { (*static_cast<Fn *>(p))(); },
+    [](void *dst, void *src) {
+      new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+      static_cast<Fn *>(src)->~Fn();
+    },
+    [](void *p) { static_cast<Fn *>(p)->~Fn(); }};
+
+template <typename Fn>
+const Task::task_ops Task::boxed_ops = {
+    [](void *p) { (**static_cast<Fn **>(p))(); },
+    [](void *dst, void *src) {
+      *static_cast<Fn **>(dst) = *static_cast<Fn **>(src);
+    },
+    [](void *p) { delete *static_cast<Fn **>(p); }};
+
+// Task with its queue bookkeeping, recycled through the pool's free list
+struct task_node {
+  Task task;
+  std::atomic<uint32_t> next_free{0}; // free list link (index + 1)
+  uint32_t index{0};                  // 0 -> heap allocated overflow node
+};
+
+/**
+ * @brief Chase-Lev work-stealing deque (bounded, C11 formulation by
+ * Le et al.). Owner pushes/pops at the bottom, thieves steal from the top.
+ */
+class WorkDeque {
+public:
+  WorkDeque();
+  bool push(task_node *node); // owner only, false if full
+  task_node *pop();           // owner only
+  task_node *steal();         // any thread
+  bool empty() const;
+
 private:
-  std::vector<std::thread> threads; // vector of threads
-  std::queue<std::function<void()>>
-      tasks; // queue of void-function objects to assing task to
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  std::unique_ptr<std::atomic<task_node *>[]> buffer;
+};
+
+/**
+ * @brief Bounded MPMC queue (Vyukov), entry point for tasks submitted by
+ * threads outside the pool
+ */
+class InjectQueue {
+public:
+  InjectQueue();
+  bool push(task_node *node);
+  task_node *pop();
+  bool empty() const;
 
-  std::condition_variable cond; // condition variable to tell threads that queue
-                                // is reachable to take task from
-  std::mutex qMutex; // to block acces to the queue for more than one thread
-                     // simultaneously
-  bool stop;
+private:
+  struct cell {
+    std::atomic<size_t> seq;
+    task_node *node;
+  };
+  std::unique_ptr<cell[]> cells;
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
 
+/**
+ * @brief Work-stealing thread pool. Every worker owns a deque: tasks
+ * enqueued by a worker go to its own deque, tasks from other threads go
+ * through the inject queue. Idle workers steal, spin a little (at most
+ * half the CPUs at once), then park; submit wakes a parked worker only
+ * when nobody is searching, and the woken worker searches until it finds
+ * work, so a burst of submits does not wake every worker at once.
+ * Task nodes come from a preallocated lock-free free list, so enqueue
+ * takes no lock and (for small callables) does not allocate.
+ */
+class ThreadPool {
 public:
   explicit ThreadPool(int numThr); // create Thread Pool
   ~ThreadPool();
-  void enqueue(std::function<void()> task);
+
+  template <typename F> void enqueue(F &&task) {
+    submit(Task(std::forward<F>(task)));
+  }
   void stopped();
+
+private:
+  void submit(Task task);
+  void worker(unsigned self);
+  task_node *find_work(unsigned self, uint64_t &seed);
+  bool has_work() const;
+  bool park(); // true if woken by submit
+  void wake();
+
+  task_node *acquire_node();
+  void release_node(task_node *node);
+
+  const unsigned numThreads; // fixed before workers start
+  unsigned maxSearching;     // spinning workers allowed, half the CPUs
+  int spinRounds;            // 0 on a single CPU
+  std::vector<std::thread> threads;
+  std::unique_ptr<WorkDeque[]> deques;
+  InjectQueue injected;
+
+  std::unique_ptr<task_node[]> nodes;
+  alignas(64) std::atomic<uint64_t> free_head{0}; // tag << 32 | index + 1
+
+  std::mutex parkMutex; // guards wakeups, sleeping workers wait on cond
+  std::condition_variable cond;
+  unsigned wakeups{0};                           // notified, not yet awake
+  alignas(64) std::atomic<unsigned> sleepers{0}; // parked, not notified
+  std::atomic<unsigned> searching{0}; // workers spinning for work
+  std::atomic<bool> stop{false};
 };
@@ -0,0 +1,98 @@
+// timer wheel
+#pragma once
+#include "metrics.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace Network {
+
+#define WHEEL_TICK_NS 1000000 // resolution: 1 ms
+#define WHEEL_BITS 8          // 256 slots per level
+#define WHEEL_LEVELS 4        // 2^32 ticks (~49 days) ahead at most
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+#define RTO_INITIAL_MS 1000 // before the first round trip was measured
+#define RTO_MIN_MS 200
+#define RTO_MAX_MS 60000
+#define RETRIES_MAX 5 // retransmissions before giving up
+
+class TimerWheel;
+
+/**
+ * @brief Intrusive timer, embedded in whatever it times (connection,
+ * request). Arming and cancelling only relink it, nothing is allocated.
+ * Destroying an armed timer cancels it
+ */
+struct Timer {
+  std::function<void()> callback;
+
+  Timer() = default;
+  explicit Timer(std::function<void()> callback)
+      : callback(std::move(callback)) {}
+  ~Timer();
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+
+  bool armed() const { return wheel != nullptr; }
+
+private:
+  friend class TimerWheel;
+  TimerWheel *wheel{nullptr};
+  uint64_t expires{0}; // tick
+  Timer *prev{this}, *next{this};
+};
+
+/**
+ * @brief Hierarchical timing wheel (Varghese & Lauck): WHEEL_LEVELS
+ * rings of WHEEL_SLOTS lists, level n slots span 256^n ticks. Arm and
+ * cancel are O(1) however many timers there are; a timer far ahead
+ * moves down a level each time its slot comes around. Single threaded:
+ * owned by one event loop (other threads post() to it)
+ */
+class TimerWheel {
+public:
+  explicit TimerWheel(uint64_t now_ns = Metrics::now());
+  ~TimerWheel();
+  TimerWheel(const TimerWheel &) = delete;
+  TimerWheel &operator=(const TimerWheel &) = delete;
+
+  // (Re)arm timer to fire delay_ns from now, at least one tick ahead
+  void arm(Timer &timer, uint64_t delay_ns);
+  void cancel(Timer &timer);
+
+  /**
+   * @brief Fire timers due by now_ns (steady clock, Metrics::now()).
+   * Callback is copied before it runs, so it may re-arm, cancel or
+   * destroy its own timer; returns timers fired
+   */
+  size_t advance(uint64_t now_ns);
+  // ms until the next timer may fire (epoll timeout), -1 if none armed
+  int timeout_ms() const;
+  size_t size() const { return count; }
+
+private:
+  void place(Timer &timer);
+  void unlink(Timer &timer);
+  void cascade(unsigned level, unsigned slot);
+
+  Timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; // list heads
+  uint64_t start_ns;
+  uint64_t current{0}; // ticks since start
+  size_t count{0};
+};
+
+/**
+ * @brief Retransmission timeout from round trip samples (RFC 6298):
+ * smoothed rtt + 4 * variance, doubled on every timeout (backoff).
+ * Karn: samples of retransmitted segments must not be fed in
+ */
+struct RttEstimator {
+  uint64_t srtt{0}, rttvar{0}; // ns, srtt 0 -> no sample yet
+  uint64_t rto{RTO_INITIAL_MS * 1000000ULL};
+
+  void sample(uint64_t rtt_ns);
+  void backoff();
+  int rto_ms() const { return static_cast<int>(rto / 1000000); }
+};
+}; // namespace Network
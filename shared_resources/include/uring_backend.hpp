@@ -0,0 +1,82 @@
+// io_uring backend
+#pragma once
+#include "io_backend.hpp"
+#include <linux/io_uring.h>
+#include <sys/uio.h> // for iovec
+
+namespace Network {
+
+#define URING_ENTRIES 256    // submission queue entries
+#define URING_BUFFERS 256    // provided receive buffers (power of 2)
+#define URING_SEND_SLOTS 128 // sends in flight at once
+#define URING_BUFFER_GROUP 0
+
+/**
+ * @brief Raw socket driven through io_uring (raw syscalls, no liburing).
+ * One multishot recv stays posted, the kernel picks receive buffers out
+ * of a registered ring of pool buffers; every completed buffer is handed
+ * out as pool packet_ptr and its ring slot refilled from the pool.
+ * Sends are copied into slot buffers and queued as SENDMSG entries,
+ * flush() submits all of them with one io_uring_enter.
+ * fd() is the ring itself - readable while completions are waiting.
+ * Single-threaded: receive, send and flush must be called from one thread.
+ */
+class UringBackend : public IoBackend {
+public:
+  UringBackend() = default;
+  ~UringBackend();
+  UringBackend(const UringBackend &) = delete;
+  UringBackend &operator=(const UringBackend &) = delete;
+
+  // Set up ring over sockfd (stays owned by caller), false if the kernel
+  // lacks io_uring or multishot receive
+  bool open(int sockfd);
+
+  int fd() const override;
+  int filter_fd() const override;
+  int receive(Packet *out, int max, int timeout_ms) override;
+  int send(unsigned char **packets, size_t *lengths,
+           struct sockaddr_in *dests, unsigned count) override;
+  void flush() override;
+
+private:
+  struct send_slot {
+    packet_ptr buffer;
+    struct iovec iov;
+    struct msghdr msg;
+    struct sockaddr_in dest;
+  };
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+  struct io_uring_sqe *next_sqe(); // zeroed, queue() publishes it
+  void queue();
+  void arm_receive();
+  void provide(unsigned short bid);
+  // Handle one completion, received packet goes to out (nullptr - drop)
+  bool complete(const struct io_uring_cqe *cqe, Packet *out);
+  void teardown();
+
+  int sockfd{-1};
+  int ringfd{-1};
+
+  void *sq_map{nullptr}, *cq_map{nullptr};
+  size_t sq_map_size{0}, cq_map_size{0};
+  unsigned *sq_head{nullptr}, *sq_tail{nullptr}, *sq_array{nullptr};
+  unsigned sq_mask{0}, sq_entries{0};
+  struct io_uring_sqe *sqes{nullptr};
+  size_t sqes_size{0};
+  unsigned *cq_head{nullptr}, *cq_tail{nullptr};
+  unsigned cq_mask{0};
+  struct io_uring_cqe *cqes{nullptr};
+  unsigned pending{0}; // queued, not yet submitted
+
+  struct io_uring_buf_ring *buf_ring{nullptr};
+  size_t buf_ring_size{0};
+  unsigned short buf_tail{0};
+  unsigned char *buffers[URING_BUFFERS]{}; // by buffer id
+  bool receiving{false};                    // multishot recv posted
+
+  std::unique_ptr<send_slot[]> slots;
+  std::vector<unsigned> free_slots;
+};
+}; // namespace Network
@@ -0,0 +1,187 @@
+#include "../include/buffer_pool.hpp"
+#include "../include/metrics.hpp"
+#include <sys/mman.h>
+
+// Owned by its thread; counters are written by the owner only and read
+// by stats(), so they never bounce between cores
+struct Network::BufferPool::thread_cache {
+  BufferPool *pool{nullptr};
+  unsigned char *buffers[POOL_CACHE_SIZE];
+  unsigned count{0};
+  std::atomic<uint64_t> acquired{0};
+  std::atomic<uint64_t> released{0};
+
+  ~thread_cache() {
+    if (pool)
+      pool->retire(*this);
+  }
+};
+
+Network::BufferPool &Network::BufferPool::instance() {
+  // never destroyed: buffers may be released by threads outliving main
+  static BufferPool *pool = [] {
+    BufferPool *created = new BufferPool();
+    created->export_stats();
+    return created;
+  }();
+  return *pool;
+}
+
+// Occupancy as gauges, sampled whenever metrics are rendered
+void Network::BufferPool::export_stats() {
+  Metrics &metrics = Metrics::instance();
+  auto gauge = [this, &metrics](const char *name, const char *help,
+                                size_t pool_stats::*field) {
+    metrics.gauge(name, help, [this, field] {
+      return static_cast<double>(stats().*field);
+    });
+  };
+  gauge("pool_buffers_in_use", "Pool buffers handed out, not released",
+        &pool_stats::in_use);
+  gauge("pool_buffers_peak", "High-water mark of pool_buffers_in_use",
+        &pool_stats::peak_in_use);
+  gauge("pool_buffers", "Pool buffers carved out of slabs",
+        &pool_stats::capacity);
+  gauge("pool_slabs", "Slabs mapped by the buffer pool", &pool_stats::slabs);
+  gauge("pool_huge_slabs", "Pool slabs backed by explicit hugepages",
+        &pool_stats::huge_slabs);
+}
+
+Network::BufferPool::~BufferPool() {
+  for (auto &slab : slabs)
+    munmap(slab.first, slab.second);
+}
+
+void Network::BufferPool::use_hugepages(bool enable) {
+  std::unique_lock<std::mutex> lock(poolMutex);
+  hugepages = enable;
+}
+
+Network::BufferPool::thread_cache &Network::BufferPool::local() {
+  thread_local thread_cache cache;
+  if (!cache.pool) {
+    cache.pool = this;
+    std::unique_lock<std::mutex> lock(poolMutex);
+    caches.push_back(&cache);
+  }
+  return cache;
+}
+
+/**
+ * @brief Pop from own free list, refill it with half a cache worth of
+ * buffers from the shared list when empty
+ */
+Network::packet_ptr Network::BufferPool::acquire() {
+  thread_cache &cache = local();
+  if (cache.count == 0)
+    refill(cache);
+  unsigned char *buffer = cache.buffers[--cache.count];
+  uint64_t acquired = cache.acquired.load(std::memory_order_relaxed) + 1;
+  cache.acquired.store(acquired, std::memory_order_relaxed);
+  return packet_ptr(buffer, packet_release(this));
+}
+
+/**
+ * @brief Push to own free list (whichever thread releases),
+ * spill half of it to the shared list when full
+ */
+void Network::BufferPool::release(unsigned char *buffer) {
+  thread_cache &cache = local();
+  if (cache.count == POOL_CACHE_SIZE)
+    spill(cache);
+  cache.buffers[cache.count++] = buffer;
+  uint64_t released = cache.released.load(std::memory_order_relaxed) + 1;
+  cache.released.store(released, std::memory_order_relaxed);
+}
+
+void Network::BufferPool::refill(thread_cache &cache) {
+  std::unique_lock<std::mutex> lock(poolMutex);
+  if (free_list.size() < POOL_CACHE_SIZE / 2)
+    grow();
+  while (cache.count < POOL_CACHE_SIZE / 2 && !free_list.empty()) {
+    cache.buffers[cache.count++] = free_list.back();
+    free_list.pop_back();
+  }
+  // refills are rare enough to track the high-water mark here
+  size_t in_use = used();
+  if (in_use > peak.load(std::memory_order_relaxed))
+    peak.store(in_use, std::memory_order_relaxed);
+}
+
+// Sum of per-thread counters, call with poolMutex held
+size_t Network::BufferPool::used() const {
+  uint64_t acquired = retired_acquired, released = retired_released;
+  for (const thread_cache *cache : caches) {
+    acquired += cache->acquired.load(std::memory_order_relaxed);
+    released += cache->released.load(std::memory_order_relaxed);
+  }
+  return static_cast<size_t>(acquired - released);
+}
+
+void Network::BufferPool::spill(thread_cache &cache) {
+  std::unique_lock<std::mutex> lock(poolMutex);
+  while (cache.count > POOL_CACHE_SIZE / 2)
+    free_list.push_back(cache.buffers[--cache.count]);
+}
+
+/**
+ * @brief mmap one more slab: explicit hugepages if asked for and
+ * reserved, otherwise regular pages with transparent hugepage advice.
+ * Buffer size is a multiple of cache line, so every buffer is aligned
+ */
+void Network::BufferPool::grow() {
+  void *slab = MAP_FAILED;
+  bool huge = false;
+  if (hugepages) {
+    slab = mmap(nullptr, POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    huge = slab != MAP_FAILED;
+  }
+  if (slab == MAP_FAILED) {
+    slab = mmap(nullptr, POOL_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (slab == MAP_FAILED)
+      throw std::bad_alloc();
+    if (hugepages)
+      madvise(slab, POOL_SLAB_SIZE, MADV_HUGEPAGE);
+  }
+  slabs.emplace_back(slab, POOL_SLAB_SIZE);
+  huge_slabs += huge;
+
+  unsigned char *base = static_cast<unsigned char *>(slab);
+  size_t count = POOL_SLAB_SIZE / POOL_BUFFER_SIZE;
+  for (size_t i = count; i > 0; --i)
+    free_list.push_back(base + (i - 1) * POOL_BUFFER_SIZE);
+  capacity += count;
+}
+
+// Thread exits: hand its buffers back, keep its counters
+void Network::BufferPool::retire(thread_cache &cache) {
+  std::unique_lock<std::mutex> lock(poolMutex);
+  while (cache.count > 0)
+    free_list.push_back(cache.buffers[--cache.count]);
+  retired_acquired += cache.acquired.load(std::memory_order_relaxed);
+  retired_released += cache.released.load(std::memory_order_relaxed);
+  for (auto it = caches.begin(); it != caches.end(); ++it) {
+    if (*it == &cache) {
+      caches.erase(it);
+      break;
+    }
+  }
+  cache.pool = nullptr;
+}
+
+Network::pool_stats Network::BufferPool::stats() {
+  std::unique_lock<std::mutex> lock(poolMutex);
+  pool_stats stats{};
+  stats.capacity = capacity;
+  stats.in_use = used();
+  stats.peak_in_use =
+      std::max(peak.load(std::memory_order_relaxed), stats.in_use);
+  stats.free_central = free_list.size();
+  // whatever is neither handed out nor shared sits in thread caches
+  stats.free_cached = capacity - stats.in_use - stats.free_central;
+  stats.slabs = slabs.size();
+  stats.huge_slabs = huge_slabs;
+  return stats;
+}
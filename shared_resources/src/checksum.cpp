@@ -0,0 +1,248 @@
+#include "../include/network.hpp"
+#include <random>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+// helpers stay inline even in unoptimized builds, short buffers are
+// otherwise dominated by the calls
+#define CHECKSUM_INLINE inline __attribute__((always_inline))
+
+/**
+ * @brief Internet checksum is a ones-complement sum of 16-bit words, and
+ * 2^16 == 1 (mod 0xffff), so 32 or 64-bit words can be summed instead
+ * and folded down at the end. Words are summed as laid out in memory,
+ * loads are unaligned-safe, so neither alignment nor host byte order
+ * matter. Every kernel returns a 64-bit partial sum.
+ */
+namespace {
+
+using checksum_kernel = uint64_t (*)(const unsigned char *, size_t);
+
+// add with end-around carry
+CHECKSUM_INLINE uint64_t add_carry(uint64_t sum, uint64_t word) {
+  sum += word;
+  return sum + (sum < word);
+}
+
+CHECKSUM_INLINE uint16_t fold(uint64_t sum) {
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(sum);
+}
+
+// last < 8 bytes, odd byte padded with zero like a 16-bit word in memory
+CHECKSUM_INLINE uint64_t sum_tail(uint64_t sum, const unsigned char *buf,
+                                  size_t len) {
+  if (len >= 4) {
+    uint32_t word;
+    memcpy(&word, buf, 4);
+    sum = add_carry(sum, word);
+    buf += 4;
+    len -= 4;
+  }
+  if (len >= 2) {
+    uint16_t word;
+    memcpy(&word, buf, 2);
+    sum = add_carry(sum, word);
+    buf += 2;
+    len -= 2;
+  }
+  if (len == 1) {
+    unsigned char last[2] = {buf[0], 0};
+    uint16_t word;
+    memcpy(&word, last, 2);
+    sum = add_carry(sum, word);
+  }
+  return sum;
+}
+
+uint64_t sum_scalar64(const unsigned char *buf, size_t len) {
+  uint64_t sum = 0;
+  for (; len >= 32; buf += 32, len -= 32) {
+    uint64_t words[4];
+    memcpy(words, buf, 32);
+    sum = add_carry(sum, words[0]);
+    sum = add_carry(sum, words[1]);
+    sum = add_carry(sum, words[2]);
+    sum = add_carry(sum, words[3]);
+  }
+  for (; len >= 8; buf += 8, len -= 8) {
+    uint64_t word;
+    memcpy(&word, buf, 8);
+    sum = add_carry(sum, word);
+  }
+  return sum_tail(sum, buf, len);
+}
+
+// 32-bit words straight into the 64-bit sum, no carries to take care of
+// below 2^32 words: fewest instructions for short buffers
+CHECKSUM_INLINE uint64_t sum_short(const unsigned char *buf, size_t len) {
+  uint64_t sum = 0;
+  for (; len >= 4; buf += 4, len -= 4) {
+    uint32_t word;
+    memcpy(&word, buf, 4);
+    sum += word;
+  }
+  return sum_tail(sum, buf, len);
+}
+
+#ifdef CHECKSUM_X86
+// 32-bit words zero-extended into 64-bit lanes can't overflow any lane
+// for buffers below 2^32 vectors
+__attribute__((target("sse2"))) uint64_t sum_sse2(const unsigned char *buf,
+                                                  size_t len) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc0 = _mm_setzero_si128(), acc1 = _mm_setzero_si128();
+  for (; len >= 32; buf += 32, len -= 32) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 16));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+    acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+    acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+  }
+  uint64_t lanes[4];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), acc0);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 2), acc1);
+  uint64_t sum = 0;
+  for (uint64_t lane : lanes)
+    sum = add_carry(sum, lane);
+  return add_carry(sum, sum_scalar64(buf, len));
+}
+
+__attribute__((target("avx2"))) uint64_t sum_avx2(const unsigned char *buf,
+                                                  size_t len) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+  for (; len >= 64; buf += 64, len -= 64) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf));
+    __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + 32));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+    acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+    acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+  }
+  uint64_t lanes[8];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc0);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 4), acc1);
+  // leave clean upper state before the legacy-encoded sse2 tail
+  _mm256_zeroupper();
+  uint64_t sum = 0;
+  for (uint64_t lane : lanes)
+    sum = add_carry(sum, lane);
+  return add_carry(sum, sum_sse2(buf, len));
+}
+#endif
+
+struct kernel_choice {
+  checksum_kernel kernel;
+  const char *name;
+};
+
+// pick once, at first use, by what cpuid reports
+const kernel_choice &selected() {
+  static const kernel_choice choice = []() -> kernel_choice {
+#ifdef CHECKSUM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return {sum_avx2, "avx2"};
+    if (__builtin_cpu_supports("sse2"))
+      return {sum_sse2, "sse2"};
+#endif
+    return {sum_scalar64, "scalar64"};
+  }();
+  return choice;
+}
+
+// every kernel the cpu can run, widest last
+std::vector<kernel_choice> supported() {
+  std::vector<kernel_choice> kernels{{sum_short, "short"},
+                                     {sum_scalar64, "scalar64"}};
+#ifdef CHECKSUM_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    kernels.push_back({sum_sse2, "sse2"});
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back({sum_avx2, "avx2"});
+#endif
+  return kernels;
+}
+
+// vector kernels only pay off past their setup, short buffers summed inline
+CHECKSUM_INLINE uint64_t sum_any(const unsigned char *buf, size_t len) {
+  if (len < CHECKSUM_SHORT_LEN)
+    return sum_short(buf, len);
+  return selected().kernel(buf, len);
+}
+} // namespace
+
+// calculate checksum
+unsigned short Network::checksum(void *buffer, unsigned len) {
+  uint64_t sum = sum_any(reinterpret_cast<const unsigned char *>(buffer), len);
+  return static_cast<unsigned short>(~fold(sum));
+}
+
+/**
+ * @brief Pseudo header words (addresses, zero + protocol, tcp length)
+ * are added to the segment's sum instead of being copied in front of it
+ */
+uint16_t Network::tcp_checksum(const struct iphdr *iph,
+                               const struct tcphdr *tcph, size_t tcp_len) {
+  uint64_t sum =
+      sum_any(reinterpret_cast<const unsigned char *>(tcph), tcp_len);
+  sum = add_carry(sum, iph->saddr);
+  sum = add_carry(sum, iph->daddr);
+  sum = add_carry(sum, htons(IPPROTO_TCP));
+  sum = add_carry(sum, htons(static_cast<uint16_t>(tcp_len)));
+  return static_cast<uint16_t>(~fold(sum));
+}
+
+const char *Network::checksum_kernel_name() { return selected().name; }
+
+/**
+ * @brief Random lengths (0..CHECKSUM_CHECK_LEN) at random start offsets
+ * (0..63, so every alignment of every vector width is hit), each kernel's
+ * folded sum against the 16-bit reference
+ */
+const char *Network::checksum_check(unsigned rounds, unsigned seed) {
+  std::mt19937 random(seed);
+  std::vector<unsigned char> data(CHECKSUM_CHECK_LEN + 64);
+  for (auto &byte : data)
+    byte = static_cast<unsigned char>(random());
+  std::uniform_int_distribution<unsigned> length(0, CHECKSUM_CHECK_LEN);
+  std::uniform_int_distribution<unsigned> offset(0, 63);
+  std::vector<kernel_choice> kernels = supported();
+  for (unsigned i = 0; i < rounds; ++i) {
+    unsigned char *buf = data.data() + offset(random);
+    unsigned len = length(random);
+    unsigned short expected = checksum_reference(buf, len);
+    for (const kernel_choice &choice : kernels)
+      if (static_cast<unsigned short>(~fold(choice.kernel(buf, len))) !=
+          expected)
+        return choice.name;
+  }
+  return nullptr;
+}
+
+// calculate checksum
+unsigned short Network::checksum_reference(void *buffer, unsigned len) {
+  // credits: Addison Wesley: UNIX Network Programming
+  unsigned short *buf = (unsigned short *)buffer;
+  unsigned int sum = 0;
+
+  for (sum = 0; len > 1; len -= 2)
+    sum += *buf++;
+
+  if (len == 1)
+    sum += ((*buf) & htons(0xFF00));
+
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  sum = ~sum;
+  return ((unsigned short)sum);
+}
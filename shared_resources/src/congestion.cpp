@@ -0,0 +1,116 @@
+#include "../include/congestion.hpp"
+#include <algorithm>
+#include <cmath>
+
+using Phase = Network::congestion_state::Phase;
+
+/**
+ * @brief Slow start counts acknowledged bytes, at most a segment per
+ * ACK (RFC 3465, L = 1), so small requests don't inflate the window
+ */
+void Network::CongestionControl::on_ack(congestion_state &state, uint32_t ack,
+                                        uint32_t acked, uint64_t srtt_ns,
+                                        uint64_t now_ns) const {
+  if (state.phase == Phase::Recovery) {
+    // partial ACK: more of the window was lost, cut stays
+    if (static_cast<int32_t>(ack - state.recover) < 0)
+      return;
+    state.phase = Phase::Avoidance;
+    state.cwnd = state.ssthresh;
+    return;
+  }
+  if (state.cwnd < state.ssthresh) {
+    state.phase = Phase::SlowStart;
+    state.cwnd += std::min(acked, state.mss);
+    return;
+  }
+  state.phase = Phase::Avoidance;
+  grow(state, acked, srtt_ns, now_ns);
+}
+
+void Network::CongestionControl::on_loss(congestion_state &state,
+                                         uint32_t snd_nxt,
+                                         uint64_t now_ns) const {
+  if (state.phase == Phase::Recovery)
+    return;
+  state.ssthresh = cut(state, now_ns);
+  state.cwnd = state.ssthresh;
+  state.recover = snd_nxt;
+  state.growth = 0;
+  state.phase = Phase::Recovery;
+}
+
+// Backed off timeouts of the same loss don't cut again
+void Network::CongestionControl::on_timeout(congestion_state &state,
+                                            uint64_t now_ns) const {
+  if (state.cwnd > state.mss)
+    state.ssthresh = cut(state, now_ns);
+  state.cwnd = state.mss;
+  state.growth = 0;
+  state.phase = Phase::SlowStart;
+}
+
+/*------------------------------ NEWRENO ------------------------------*/
+
+void Network::NewReno::grow(congestion_state &state, uint32_t acked,
+                            uint64_t, uint64_t) const {
+  state.growth += acked;
+  if (state.growth >= state.cwnd) {
+    state.growth -= state.cwnd;
+    state.cwnd += state.mss;
+  }
+}
+
+uint32_t Network::NewReno::cut(congestion_state &state, uint64_t) const {
+  return std::max(state.cwnd / 2, 2 * state.mss);
+}
+
+/*------------------------------- CUBIC -------------------------------*/
+
+/**
+ * @brief Target is the cubic one RTT ahead, W(t) = C (t - K)^3 + W_max,
+ * at most 1.5 times the window; Reno's estimate where that is larger.
+ * Window moves (target - cwnd) / cwnd per segment acknowledged
+ */
+void Network::Cubic::grow(congestion_state &state, uint32_t acked,
+                          uint64_t srtt_ns, uint64_t now_ns) const {
+  double cwnd = static_cast<double>(state.cwnd) / state.mss;
+  if (state.epoch_start == 0) {
+    state.epoch_start = now_ns;
+    state.k = state.w_max > cwnd ? std::cbrt((state.w_max - cwnd) / CUBIC_C)
+                                 : 0;
+    state.w_max = std::max(state.w_max, cwnd);
+    state.w_est = cwnd;
+  }
+  double t = (now_ns - state.epoch_start + srtt_ns) / 1e9;
+  double target =
+      std::clamp(CUBIC_C * std::pow(t - state.k, 3) + state.w_max, cwnd,
+                 1.5 * cwnd);
+  // Reno grows 3 (1 - beta) / (1 + beta) segments per RTT after this cut
+  state.w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked /
+                 state.cwnd;
+  target = std::max(target, state.w_est);
+  state.growth += (target - cwnd) / cwnd * acked;
+  uint32_t whole = static_cast<uint32_t>(state.growth);
+  state.cwnd += whole;
+  state.growth -= whole;
+}
+
+// Lost before W_max was regained: give way to newer flows (fast
+// convergence), remember less than the window was
+uint32_t Network::Cubic::cut(congestion_state &state, uint64_t) const {
+  double cwnd = static_cast<double>(state.cwnd) / state.mss;
+  state.w_max = cwnd < state.w_max ? cwnd * (1 + CUBIC_BETA) / 2 : cwnd;
+  state.epoch_start = 0;
+  return std::max(static_cast<uint32_t>(state.cwnd * CUBIC_BETA),
+                  2 * state.mss);
+}
+
+std::shared_ptr<Network::CongestionControl>
+Network::make_congestion_control(const std::string &name) {
+  if (name == "newreno")
+    return std::make_shared<NewReno>();
+  if (name == "cubic")
+    return std::make_shared<Cubic>();
+  return nullptr;
+}
@@ -0,0 +1,202 @@
+#include "../include/dispatcher.hpp"
+#include "../include/metrics.hpp"
+
+size_t Network::flow_key_hash::operator()(const flow_key &key) const {
+  // murmur3 finalizer over the packed 4-tuple
+  uint64_t h = (static_cast<uint64_t>(key.saddr) << 32) | key.daddr;
+  h ^= ((static_cast<uint64_t>(key.sport) << 16) | key.dport) *
+       0x9e3779b97f4a7c15ULL;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return static_cast<size_t>(h);
+}
+
+Network::flow_key Network::make_flow_key(const struct sockaddr_in &src,
+                                         const struct sockaddr_in &dst) {
+  return flow_key{src.sin_addr.s_addr, dst.sin_addr.s_addr, src.sin_port,
+                  dst.sin_port};
+}
+
+Network::flow_key Network::packet_flow_key(const unsigned char *packet) {
+  const struct iphdr *iph = reinterpret_cast<const struct iphdr *>(packet);
+  const struct tcphdr *tcph =
+      reinterpret_cast<const struct tcphdr *>(packet + iph->ihl * 4);
+  return flow_key{iph->saddr, iph->daddr, tcph->source, tcph->dest};
+}
+
+void Network::PacketQueue::push(Packet packet) {
+  {
+    std::unique_lock<std::mutex> lock(qMutex);
+    packets.push_back(std::move(packet));
+  }
+  cond.notify_one();
+}
+
+Network::Packet Network::PacketQueue::pop() {
+  std::unique_lock<std::mutex> lock(qMutex);
+  cond.wait(lock, [this] { return !packets.empty(); });
+  Packet packet = std::move(packets.front());
+  packets.pop_front();
+  return packet;
+}
+
+bool Network::PacketQueue::try_pop(Packet &packet) {
+  std::unique_lock<std::mutex> lock(qMutex);
+  if (packets.empty())
+    return false;
+  packet = std::move(packets.front());
+  packets.pop_front();
+  return true;
+}
+
+bool Network::PacketQueue::pop_for(Packet &packet, int timeout_ms) {
+  std::unique_lock<std::mutex> lock(qMutex);
+  if (!cond.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                     [this] { return !packets.empty(); }))
+    return false;
+  packet = std::move(packets.front());
+  packets.pop_front();
+  return true;
+}
+
+size_t Network::PacketQueue::size() {
+  std::unique_lock<std::mutex> lock(qMutex);
+  return packets.size();
+}
+
+Network::Dispatcher::Dispatcher(std::unique_ptr<IoBackend> backend,
+                                const struct sockaddr_in &local_addr)
+    : backend(std::move(backend)), local_addr(local_addr) {
+  Metrics &metrics = Metrics::instance();
+  depth_gauges[0] = metrics.gauge(
+      "dispatcher_backlog_depth", "Packets of unknown flows waiting",
+      [this] { return static_cast<double>(unmatched.size()); });
+  depth_gauges[1] = metrics.gauge(
+      "dispatcher_flow_queue_depth", "Packets waiting in connection queues",
+      [this] {
+        std::shared_lock<std::shared_mutex> lock(flowsMutex);
+        size_t queued = 0;
+        for (const auto &flow : flows)
+          queued += flow.second->size();
+        return static_cast<double>(queued);
+      });
+  depth_gauges[2] = metrics.gauge(
+      "dispatcher_flows", "Connections with a queue of their own", [this] {
+        std::shared_lock<std::shared_mutex> lock(flowsMutex);
+        return static_cast<double>(flows.size());
+      });
+}
+
+Network::Dispatcher::~Dispatcher() {
+  for (unsigned id : depth_gauges)
+    Metrics::instance().remove_gauge(id);
+  stop();
+}
+
+void Network::Dispatcher::start() {
+  if (running.exchange(true))
+    return;
+  reader = std::thread([this]() { run(); });
+}
+
+void Network::Dispatcher::stop() {
+  running = false;
+  if (reader.joinable())
+    reader.join();
+}
+
+std::shared_ptr<Network::PacketQueue>
+Network::Dispatcher::subscribe(const flow_key &key, bool *created) {
+  std::unique_lock<std::shared_mutex> lock(flowsMutex);
+  auto &queue = flows[key];
+  if (created)
+    *created = !queue;
+  if (!queue) {
+    queue = std::make_shared<PacketQueue>();
+    refresh_filter();
+  }
+  return queue;
+}
+
+void Network::Dispatcher::unsubscribe(const flow_key &key) {
+  std::unique_lock<std::shared_mutex> lock(flowsMutex);
+  if (flows.erase(key))
+    refresh_filter();
+}
+
+/**
+ * @brief Rebuild kernel filter so it passes SYNs and segments of
+ * subscribed peers only
+ */
+void Network::Dispatcher::refresh_filter() {
+  // beyond FILTER_MAX_PEERS filter passes everything anyway: don't
+  // rebuild it for every accept or close
+  bool open = flows.size() > FILTER_MAX_PEERS;
+  if (open && filter_open)
+    return;
+  filter_open = open;
+  std::vector<struct sockaddr_in> peers; // none -> pass all
+  if (!open) {
+    peers.reserve(flows.size());
+    for (const auto &flow : flows) {
+      struct sockaddr_in peer;
+      memset(&peer, 0, sizeof(peer));
+      peer.sin_family = AF_INET;
+      peer.sin_addr.s_addr = flow.first.saddr;
+      peer.sin_port = flow.first.sport;
+      peers.push_back(peer);
+    }
+  }
+  Network::attach_port_filter(backend->filter_fd(), ntohs(local_addr.sin_port),
+                              peers);
+}
+
+Network::PacketQueue &Network::Dispatcher::backlog() { return unmatched; }
+
+/**
+ * @brief Wait for backend to deliver a burst (with timeout to notice stop)
+ * and hand each packet to dispatch()
+ */
+void Network::Dispatcher::run() {
+  Packet burst[BATCH_SIZE];
+  while (running) {
+    int received = backend->receive(burst, BATCH_SIZE, 100);
+    for (int i = 0; i < received; ++i)
+      dispatch(burst[i]);
+  }
+}
+
+/**
+ * @brief Drop packets not designated to local port (buffer stays with
+ * the caller for reuse), route the rest by 4-tuple:
+ * known flow -> its queue, otherwise -> backlog (dropped once it holds
+ * BACKLOG_MAX, so a SYN flood can't grow the buffer pool without bound)
+ */
+void Network::Dispatcher::dispatch(Packet &packet) {
+  if (packet.size < sizeof(struct iphdr) + sizeof(struct tcphdr))
+    return;
+  const struct iphdr *iph =
+      reinterpret_cast<const struct iphdr *>(packet.data.get());
+  if (iph->ihl < 5 || packet.size < iph->ihl * 4u + sizeof(struct tcphdr))
+    return;
+  flow_key key = Network::packet_flow_key(packet.data.get());
+  if (key.dport != local_addr.sin_port)
+    return;
+
+  std::shared_ptr<PacketQueue> queue;
+  {
+    std::shared_lock<std::shared_mutex> lock(flowsMutex);
+    auto flow = flows.find(key);
+    if (flow != flows.end())
+      queue = flow->second;
+  }
+  if (queue)
+    queue->push(std::move(packet));
+  else if (unmatched.size() >= BACKLOG_MAX)
+    metric::backlog_dropped.add();
+  else
+    unmatched.push(std::move(packet));
+}
@@ -0,0 +1,112 @@
+#include "../include/event_loop.hpp"
+#include <iostream>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+Network::EventLoop::EventLoop() {
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+    std::cerr << "epoll_create1 failed " << strerror(errno) << std::endl;
+  wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakefd < 0)
+    std::cerr << "eventfd failed " << strerror(errno) << std::endl;
+  add(wakefd, EPOLLIN, [this](uint32_t) {
+    uint64_t count;
+    while (read(wakefd, &count, sizeof(count)) > 0)
+      ;
+    drain_posted();
+  });
+}
+
+Network::EventLoop::~EventLoop() {
+  if (wakefd >= 0)
+    close(wakefd);
+  if (epfd >= 0)
+    close(epfd);
+}
+
+bool Network::EventLoop::add(int fd, uint32_t events, Handler handler) {
+  struct epoll_event ev {};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    std::cerr << "epoll_ctl(ADD) failed for fd " << fd << " "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  handlers[fd] = std::make_shared<Handler>(std::move(handler));
+  return true;
+}
+
+bool Network::EventLoop::modify(int fd, uint32_t events) {
+  struct epoll_event ev {};
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void Network::EventLoop::remove(int fd) {
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+  handlers.erase(fd);
+}
+
+void Network::EventLoop::post(std::function<void()> task) {
+  {
+    std::unique_lock<std::mutex> lock(postMutex);
+    posted.push_back(std::move(task));
+  }
+  wake();
+}
+
+void Network::EventLoop::wake() {
+  uint64_t one = 1;
+  if (write(wakefd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    std::cerr << "eventfd write failed " << strerror(errno) << std::endl;
+}
+
+void Network::EventLoop::drain_posted() {
+  std::vector<std::function<void()>> tasks;
+  {
+    std::unique_lock<std::mutex> lock(postMutex);
+    tasks.swap(posted);
+  }
+  for (auto &task : tasks)
+    task();
+}
+
+/**
+ * @brief Wait for ready descriptors and call their handlers. A handler
+ * may remove descriptors (even its own), so each one is looked up again
+ * right before its call. Wait ends no later than the next timer is due,
+ * timers run after the handlers. A stop() that came first ends it at once
+ */
+void Network::EventLoop::run(int timeout_ms) {
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  while (!stopping) {
+    int wait = timeout_ms;
+    int due = wheel.timeout_ms();
+    if (due >= 0 && (wait < 0 || due < wait))
+      wait = due;
+    int ready = epoll_wait(epfd, events, LOOP_MAX_EVENTS, wait);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      std::cerr << "epoll_wait failed " << strerror(errno) << std::endl;
+      break;
+    }
+    for (int i = 0; i < ready && !stopping; ++i) {
+      auto found = handlers.find(events[i].data.fd);
+      if (found == handlers.end())
+        continue;
+      std::shared_ptr<Handler> handler = found->second;
+      (*handler)(events[i].events);
+    }
+    wheel.advance(Metrics::now());
+  }
+}
+
+void Network::EventLoop::stop() {
+  stopping = true;
+  wake();
+}
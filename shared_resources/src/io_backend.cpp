@@ -0,0 +1,40 @@
+#include "../include/io_backend.hpp"
+#include "../include/buffer_pool.hpp"
+#include <poll.h>
+
+// Plain sendmmsg on the filtered socket
+int Network::IoBackend::send(unsigned char **packets, size_t *lengths,
+                             struct sockaddr_in *dests, unsigned count) {
+  return Network::send_batch(filter_fd(), packets, lengths, dests, count);
+}
+
+Network::SocketBackend::SocketBackend(int sockfd) : sockfd(sockfd) {}
+
+int Network::SocketBackend::fd() const { return sockfd; }
+
+/**
+ * @brief Reuse pool buffers left in out[] by the caller (dropped packets),
+ * take the missing ones from the pool, drain socket with one recvmmsg
+ */
+int Network::SocketBackend::receive(Packet *out, int max, int timeout_ms) {
+  struct pollfd pfd {};
+  pfd.fd = sockfd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeout_ms) <= 0)
+    return 0;
+
+  unsigned char *buffers[BATCH_SIZE];
+  size_t lengths[BATCH_SIZE];
+  if (max > BATCH_SIZE)
+    max = BATCH_SIZE;
+  for (int i = 0; i < max; ++i) {
+    if (!out[i].data || !out[i].data.get_deleter().pool)
+      out[i].data = BufferPool::instance().acquire();
+    buffers[i] = out[i].data.get();
+  }
+  int received = Network::receive_batch(sockfd, buffers, POOL_BUFFER_SIZE,
+                                        lengths, nullptr, max, MSG_DONTWAIT);
+  for (int i = 0; i < received; ++i)
+    out[i].size = lengths[i];
+  return received < 0 ? 0 : received;
+}
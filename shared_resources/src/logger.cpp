@@ -0,0 +1,225 @@
+#include "../include/logger.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <errno.h>
+#include <unistd.h>
+
+// Owned by its thread; the ring itself outlives it until drained
+struct Network::Logger::ring_owner {
+  LogRing *ring{nullptr};
+
+  ~ring_owner() {
+    if (ring)
+      ring->closed.store(true, std::memory_order_release);
+  }
+};
+
+void Network::log_record::put_text(std::string_view value) {
+  size_t room = sizeof(text) - text_len;
+  size_t length = std::min(value.size(), room);
+  memcpy(text + text_len, value.data(), length);
+  push(Text, static_cast<uint64_t>(text_len) << 16 | length);
+  text_len += length;
+}
+
+Network::Logger &Network::Logger::instance() {
+  // never destroyed: threads outliving main may still log
+  static Logger *logger = new Logger();
+  return *logger;
+}
+
+Network::Logger::Logger()
+    : wall_start(std::chrono::system_clock::now()),
+      steady_start(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count()) {
+  writer = std::thread(&Logger::run, this);
+  std::atexit(&Logger::stop);
+}
+
+Network::LogRing &Network::Logger::local() {
+  thread_local ring_owner owner;
+  if (!owner.ring) {
+    owner.ring = new LogRing();
+    std::unique_lock<std::mutex> lock(ringsMutex);
+    rings.push_back(owner.ring);
+  }
+  return *owner.ring;
+}
+
+void Network::Logger::stop() {
+  Logger &logger = instance();
+  logger.running.store(false, std::memory_order_relaxed);
+  if (logger.writer.joinable())
+    logger.writer.join();
+}
+
+void Network::Logger::run() {
+  while (running.load(std::memory_order_relaxed)) {
+    if (drain() == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  drain();
+}
+
+void Network::Logger::flush() { drain(); }
+
+uint64_t Network::Logger::dropped() {
+  std::unique_lock<std::mutex> lock(ringsMutex);
+  uint64_t total = retired_dropped;
+  for (LogRing *ring : rings)
+    total += ring->dropped.load(std::memory_order_relaxed);
+  return total;
+}
+
+/**
+ * @brief Take what every ring holds right now, write it ordered by time,
+ * then hand the slots back. Rings of exited threads are freed once empty
+ */
+size_t Network::Logger::drain() {
+  std::unique_lock<std::mutex> drainLock(drainMutex);
+  std::vector<LogRing *> current;
+  {
+    std::unique_lock<std::mutex> lock(ringsMutex);
+    current = rings;
+  }
+
+  struct pending {
+    uint64_t time;
+    const log_record *record;
+  };
+  std::vector<pending> batch;
+  std::vector<uint64_t> tails(current.size());
+  std::vector<bool> closed(current.size());
+  for (size_t r = 0; r < current.size(); ++r) {
+    LogRing *ring = current[r];
+    // closed before tail: nothing is logged after the tail we read
+    closed[r] = ring->closed.load(std::memory_order_acquire);
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    tails[r] = ring->tail.load(std::memory_order_acquire);
+    for (uint64_t i = head; i != tails[r]; ++i) {
+      const log_record &record = ring->records[i & (LOG_RING_SIZE - 1)];
+      batch.push_back({record.time, &record});
+    }
+  }
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const pending &a, const pending &b) {
+                     return a.time < b.time;
+                   });
+
+  std::string out;
+  out.reserve(LOG_BATCH_BYTES + LOG_RECORD_SIZE * 4);
+  for (const pending &entry : batch) {
+    format(*entry.record, out);
+    if (out.size() >= LOG_BATCH_BYTES)
+      write_out(out);
+  }
+  for (size_t r = 0; r < current.size(); ++r)
+    current[r]->head.store(tails[r], std::memory_order_release);
+
+  uint64_t lost = 0;
+  {
+    std::unique_lock<std::mutex> lock(ringsMutex);
+    for (size_t r = 0; r < current.size(); ++r) {
+      if (!closed[r])
+        continue;
+      retired_dropped += current[r]->dropped.load(std::memory_order_relaxed);
+      rings.erase(std::find(rings.begin(), rings.end(), current[r]));
+      delete current[r];
+    }
+    lost = retired_dropped;
+    for (LogRing *ring : rings)
+      lost += ring->dropped.load(std::memory_order_relaxed);
+  }
+  if (lost != reported_dropped) {
+    out += "logger: " + std::to_string(lost - reported_dropped) +
+           " records dropped, rings full\n";
+    reported_dropped = lost;
+  }
+  write_out(out);
+  return batch.size();
+}
+
+// "hh:mm:ss.uuuuuu LEVEL message"
+void Network::Logger::format(const log_record &record,
+                             std::string &out) const {
+  static const char *levels[] = {"TRACE", "DEBUG", "INFO ", "WARN ",
+                                 "ERROR"};
+  auto wall = wall_start + std::chrono::duration_cast<
+                               std::chrono::system_clock::duration>(
+                               std::chrono::nanoseconds(record.time -
+                                                        steady_start));
+  time_t seconds = std::chrono::system_clock::to_time_t(wall);
+  long micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                    wall.time_since_epoch())
+                    .count() %
+                1000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char prefix[32];
+  int n = snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%06ld %s ",
+                   local.tm_hour, local.tm_min, local.tm_sec, micros,
+                   levels[std::min<uint8_t>(record.level, LOG_LEVEL_ERROR)]);
+  out.append(prefix, n);
+
+  char number[64];
+  unsigned arg = 0;
+  for (const char *p = record.format; *p; ++p) {
+    if (p[0] != '{' || p[1] != '}' || arg == record.argc) {
+      out += *p;
+      continue;
+    }
+    ++p;
+    uint64_t value = record.args[arg];
+    switch (record.types[arg++]) {
+    case log_record::Signed:
+      out.append(number, std::to_chars(number, number + sizeof(number),
+                                       static_cast<int64_t>(value))
+                                 .ptr -
+                             number);
+      break;
+    case log_record::Unsigned:
+      out.append(number,
+                 std::to_chars(number, number + sizeof(number), value).ptr -
+                     number);
+      break;
+    case log_record::Double: {
+      double d;
+      memcpy(&d, &value, sizeof(d));
+      out.append(number, snprintf(number, sizeof(number), "%g", d));
+      break;
+    }
+    case log_record::Text:
+      out.append(record.text + (value >> 16), value & 0xffff);
+      break;
+    case log_record::Addr: {
+      struct in_addr ip;
+      ip.s_addr = static_cast<uint32_t>(value >> 16);
+      inet_ntop(AF_INET, &ip, number, INET_ADDRSTRLEN);
+      out += number;
+      out += ':';
+      out += std::to_string(ntohs(static_cast<uint16_t>(value)));
+      break;
+    }
+    }
+  }
+  out += '\n';
+}
+
+void Network::Logger::write_out(std::string &out) {
+  size_t done = 0;
+  while (done < out.size()) {
+    ssize_t written = ::write(STDOUT_FILENO, out.data() + done,
+                              out.size() - done);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      break; // nowhere to report it
+    }
+    done += written;
+  }
+  out.clear();
+}
@@ -0,0 +1,384 @@
+#include "../include/metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const Network::Counter Network::metric::packets_in =
+    Metrics::instance().counter("packets_in_total", "Packets received");
+const Network::Counter Network::metric::bytes_in =
+    Metrics::instance().counter("bytes_in_total", "Bytes received");
+const Network::Counter Network::metric::packets_out =
+    Metrics::instance().counter("packets_out_total", "Packets sent");
+const Network::Counter Network::metric::bytes_out =
+    Metrics::instance().counter("bytes_out_total", "Bytes sent");
+const Network::Counter Network::metric::checksum_failures =
+    Metrics::instance().counter("checksum_failures_total",
+                                "Parsed packets with wrong ip/tcp checksum");
+const Network::Counter Network::metric::malformed =
+    Metrics::instance().counter("malformed_packets_total",
+                                "Packets with inconsistent headers");
+const Network::Counter Network::metric::filtered_out =
+    Metrics::instance().counter("filtered_packets_total",
+                                "Packets receive_packet read and skipped "
+                                "(not to caller's port)");
+const Network::Counter Network::metric::backlog_dropped =
+    Metrics::instance().counter("backlog_dropped_total",
+                                "Unknown-flow packets dropped, backlog full");
+
+/*----------------------------- HISTOGRAM -----------------------------*/
+
+Network::hist_shard::hist_shard() { reset(); }
+
+/**
+ * @brief Values below 2^HIST_SUB_BITS get a bucket each, above that
+ * every power of two is split into 2^HIST_SUB_BITS equal buckets
+ */
+unsigned Network::hist_shard::bucket(uint64_t value) {
+  constexpr uint64_t sub = 1ULL << HIST_SUB_BITS;
+  if (value >= 1ULL << HIST_MAX_BITS)
+    value = (1ULL << HIST_MAX_BITS) - 1;
+  if (value < sub)
+    return static_cast<unsigned>(value);
+  unsigned exp = 63 - __builtin_clzll(value);
+  unsigned shift = exp - HIST_SUB_BITS;
+  return ((shift + 1) << HIST_SUB_BITS) +
+         static_cast<unsigned>((value >> shift) - sub);
+}
+
+uint64_t Network::hist_shard::highest(unsigned bucket) {
+  constexpr uint64_t sub = 1ULL << HIST_SUB_BITS;
+  if (bucket < sub)
+    return bucket;
+  unsigned shift = (bucket >> HIST_SUB_BITS) - 1;
+  uint64_t low = (sub + (bucket & (sub - 1))) << shift;
+  return low + (1ULL << shift) - 1;
+}
+
+// single writer: plain load + store, no locked add
+void Network::hist_shard::record(uint64_t value) {
+  auto bump = [](std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  };
+  bump(buckets[bucket(value)], 1);
+  bump(count, 1);
+  bump(sum, value);
+  if (value > max.load(std::memory_order_relaxed))
+    max.store(value, std::memory_order_relaxed);
+}
+
+void Network::hist_shard::reset() {
+  for (auto &bucket : buckets)
+    bucket.store(0, std::memory_order_relaxed);
+  count.store(0, std::memory_order_relaxed);
+  sum.store(0, std::memory_order_relaxed);
+  max.store(0, std::memory_order_relaxed);
+}
+
+// Add other's values (other may still be written by its thread)
+void Network::hist_shard::merge(const hist_shard &other) {
+  uint64_t seen = 0;
+  for (size_t b = 0; b < HIST_BUCKETS; ++b) {
+    uint64_t n = other.buckets[b].load(std::memory_order_relaxed);
+    buckets[b].store(buckets[b].load(std::memory_order_relaxed) + n,
+                     std::memory_order_relaxed);
+    seen += n;
+  }
+  // count comes from the buckets, so quantiles add up
+  count.store(count.load(std::memory_order_relaxed) + seen,
+              std::memory_order_relaxed);
+  sum.store(sum.load(std::memory_order_relaxed) +
+                other.sum.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+  uint64_t other_max = other.max.load(std::memory_order_relaxed);
+  if (other_max > max.load(std::memory_order_relaxed))
+    max.store(other_max, std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the q-th value, exact max for q = 1
+uint64_t Network::hist_shard::quantile(double q) const {
+  uint64_t total = count.load(std::memory_order_relaxed);
+  uint64_t largest = max.load(std::memory_order_relaxed);
+  if (total == 0)
+    return 0;
+  if (q >= 1.0)
+    return largest;
+  uint64_t rank =
+      std::max<uint64_t>(static_cast<uint64_t>(q * total + 0.5), 1);
+  uint64_t below = 0;
+  for (unsigned b = 0; b < HIST_BUCKETS; ++b) {
+    below += buckets[b].load(std::memory_order_relaxed);
+    if (below >= rank)
+      return std::min(highest(b), largest);
+  }
+  return largest;
+}
+
+/*------------------------------ REGISTRY ------------------------------*/
+
+Network::metrics_block::metrics_block() {
+  for (auto &counter : counters)
+    counter.store(0, std::memory_order_relaxed);
+  for (auto &histogram : histograms)
+    histogram.store(nullptr, std::memory_order_relaxed);
+}
+
+Network::metrics_block::~metrics_block() {
+  if (registered)
+    Metrics::instance().retire(*this);
+}
+
+Network::Metrics &Network::Metrics::instance() {
+  // never destroyed: threads outliving main may still count
+  static Metrics *metrics = new Metrics();
+  return *metrics;
+}
+
+Network::Metrics::Metrics() {
+  for (auto &histogram : retired_histograms)
+    histogram = std::make_unique<hist_shard>();
+}
+
+uint64_t Network::Metrics::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Network::Metrics::enroll(metrics_block &block) {
+  std::unique_lock<std::mutex> lock(metricsMutex);
+  blocks.push_back(&block);
+  block.registered = true;
+}
+
+// Thread exits: fold its values into the retired totals
+void Network::Metrics::retire(metrics_block &block) {
+  std::unique_lock<std::mutex> lock(metricsMutex);
+  for (size_t i = 0; i < METRICS_MAX_COUNTERS; ++i)
+    retired_counters[i] += block.counters[i].load(std::memory_order_relaxed);
+  for (size_t i = 0; i < METRICS_MAX_HISTOGRAMS; ++i) {
+    hist_shard *shard = block.histograms[i].load(std::memory_order_acquire);
+    if (!shard)
+      continue;
+    retired_histograms[i]->merge(*shard);
+    delete shard;
+  }
+  for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+    if (*it == &block) {
+      blocks.erase(it);
+      break;
+    }
+  }
+  block.registered = false;
+}
+
+uint16_t Network::Metrics::find_or_add(std::vector<series> &list,
+                                       size_t limit, const std::string &name,
+                                       const std::string &help) {
+  std::unique_lock<std::mutex> lock(metricsMutex);
+  for (size_t i = 0; i < list.size(); ++i)
+    if (list[i].name == name)
+      return static_cast<uint16_t>(i);
+  if (list.size() == limit)
+    throw std::length_error("metrics registry full: " + name);
+  list.push_back({name, help});
+  return static_cast<uint16_t>(list.size() - 1);
+}
+
+Network::Counter Network::Metrics::counter(const std::string &name,
+                                           const std::string &help) {
+  return Counter{find_or_add(counters, METRICS_MAX_COUNTERS, name, help)};
+}
+
+Network::Histogram Network::Metrics::histogram(const std::string &name,
+                                               const std::string &help) {
+  return Histogram{
+      find_or_add(histograms, METRICS_MAX_HISTOGRAMS, name, help)};
+}
+
+unsigned Network::Metrics::gauge(const std::string &name,
+                                 const std::string &help,
+                                 std::function<double()> read) {
+  std::unique_lock<std::mutex> lock(metricsMutex);
+  gauges.push_back({next_gauge, name, help, std::move(read)});
+  return next_gauge++;
+}
+
+void Network::Metrics::remove_gauge(unsigned id) {
+  std::unique_lock<std::mutex> lock(metricsMutex);
+  for (auto it = gauges.begin(); it != gauges.end(); ++it) {
+    if (it->id == id) {
+      gauges.erase(it);
+      return;
+    }
+  }
+}
+
+/*------------------------------- EXPORT -------------------------------*/
+
+/**
+ * @brief Prometheus text format: counters as they are, gauges summed by
+ * name, histograms as summaries (quantiles, _sum, _count) in seconds,
+ * quantiles are upper bounds of their buckets
+ */
+std::string Network::Metrics::render() {
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+  std::string out;
+  char line[256];
+  std::unique_lock<std::mutex> lock(metricsMutex);
+
+  for (size_t i = 0; i < counters.size(); ++i) {
+    uint64_t total = retired_counters[i];
+    for (const metrics_block *block : blocks)
+      total += block->counters[i].load(std::memory_order_relaxed);
+    out += "# HELP " + counters[i].name + " " + counters[i].help + "\n";
+    out += "# TYPE " + counters[i].name + " counter\n";
+    snprintf(line, sizeof(line), "%s %lu\n", counters[i].name.c_str(),
+             static_cast<unsigned long>(total));
+    out += line;
+  }
+
+  std::vector<bool> done(gauges.size(), false);
+  for (size_t i = 0; i < gauges.size(); ++i) {
+    if (done[i])
+      continue;
+    double value = 0;
+    for (size_t j = i; j < gauges.size(); ++j) {
+      if (gauges[j].name != gauges[i].name)
+        continue;
+      value += gauges[j].read();
+      done[j] = true;
+    }
+    out += "# HELP " + gauges[i].name + " " + gauges[i].help + "\n";
+    out += "# TYPE " + gauges[i].name + " gauge\n";
+    snprintf(line, sizeof(line), "%s %g\n", gauges[i].name.c_str(), value);
+    out += line;
+  }
+
+  hist_shard merged;
+  for (size_t i = 0; i < histograms.size(); ++i) {
+    merged.reset();
+    merged.merge(*retired_histograms[i]);
+    for (const metrics_block *block : blocks) {
+      const hist_shard *shard =
+          block->histograms[i].load(std::memory_order_acquire);
+      if (shard)
+        merged.merge(*shard);
+    }
+    const std::string &name = histograms[i].name;
+    out += "# HELP " + name + " " + histograms[i].help + "\n";
+    out += "# TYPE " + name + " summary\n";
+    for (double q : quantiles) {
+      snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %g\n", name.c_str(),
+               q, merged.quantile(q) / 1e9);
+      out += line;
+    }
+    snprintf(line, sizeof(line), "%s_sum %g\n%s_count %lu\n", name.c_str(),
+             merged.sum.load() / 1e9, name.c_str(),
+             static_cast<unsigned long>(merged.count.load()));
+    out += line;
+  }
+  return out;
+}
+
+/**
+ * @brief Start exporting thread: file target is rewritten (write + rename,
+ * readers never see half of it) every interval seconds, unix:<path>
+ * target renders on every connection, closed once written
+ */
+bool Network::Metrics::export_to(const std::string &target,
+                                 unsigned interval) {
+  if (exporting.load())
+    return false;
+  this->target = target;
+  this->interval = interval > 0 ? interval : 1;
+  if (target.compare(0, 5, "unix:") == 0) {
+    std::string path = target.substr(5);
+    struct sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "metrics socket path too long " << path << std::endl;
+      return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (listen_fd < 0 ||
+        bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr),
+             sizeof(addr)) < 0 ||
+        listen(listen_fd, 8) < 0) {
+      std::cerr << "metrics socket " << path << " failed " << strerror(errno)
+                << std::endl;
+      if (listen_fd >= 0)
+        close(listen_fd);
+      listen_fd = -1;
+      return false;
+    }
+  }
+  exporting = true;
+  exporter = std::thread(&Metrics::run_export, this);
+  std::atexit(&Metrics::stop);
+  return true;
+}
+
+void Network::Metrics::run_export() {
+  auto next = std::chrono::steady_clock::now();
+  while (exporting.load(std::memory_order_relaxed)) {
+    if (listen_fd >= 0) {
+      struct pollfd pfd {};
+      pfd.fd = listen_fd;
+      pfd.events = POLLIN;
+      // timeout lets the exporter notice it was stopped
+      if (poll(&pfd, 1, 100) <= 0)
+        continue;
+      int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0)
+        continue;
+      std::string text = render();
+      size_t done = 0;
+      while (done < text.size()) {
+        ssize_t n = send(fd, text.data() + done, text.size() - done,
+                         MSG_NOSIGNAL);
+        if (n <= 0)
+          break;
+        done += n;
+      }
+      close(fd);
+      continue;
+    }
+    if (std::chrono::steady_clock::now() < next) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    next += std::chrono::seconds(interval);
+    std::string text = render();
+    std::string tmp = target + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "w");
+    if (!file)
+      continue;
+    bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    if (fclose(file) == 0 && written)
+      rename(tmp.c_str(), target.c_str());
+  }
+}
+
+// At exit: last file write is left in place, socket path is removed
+void Network::Metrics::stop() {
+  Metrics &metrics = instance();
+  metrics.exporting = false;
+  if (metrics.exporter.joinable())
+    metrics.exporter.join();
+  if (metrics.listen_fd >= 0) {
+    close(metrics.listen_fd);
+    unlink(metrics.target.substr(5).c_str());
+  }
+}
@@ -1,26 +1,70 @@
 #include "../include/network.hpp"
+#include "../include/buffer_pool.hpp"
+#include "../include/dispatcher.hpp"
+#include "../include/logger.hpp"
+#include "../include/metrics.hpp"
+#include "../include/packet_ring.hpp"
+#include "../include/syn_cookie.hpp"
+#include "../include/timer_wheel.hpp"
+#include <algorithm>
+#include <linux/filter.h>
+#include <poll.h>
+
+void Network::packet_release::operator()(unsigned char *data) const {
+  if (ring)
+    ring->release(data);
+  else if (pool)
+    pool->release(data);
+  else
+    delete[] data;
+}
 
-// Create connection request SYN packet
-void Network::create_syn_packet(struct sockaddr_in *src,
-                                struct sockaddr_in *dst,
-                                std::unique_ptr<unsigned char[]> &packet,
-                                int *packet_size) {
-  uint16_t datagram_size =
-      sizeof(struct iphdr) + sizeof(struct tcphdr) + OPT_SIZE;
-  auto datagram = std::make_unique<unsigned char[]>(datagram_size);
-  memset(datagram.get(), 0, datagram_size);
+/**
+ * @brief Lay out ip header, tcp header (+ zeroed options) and payload
+ * directly in caller's buffer. The tcp checksum is taken over the segment
+ * in place with pseudo header fields added to the sum, so nothing is
+ * allocated or copied twice. Returns packet size, 0 if it doesn't fit
+ */
+size_t Network::build_packet(unsigned char *buffer, size_t capacity,
+                             const struct sockaddr_in *src,
+                             const struct sockaddr_in *dst, uint32_t seq,
+                             uint32_t ack_seq, uint8_t flags,
+                             uint16_t options_len, const void *payload,
+                             size_t payload_len, uint16_t window) {
+  size_t size = lay_out_packet(buffer, capacity, src, dst, seq, ack_seq,
+                               flags, options_len, payload, payload_len,
+                               window);
+  if (size != 0)
+    seal_packet(buffer, size);
+  return size;
+}
+
+size_t Network::lay_out_packet(unsigned char *buffer, size_t capacity,
+                               const struct sockaddr_in *src,
+                               const struct sockaddr_in *dst, uint32_t seq,
+                               uint32_t ack_seq, uint8_t flags,
+                               uint16_t options_len, const void *payload,
+                               size_t payload_len, uint16_t window) {
+  size_t tcp_len = sizeof(struct tcphdr) + options_len + payload_len;
+  size_t datagram_size = sizeof(struct iphdr) + tcp_len;
+  if (datagram_size > capacity || datagram_size > IP_MAXPACKET ||
+      options_len % 4 != 0 || options_len > 40) {
+    std::cerr << "Error: packet of " << datagram_size
+              << " bytes doesn't fit buffer of " << capacity << std::endl;
+    return 0;
+  }
 
   // Ip, tcp headers
-  struct iphdr *iph = reinterpret_cast<struct iphdr *>(datagram.get());
+  struct iphdr *iph = reinterpret_cast<struct iphdr *>(buffer);
   struct tcphdr *tcph =
-      reinterpret_cast<struct tcphdr *>(datagram.get() + sizeof(struct iphdr));
+      reinterpret_cast<struct tcphdr *>(buffer + sizeof(struct iphdr));
 
   // Ip header configuration
   iph->ihl = 5;
   iph->version = 4;
   iph->tos = 0;
-  iph->tot_len = datagram_size;
-  iph->id = htons(rand() & 65535);
+  iph->tot_len = htons(datagram_size);
+  iph->id = htons(rand() & 65535); // id of this packet
   iph->frag_off = 0;
   iph->ttl = 64;
   iph->protocol = IPPROTO_TCP;
@@ -29,145 +73,189 @@ void Network::create_syn_packet(struct sockaddr_in *src,
   iph->daddr = dst->sin_addr.s_addr;
 
   // TCP header configuration
+  memset(tcph, 0, sizeof(struct tcphdr) + options_len);
   tcph->source = src->sin_port;
   tcph->dest = dst->sin_port;
-  tcph->seq = htonl(100);
-  tcph->ack_seq = htonl(0);
-  tcph->doff = 10; // tcp header size
-  tcph->fin = 0;
-  tcph->syn = 1;
-  tcph->rst = 0;
-  tcph->psh = 0;
-  tcph->ack = 0;
-  tcph->urg = 0;
-  tcph->check = 0;            // correct calculation follows later
-  tcph->window = htons(5840); // window size
+  tcph->seq = htonl(seq);
+  tcph->ack_seq = htonl(ack_seq);
+  tcph->doff = (sizeof(struct tcphdr) + options_len) / 4; // tcp header size
+  tcph->fin = (flags & TH_FIN) != 0;
+  tcph->syn = (flags & TH_SYN) != 0;
+  tcph->rst = (flags & TH_RST) != 0;
+  tcph->psh = (flags & TH_PUSH) != 0;
+  tcph->ack = (flags & TH_ACK) != 0;
+  tcph->urg = (flags & TH_URG) != 0;
+  tcph->window = htons(window); // window size
   tcph->urg_ptr = 0;
 
-  // pseudo header to calculate checksum
-  Network::pseudo_header psh;
+  // Set payload
+  unsigned char *data =
+      buffer + sizeof(struct iphdr) + sizeof(struct tcphdr) + options_len;
+  if (payload_len > 0 && payload != data)
+    memcpy(data, payload, payload_len);
+  return datagram_size;
+}
 
-  psh.src_addr = iph->saddr;
-  psh.dst_addr = iph->daddr;
-  psh.placeholder = 0;
-  psh.protocol = IPPROTO_TCP;
-  psh.tcp_length = htons(sizeof(struct tcphdr) + OPT_SIZE);
+void Network::seal_packet(unsigned char *buffer, size_t size) {
+  struct iphdr *iph = reinterpret_cast<struct iphdr *>(buffer);
+  struct tcphdr *tcph =
+      reinterpret_cast<struct tcphdr *>(buffer + sizeof(struct iphdr));
+  iph->check = Network::checksum(iph, sizeof(struct iphdr));
+  tcph->check =
+      Network::tcp_checksum(iph, tcph, size - sizeof(struct iphdr));
+}
 
-  uint16_t psize =
-      sizeof(Network::pseudo_header) + sizeof(struct tcphdr) + OPT_SIZE;
+size_t Network::build_segment(unsigned char *buffer, size_t capacity,
+                              const struct sockaddr_in *src,
+                              const struct sockaddr_in *dst, uint32_t seq,
+                              uint32_t ack_seq, uint8_t flags,
+                              const tcp_session &session, const void *payload,
+                              size_t payload_len) {
+  if (session.timestamps)
+    return build_packet<ts_layout>(buffer, capacity, src, dst, seq, ack_seq,
+                                   flags, session.stamp(), session.window(),
+                                   payload, payload_len);
+  return build_packet(buffer, capacity, src, dst, seq, ack_seq, flags, 0,
+                      payload, payload_len, session.window());
+}
+
+void Network::restamp(unsigned char *packet, uint32_t tsval) {
+  struct tcphdr *tcph =
+      reinterpret_cast<struct tcphdr *>(packet + sizeof(struct iphdr));
+  unsigned char *at = packet + PAYLOAD_OFFSET + ts_layout::tsval_at;
+  uint32_t old_val;
+  memcpy(&old_val, at, sizeof(old_val));
+  store32(at, tsval);
+  tcph->check = checksum_update32(tcph->check, old_val, htonl(tsval));
+}
 
-  // fill pseudo packet
-  std::vector<unsigned char> pseudogram(psize);
+/*---------------------------- TCP OPTIONS ----------------------------*/
 
-  memcpy(pseudogram.data(), &psh, sizeof(Network::pseudo_header));
+static inline uint16_t load16(const unsigned char *in) {
+  return static_cast<uint16_t>(in[0] << 8 | in[1]);
+}
+static inline uint32_t load32(const unsigned char *in) {
+  return static_cast<uint32_t>(load16(in)) << 16 | load16(in + 2);
+}
+
+/**
+ * @brief Every segment of a connection with timestamps carries exactly
+ * ts_layout, checked first with one compare; anything else (SYNs) is
+ * walked option by option. Walk stops at EOL or an option running past
+ * the end
+ */
+Network::tcp_options Network::parse_options(std::string_view raw) {
+  tcp_options options;
+  const unsigned char *at = reinterpret_cast<const unsigned char *>(raw.data());
+  const unsigned char *end = at + raw.size();
+  static const unsigned char ts_prefix[] = {TCPOPT_NOP, TCPOPT_NOP,
+                                            TCPOPT_TIMESTAMP,
+                                            TCPOLEN_TIMESTAMP};
+  if (raw.size() == ts_layout::size &&
+      memcmp(at, ts_prefix, sizeof(ts_prefix)) == 0) {
+    options.timestamps = true;
+    options.tsval = load32(at + ts_layout::tsval_at);
+    options.tsecr = load32(at + ts_layout::tsval_at + 4);
+    return options;
+  }
+  while (at < end && *at != TCPOPT_EOL) {
+    if (*at == TCPOPT_NOP) {
+      ++at;
+      continue;
+    }
+    if (end - at < 2 || at[1] < 2 || at[1] > end - at)
+      break;
+    uint8_t kind = at[0], len = at[1];
+    if (kind == TCPOPT_MAXSEG && len == TCPOLEN_MAXSEG) {
+      options.mss = load16(at + 2);
+    } else if (kind == TCPOPT_WINDOW && len == TCPOLEN_WINDOW) {
+      options.wscale =
+          static_cast<int8_t>(std::min<int>(at[2], TCP_WSCALE_MAX));
+    } else if (kind == TCPOPT_SACK_PERMITTED &&
+               len == TCPOLEN_SACK_PERMITTED) {
+      options.sack_permitted = true;
+    } else if (kind == TCPOPT_TIMESTAMP && len == TCPOLEN_TIMESTAMP) {
+      options.timestamps = true;
+      options.tsval = load32(at + 2);
+      options.tsecr = load32(at + 6);
+    }
+    at += len;
+  }
+  return options;
+}
 
-  memcpy(pseudogram.data() + sizeof(Network::pseudo_header), tcph,
-         sizeof(struct tcphdr) + OPT_SIZE);
+uint32_t Network::tcp_timestamp() {
+  return static_cast<uint32_t>(Metrics::now() / 1000000);
+}
 
-  /* // TCP options
-   unsigned char *options =
-       datagram.get() + sizeof(struct iphdr) + sizeof(struct tcphdr);
+Network::tcp_options Network::tcp_session::offer(const tcp_options *syn) {
+  tcp_options options;
+  options.mss = LOCAL_MSS;
+  options.wscale = !syn || syn->wscale >= 0 ? LOCAL_WSCALE : -1;
+  options.timestamps = !syn || syn->timestamps;
+  if (options.timestamps) {
+    options.tsval = tcp_timestamp();
+    options.tsecr = syn ? syn->tsval : 0;
+  }
+  return options;
+}
 
-   options[0] = 0x02;                           // MSS Option Kind
-   options[1] = 0x04;                           // MSS Option Length
-   uint16_t mss = htons(48);                    // MSS Value
-   memcpy(options + 2, &mss, sizeof(uint16_t)); // Copy MSS value to options
-   options[4] = 0x04;                           // SACK Permitted Option Kind
-   options[5] = 0x02;                           // SACK Permitted Option Length
+void Network::tcp_session::negotiate(const tcp_options &syn) {
+  mss = syn.mss != 0 ? std::min<uint16_t>(syn.mss, LOCAL_MSS)
+                     : TCP_MSS_DEFAULT;
+  bool scaled = syn.wscale >= 0;
+  snd_wscale = scaled ? syn.wscale : 0;
+  rcv_wscale = scaled ? LOCAL_WSCALE : 0;
+  timestamps = syn.timestamps;
+  ts_recent = syn.tsval;
+  LOG_DEBUG("negotiated mss {} wscale {}/{} timestamps {}", mss, snd_wscale,
+            rcv_wscale, timestamps);
+}
 
-   // Do the same for pseudo header
+Network::tcp_options Network::tcp_session::received(const PacketView &view) {
+  snd_wnd = static_cast<uint32_t>(view.window()) << snd_wscale;
+  if (!timestamps)
+    return {};
+  tcp_options options = parse_options(view.options());
+  if (options.timestamps)
+    ts_recent = options.tsval;
+  return options;
+}
 
-   unsigned char *ps_options = pseudogram.data() +
-                               sizeof(Network::pseudo_header) +
-                               sizeof(struct tcphdr);
-   ps_options[0] = 0x02;
-   ps_options[1] = 0x04;
-   memcpy(options + 2, &mss, sizeof(uint16_t));
-   options[4] = 0x04;
-   options[5] = 0x02;
- */
-  uint16_t ipchk =
-      Network::checksum(reinterpret_cast<unsigned short *>(iph), iph->tot_len);
-  iph->check = htons(ipchk);
+uint16_t Network::tcp_session::window() const {
+  return static_cast<uint16_t>(
+      std::min<uint32_t>(LOCAL_WINDOW >> rcv_wscale, TCP_WINDOW_MAX));
+}
 
-  uint16_t tcpchk = Network::checksum(
-      reinterpret_cast<unsigned short *>(pseudogram.data()), psize);
-  tcph->check = htons(tcpchk);
+Network::tcp_options Network::tcp_session::stamp() const {
+  tcp_options options;
+  options.timestamps = true;
+  options.tsval = tcp_timestamp();
+  options.tsecr = ts_recent;
+  return options;
+}
+/*--------------------------------------------------------------------*/
 
-  packet = std::move(datagram);
-  *packet_size = iph->tot_len;
+// Create connection request SYN packet
+void Network::create_syn_packet(struct sockaddr_in *src,
+                                struct sockaddr_in *dst,
+                                std::unique_ptr<unsigned char[]> &packet,
+                                int *packet_size) {
+  packet = std::make_unique<unsigned char[]>(REQUEST_SIZE);
+  *packet_size = Network::build_packet(packet.get(), REQUEST_SIZE, src, dst,
+                                       100, 0, TH_SYN, OPT_SIZE, nullptr, 0);
 }
+
 // Create ACK packet
 void Network::create_ack_packet(struct sockaddr_in *src,
                                 struct sockaddr_in *dst, uint32_t seq,
                                 uint32_t ack_seq,
                                 std::unique_ptr<unsigned char[]> &packet,
                                 int *packet_size) {
-  uint16_t datagram_size =
-      sizeof(struct iphdr) + sizeof(struct tcphdr) + OPT_SIZE;
-  auto datagram = std::make_unique<unsigned char[]>(datagram_size);
-  memset(datagram.get(), 0, datagram_size);
-
-  // Ip, tcp headers
-  struct iphdr *iph = reinterpret_cast<struct iphdr *>(datagram.get());
-  struct tcphdr *tcph =
-      reinterpret_cast<struct tcphdr *>(datagram.get() + sizeof(struct iphdr));
-
-  // Ip header configuration
-  iph->ihl = 5;
-  iph->version = 4;
-  iph->tos = 0;
-  iph->tot_len = datagram_size;
-  iph->id = htons(rand() & 65535);
-  iph->frag_off = 0;
-  iph->ttl = 64;
-  iph->protocol = IPPROTO_TCP;
-  iph->check = 0;
-  iph->saddr = src->sin_addr.s_addr;
-  iph->daddr = dst->sin_addr.s_addr;
-
-  // TCP header configuration
-  tcph->source = src->sin_port;
-  tcph->dest = dst->sin_port;
-  tcph->seq = htonl(seq);
-  tcph->ack_seq = htonl(ack_seq);
-  tcph->doff = 10; // tcp header size (data offset)
-  tcph->fin = 0;
-  tcph->syn = 0;
-  tcph->rst = 0;
-  tcph->psh = 0;
-  tcph->ack = 1;
-  tcph->urg = 0;
-  tcph->check = 0;            // correct calculation follows later
-  tcph->window = htons(5840); // window size
-  tcph->urg_ptr = 0;
-
-  // pseudo header to calculate checksum
-  Network::pseudo_header psh;
-
-  psh.src_addr = iph->saddr;
-  psh.dst_addr = iph->daddr;
-  psh.placeholder = 0;
-  psh.protocol = IPPROTO_TCP;
-  psh.tcp_length = htons(sizeof(struct tcphdr) + OPT_SIZE);
-
-  size_t psize =
-      sizeof(Network::pseudo_header) + sizeof(struct tcphdr) + OPT_SIZE;
-  std::vector<unsigned char> pseudogram(psize);
-  memcpy(pseudogram.data(), &psh, sizeof(Network::pseudo_header));
-  memcpy(pseudogram.data() + sizeof(Network::pseudo_header), tcph,
-         sizeof(struct tcphdr) + OPT_SIZE);
-
-  uint16_t ipchk =
-      Network::checksum(reinterpret_cast<unsigned short *>(iph), iph->ihl << 2);
-  iph->check = htons(ipchk);
-
-  uint16_t tcpchk = Network::checksum(
-      reinterpret_cast<unsigned short *>(pseudogram.data()), psize);
-  tcph->check = htons(tcpchk);
-
-  packet = std::move(datagram);
-  *packet_size = iph->tot_len;
+  packet = std::make_unique<unsigned char[]>(REQUEST_SIZE);
+  *packet_size = Network::build_packet(packet.get(), REQUEST_SIZE, src, dst,
+                                       seq, ack_seq, TH_ACK, OPT_SIZE, nullptr,
+                                       0);
 }
 
 // Create a data-filled packet
@@ -176,80 +264,12 @@ void Network::create_data_packet(struct sockaddr_in *src,
                                  uint32_t ack_seq, const std::string &data,
                                  std::unique_ptr<unsigned char[]> &packet,
                                  int *packet_size) {
-  uint16_t datagram_size =
+  size_t datagram_size =
       sizeof(struct iphdr) + sizeof(struct tcphdr) + data.size();
-  auto datagram = std::make_unique<unsigned char[]>(datagram_size);
-  memset(datagram.get(), 0, datagram_size);
-
-  // Ip, tcp headers
-  struct iphdr *iph = reinterpret_cast<struct iphdr *>(datagram.get());
-  struct tcphdr *tcph =
-      reinterpret_cast<struct tcphdr *>(datagram.get() + sizeof(struct iphdr));
-
-  // Set payload
-  std::copy(data.begin(), data.end(),
-            datagram.get() + sizeof(struct iphdr) + sizeof(struct tcphdr));
-  // IP header configuration
-  iph->ihl = 5;
-  iph->version = 4;
-  iph->tos = 0;
-  iph->tot_len = datagram_size;
-  iph->id = htons(rand() % 65535); // id of this packet
-  iph->frag_off = 0;
-  iph->ttl = 64;
-  iph->protocol = IPPROTO_TCP;
-  iph->check = 0;                    // calculation follows later
-  iph->saddr = src->sin_addr.s_addr; // source adress
-  iph->daddr = dst->sin_addr.s_addr;
-
-  // TCP header configuration
-  tcph->source = src->sin_port;
-  tcph->dest = dst->sin_port;
-  tcph->seq = htonl(seq);
-  tcph->ack_seq = htonl(ack_seq);
-  tcph->doff = 5; // tcp header size
-  tcph->fin = 0;
-  tcph->syn = 0;
-  tcph->rst = 0;
-  tcph->psh = 1;
-  tcph->ack = 1;
-  tcph->urg = 0;
-  tcph->check = 0;            // calculation follows later
-  tcph->window = htons(5840); // window size
-  tcph->urg_ptr = 0;
-
-  // pseudo header to calculate checksum
-  Network::pseudo_header psh;
-
-  psh.src_addr = iph->saddr;
-  psh.dst_addr = iph->daddr;
-  psh.placeholder = 0;
-  psh.protocol = IPPROTO_TCP;
-  psh.tcp_length = htons(sizeof(struct tcphdr) + data.size());
-
-  size_t psize =
-      sizeof(Network::pseudo_header) + sizeof(struct tcphdr) + data.size();
-
-  std::vector<unsigned char> pseudogram(psize);
-
-  memcpy(pseudogram.data(), &psh, sizeof(Network::pseudo_header));
-  memcpy(pseudogram.data() + sizeof(Network::pseudo_header), tcph,
-         sizeof(struct tcphdr));
-  memcpy(pseudogram.data() + sizeof(Network::pseudo_header) +
-             sizeof(struct tcphdr),
-         datagram.get() + sizeof(struct iphdr) + sizeof(struct tcphdr),
-         data.size());
-
-  uint16_t ipchk =
-      Network::checksum(reinterpret_cast<unsigned short *>(iph), iph->tot_len);
-  iph->check = htons(ipchk);
-
-  uint16_t tcpchk = Network::checksum(
-      reinterpret_cast<unsigned short *>(pseudogram.data()), psize);
-  tcph->check = htons(tcpchk);
-
-  packet = std::move(datagram);
-  *packet_size = iph->tot_len;
+  packet = std::make_unique<unsigned char[]>(datagram_size);
+  *packet_size = Network::build_packet(packet.get(), datagram_size, src, dst,
+                                       seq, ack_seq, TH_PUSH | TH_ACK, 0,
+                                       data.data(), data.size());
 }
 
 int Network::create_socket(int domain, int type, int protocol) {
@@ -292,6 +312,9 @@ bool Network::create_server_socket(int &server_sockfd,
               << std::endl;
     return -1;
   }
+  // don't let the kernel wake us for traffic of other ports
+  if (!Network::attach_port_filter(server_sockfd, port))
+    return false;
   std::cout << "\n\nSelf adress: " << ip << ":" << port << std::endl;
   return true;
 }
@@ -329,6 +352,8 @@ int Network::create_client_socket(int &client_sockfd,
     std::cerr << "setsockopt(IP_HDRINCL, 1) failed" << std::endl;
     return -1;
   }
+  if (!attach_port_filter(client_sockfd, port))
+    return -1;
   return client_sockfd;
 }
 
@@ -357,173 +382,376 @@ bool Network::bind_to_port(int port, int &sockfd, struct sockaddr_in &addr) {
 }
 
 /**
- * @brief Write source address to passed source param
- * check flags and sequences numbers
- * parse payload, it will then be assigned to initial passed packet param
- * recalculate and compare checksums
- * log into console
+ * @brief Build classic BPF program for raw IPv4 socket
+ * (packet data starts at ip header):
+ * accept unfragmented TCP to port (or port range) without RST flag,
+ * if sharded - accept only flows with (source ip + source port) % shards
+ * equal to shard, so every socket of the group sees its own flows only,
+ * if peers are known - accept only SYNs, bare ACKs (handshake's last
+ * step, which is all a SYN cookie server knows of a new peer) and
+ * segments of known peers.
+ * Too many peers to match -> fall back to port only program.
+ * SO_ATTACH_FILTER swaps programs atomically, so it's safe to call
+ * again whenever connections come and go
  */
-void Network::parse_packet(std::unique_ptr<unsigned char[]> &packet,
-                           uint32_t *seq, uint32_t *ack,
-                           struct sockaddr_in &source) {
-  /*------------------------- READ PACKET -------------------------*/
-  struct iphdr *iph = reinterpret_cast<struct iphdr *>(packet.get());
-  unsigned short iphdrlen = iph->ihl * 4;
-  struct tcphdr *tcph =
-      reinterpret_cast<struct tcphdr *>(packet.get() + iphdrlen);
-  unsigned short tcphdrlen = tcph->doff * 4;
-  source.sin_port = tcph->source;
-  source.sin_addr.s_addr = iph->saddr;
-
-  char source_ip[INET_ADDRSTRLEN];
-  inet_ntop(AF_INET, &(source.sin_addr), source_ip, INET_ADDRSTRLEN);
-  std::cout << "\n\tsource address: " << source_ip << ":" << ntohs(tcph->source)
-            << std::endl;
-  // Read sequence number
-  uint32_t seq_num = tcph->seq;
-  // Read acknowledgement number
-  uint32_t ack_num = tcph->ack_seq;
-  // Check if it's SYN
-  bool syn = tcph->syn;
-  // Check delivery completeness
-  *seq = ntohl(seq_num);
-  *ack = ntohl(ack_num);
-  /*---------------------------------------------------------------*/
+static bool attach_filter(int sockfd, int first_port, int last_port,
+                          const std::vector<struct sockaddr_in> &peers,
+                          unsigned shard, unsigned shards) {
+  std::vector<struct sock_filter> prog;
+  auto stmt = [&prog](uint16_t code, uint32_t k) {
+    prog.push_back(BPF_STMT(code, k));
+  };
+  auto jump = [&prog](uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+    prog.push_back(BPF_JUMP(code, k, jt, jf));
+  };
+  const uint32_t pass = 0xffffffff, drop = 0;
+
+  stmt(BPF_LD | BPF_B | BPF_ABS, 9); // ip protocol
+  jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0);
+  stmt(BPF_RET | BPF_K, drop);
+  stmt(BPF_LD | BPF_H | BPF_ABS, 6); // fragment offset
+  jump(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 0, 1);
+  stmt(BPF_RET | BPF_K, drop);
+  stmt(BPF_LDX | BPF_B | BPF_MSH, 0); // X = ip header length
+  stmt(BPF_LD | BPF_H | BPF_IND, 2);  // tcp dest port
+  if (first_port == last_port) {
+    jump(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint16_t>(first_port), 1, 0);
+  } else {
+    jump(BPF_JMP | BPF_JGE | BPF_K, static_cast<uint16_t>(first_port), 0, 2);
+    jump(BPF_JMP | BPF_JGT | BPF_K, static_cast<uint16_t>(last_port), 1, 0);
+    prog.push_back(BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0));
+  }
+  stmt(BPF_RET | BPF_K, drop);
+  stmt(BPF_LD | BPF_B | BPF_IND, 13); // tcp flags
+  // RSTs come from kernel's own TCP stack, which knows nothing of us
+  jump(BPF_JMP | BPF_JSET | BPF_K, 0x04, 0, 1);
+  stmt(BPF_RET | BPF_K, drop);
+
+  if (shards > 1) {
+    stmt(BPF_LD | BPF_W | BPF_ABS, 12); // source ip
+    stmt(BPF_ST, 1);
+    stmt(BPF_LD | BPF_H | BPF_IND, 0); // tcp source port
+    stmt(BPF_LDX | BPF_W | BPF_MEM, 1);
+    stmt(BPF_ALU | BPF_ADD | BPF_X, 0);
+    stmt(BPF_ALU | BPF_MOD | BPF_K, shards);
+    jump(BPF_JMP | BPF_JEQ | BPF_K, shard, 1, 0);
+    stmt(BPF_RET | BPF_K, drop);
+    stmt(BPF_LDX | BPF_B | BPF_MSH, 0); // X = ip header length again
+  }
 
-  //-------------------------------------------------------------------|
+  if (peers.empty() || peers.size() > FILTER_MAX_PEERS) {
+    stmt(BPF_RET | BPF_K, pass);
+  } else {
+    stmt(BPF_LD | BPF_B | BPF_IND, 13);            // tcp flags again
+    jump(BPF_JMP | BPF_JSET | BPF_K, 0x02, 0, 1); // SYN
+    stmt(BPF_RET | BPF_K, pass);
+    jump(BPF_JMP | BPF_JEQ | BPF_K, 0x10, 0, 1); // bare ACK
+    stmt(BPF_RET | BPF_K, pass);
+    stmt(BPF_LD | BPF_W | BPF_ABS, 12); // source ip
+    stmt(BPF_ST, 0);
+    for (const auto &peer : peers) {
+      stmt(BPF_LD | BPF_MEM, 0);
+      jump(BPF_JMP | BPF_JEQ | BPF_K, ntohl(peer.sin_addr.s_addr), 0, 3);
+      stmt(BPF_LD | BPF_H | BPF_IND, 0); // tcp source port
+      jump(BPF_JMP | BPF_JEQ | BPF_K, ntohs(peer.sin_port), 0, 1);
+      stmt(BPF_RET | BPF_K, pass);
+    }
+    stmt(BPF_RET | BPF_K, drop);
+  }
 
-  /*------------------------ PARSE PAYLOAD ------------------------*/
-  unsigned int payload_size = ntohs(iph->tot_len) - (iphdrlen + tcphdrlen);
-  if (payload_size > 0 && payload_size < DATAGRAM_SIZE) {
-    auto payload = std::make_unique<unsigned char[]>(payload_size);
-    memcpy(payload.get(), packet.get() + (iphdrlen + tcphdrlen), payload_size);
-    packet = std::move(payload);
+  struct sock_fprog fprog;
+  fprog.len = static_cast<unsigned short>(prog.size());
+  fprog.filter = prog.data();
+  if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+                 sizeof(fprog)) < 0) {
+    std::cerr << "setsockopt(SO_ATTACH_FILTER) failed " << strerror(errno)
+              << std::endl;
+    return false;
   }
-  /*--------------------------------------------------------------*/
+  return true;
+}
 
-  //-------------------------------------------------------------------|
+bool Network::attach_port_filter(int sockfd, int port,
+                                 const std::vector<struct sockaddr_in> &peers,
+                                 unsigned shard, unsigned shards) {
+  return attach_filter(sockfd, port, port, peers, shard, shards);
+}
 
-  /*---------------------- COMPARE CHECKSUMS ---------------------*/
+bool Network::attach_range_filter(
+    int sockfd, int first_port, int last_port,
+    const std::vector<struct sockaddr_in> &peers) {
+  return attach_filter(sockfd, first_port, last_port, peers, 0, 1);
+}
 
-  /*------------------------- TCP CHECKSUM -----------------------*/
-  uint16_t recv_tcp_chk =
-      ntohs(tcph->check); // Convert received checksum to host byte order
-  tcph->check = 0;        // Set to 0 for checksum calculation
-
-  // Pseudo header to calculate checksum
-  Network::pseudo_header psh;
-  psh.src_addr = iph->saddr;
-  psh.dst_addr = iph->daddr;
-  psh.placeholder = 0;
-  psh.protocol = IPPROTO_TCP;
-  psh.tcp_length =
-      htons(tcphdrlen + payload_size); // Length of TCP header + payload
-
-  size_t psize = sizeof(Network::pseudo_header) + tcphdrlen + payload_size;
-
-  std::vector<unsigned char> pseudogram(psize);
-  memcpy(pseudogram.data(), &psh, sizeof(Network::pseudo_header));
-  memcpy(pseudogram.data() + sizeof(Network::pseudo_header), tcph, tcphdrlen);
-  memcpy(pseudogram.data() + sizeof(Network::pseudo_header) + tcphdrlen,
-         packet.get() + iphdrlen + tcphdrlen, payload_size);
-
-  uint16_t calc_tcp_chk = Network::checksum(
-      reinterpret_cast<unsigned short *>(pseudogram.data()), psize);
-
-  tcph->check = htons(
-      recv_tcp_chk); // Restore the original checksum in network byte order
-  bool tcp_chk_match = (recv_tcp_chk == calc_tcp_chk);
-
-  /*------------------------- IP CHECKSUM ------------------------*/
-  uint16_t recv_ip_chk =
-      (iph->check); // Convert received checksum to host byte order
-  iph->check = 0;   // Clear the checksum field for calculation
-  uint16_t calc_ip_chk =
-      Network::checksum(reinterpret_cast<unsigned short *>(iph), iphdrlen);
-
-  iph->check =
-      (recv_ip_chk); // Restore the original checksum in network byte order
-  bool ip_chk_match = (recv_ip_chk == calc_ip_chk);
-  /*--------------------------------------------------------------*/
-
-  // If either checksum don't match -> log
-  if (!tcp_chk_match || !ip_chk_match) {
-    std::cout << "\tPacket checksums don't match, malformed" << std::endl;
-    std::cout << "\tip->" << recv_ip_chk << ":" << calc_ip_chk << std::endl;
-    std::cout << "\ttcp->" << recv_tcp_chk << ":" << calc_tcp_chk << std::endl;
-  }
+/**
+ * @brief Check ip header, tcp header and ip total length against the
+ * buffer, anything malformed leaves the view invalid
+ */
+Network::PacketView::PacketView(unsigned char *data, size_t size)
+    : data(data) {
+  if (data == nullptr || size < sizeof(struct iphdr))
+    return;
+  const struct iphdr *iph = reinterpret_cast<const struct iphdr *>(data);
+  size_t ip_len = iph->ihl * 4;
+  if (ip_len < sizeof(struct iphdr) || size < ip_len + sizeof(struct tcphdr))
+    return;
+  const struct tcphdr *tcph =
+      reinterpret_cast<const struct tcphdr *>(data + ip_len);
+  size_t tcp_len = tcph->doff * 4;
+  size_t total = ntohs(iph->tot_len);
+  // truncated capture, view what was received
+  if (total > size)
+    total = size;
+  if (tcp_len < sizeof(struct tcphdr) || total < ip_len + tcp_len)
+    return;
+  iphdrlen = static_cast<uint16_t>(ip_len);
+  tcphdrlen = static_cast<uint16_t>(tcp_len);
+  payload_len = total - ip_len - tcp_len;
+}
+
+Network::PacketView::PacketView(const Packet &packet)
+    : PacketView(packet.data.get(), packet.size) {}
 
-  std::cout << "\tSYN: " << syn << std::endl;
-  std::cout << "\tSEQ: " << *seq << std::endl;
-  std::cout << "\tACK: " << *ack << std::endl << std::endl;
+std::string_view Network::PacketView::options() const {
+  if (!valid())
+    return {};
+  return std::string_view(
+      reinterpret_cast<const char *>(data) + iphdrlen + sizeof(struct tcphdr),
+      tcphdrlen - sizeof(struct tcphdr));
 }
 
-// calculate checksum
-unsigned short Network::checksum(void *buffer, unsigned len) {
-  // credits: Addison Wesley: UNIX Network Programming
-  unsigned short *buf = (unsigned short *)buffer;
-  unsigned int sum = 0;
-  unsigned short result;
+std::string_view Network::PacketView::payload() const {
+  if (!valid())
+    return {};
+  return std::string_view(
+      reinterpret_cast<const char *>(data) + iphdrlen + tcphdrlen,
+      payload_len);
+}
 
-  for (sum = 0; len > 1; len -= 2)
-    sum += *buf++;
+struct sockaddr_in Network::PacketView::source() const {
+  struct sockaddr_in source;
+  memset(&source, 0, sizeof(source));
+  source.sin_family = AF_INET;
+  source.sin_port = tcp()->source;
+  source.sin_addr.s_addr = ip()->saddr;
+  return source;
+}
 
-  if (len == 1)
-    sum += ((*buf) & htons(0xFF00));
+/**
+ * @brief Sum over a region including its stored checksum folds to zero
+ * when the checksum is right, so nothing is cleared or copied
+ */
+bool Network::PacketView::checksums_valid() const {
+  if (!valid())
+    return false;
+  bool ip_ok = Network::checksum(data, iphdrlen) == 0;
+  bool tcp_ok = Network::tcp_checksum(ip(), tcp(), tcphdrlen + payload_len) == 0;
+  return ip_ok && tcp_ok;
+}
 
-  while (sum >> 16) {
-    sum = (sum & 0xffff) + (sum >> 16);
+/**
+ * @brief Write source address to passed source param
+ * check flags and sequences numbers
+ * verify checksums over the received buffer
+ * log into console, payload is available through returned view
+ */
+Network::PacketView Network::parse_packet(const Packet &packet, uint32_t *seq,
+                                          uint32_t *ack,
+                                          struct sockaddr_in &source,
+                                          tcp_options *options) {
+  PacketView view(packet);
+  if (!view.valid()) {
+    metric::malformed.add();
+    LOG_WARN("malformed packet, {} bytes", packet.size);
+    return view;
   }
-  sum = ~sum;
-  return ((unsigned short)sum);
+  /*------------------------- READ PACKET -------------------------*/
+  source.sin_port = view.tcp()->source;
+  source.sin_addr.s_addr = view.ip()->saddr;
+  *seq = view.seq();
+  *ack = view.ack_seq();
+  if (options)
+    *options = parse_options(view.options());
+  /*---------------------------------------------------------------*/
+
+  /*---------------------- COMPARE CHECKSUMS ---------------------*/
+  if (!view.checksums_valid()) {
+    metric::checksum_failures.add();
+    LOG_WARN("packet from {}: checksums don't match, malformed",
+             log_addr(source));
+  }
+
+  LOG_DEBUG("source address: {} SYN: {} SEQ: {} ACK: {}", log_addr(source),
+            view.tcp()->syn, *seq, *ack);
+  return view;
+}
+
+/**
+ * @brief RFC 1624 eqn. 3: HC' = ~(~HC + ~m + m')
+ * all values as they are laid out in the packet (network byte order)
+ */
+uint16_t Network::checksum_update16(uint16_t check, uint16_t old_val,
+                                    uint16_t new_val) {
+  uint32_t sum = static_cast<uint16_t>(~check);
+  sum += static_cast<uint16_t>(~old_val);
+  sum += new_val;
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return static_cast<uint16_t>(~sum);
+}
+
+uint16_t Network::checksum_update32(uint16_t check, uint32_t old_val,
+                                    uint32_t new_val) {
+  check = checksum_update16(check, old_val & 0xffff, new_val & 0xffff);
+  return checksum_update16(check, old_val >> 16, new_val >> 16);
+}
+
+/**
+ * @brief Addresses are covered by both ip header and tcp pseudo header
+ * checksums, ports by tcp checksum only. O(header) instead of re-summing
+ * the whole segment
+ */
+void Network::rewrite_header(struct iphdr *iph, struct tcphdr *tcph,
+                             uint32_t saddr, uint32_t daddr, uint16_t sport,
+                             uint16_t dport) {
+  uint16_t ipchk = iph->check;
+  uint16_t tcpchk = tcph->check;
+
+  ipchk = checksum_update32(ipchk, iph->saddr, saddr);
+  ipchk = checksum_update32(ipchk, iph->daddr, daddr);
+  tcpchk = checksum_update32(tcpchk, iph->saddr, saddr);
+  tcpchk = checksum_update32(tcpchk, iph->daddr, daddr);
+  tcpchk = checksum_update16(tcpchk, tcph->source, sport);
+  tcpchk = checksum_update16(tcpchk, tcph->dest, dport);
+
+  iph->saddr = saddr;
+  iph->daddr = daddr;
+  tcph->source = sport;
+  tcph->dest = dport;
+  iph->check = ipchk;
+  tcph->check = tcpchk;
+}
+
+/**
+ * @brief Replace payload from offset till its end with len bytes of data.
+ * Only the edited region is summed: old bytes are taken out of the tcp
+ * checksum, new ones added (a region starting at odd offset contributes
+ * byte-swapped). Changed lengths are patched into ip total length and
+ * pseudo header tcp length the same incremental way. Packet left
+ * untouched if the result wouldn't fit capacity
+ */
+size_t Network::rewrite_payload(unsigned char *packet, size_t capacity,
+                                size_t offset, const void *data, size_t len) {
+  struct iphdr *iph = reinterpret_cast<struct iphdr *>(packet);
+  unsigned short iphdrlen = iph->ihl * 4;
+  struct tcphdr *tcph = reinterpret_cast<struct tcphdr *>(packet + iphdrlen);
+  unsigned short tcphdrlen = tcph->doff * 4;
+  unsigned char *payload = packet + iphdrlen + tcphdrlen;
+  size_t old_total = ntohs(iph->tot_len);
+  size_t old_size = old_total - (iphdrlen + tcphdrlen);
+  if (offset > old_size)
+    offset = old_size;
+  if (iphdrlen + tcphdrlen + offset + len > capacity)
+    return 0;
+
+  auto region_sum = [offset](const unsigned char *region, size_t size) {
+    uint16_t sum = static_cast<uint16_t>(
+        ~Network::checksum(const_cast<unsigned char *>(region), size));
+    return (offset & 1) ? static_cast<uint16_t>((sum << 8) | (sum >> 8))
+                        : sum;
+  };
+  uint16_t tcpchk = tcph->check;
+  tcpchk = checksum_update16(tcpchk, region_sum(payload + offset,
+                                                old_size - offset),
+                             0);
+  memcpy(payload + offset, data, len);
+  tcpchk = checksum_update16(tcpchk, 0, region_sum(payload + offset, len));
+
+  size_t new_total = iphdrlen + tcphdrlen + offset + len;
+  tcpchk = checksum_update16(tcpchk, htons(old_total - iphdrlen),
+                             htons(new_total - iphdrlen));
+  iph->check = checksum_update16(iph->check, htons(old_total),
+                                 htons(new_total));
+  iph->tot_len = htons(new_total);
+  tcph->check = tcpchk;
+  return new_total;
 }
 
 // Receive and parse SYN
-bool Network::listen_client(int &server_sockfd, int numcl,
-                            struct sockaddr_in &server_addr,
-                            std::vector<struct sockaddr_in> &clients) {
-  std::cout << "\n\nListening for incoming connection..." << std::endl;
-  auto syn_req = std::make_unique<unsigned char[]>(REQUEST_SIZE);
+bool Network::listen_client(PacketQueue &backlog, struct sockaddr_in &client,
+                            tcp_options &options) {
+  Packet syn_req;
+  PacketView view;
   uint32_t seq_num, ack_num;
-  struct iphdr *ip_header;
-  struct tcphdr *tcp_header;
   bool syn = false;
 
-  sockaddr_in client;
-  memset(&client, 0, sizeof(client));
-  clients.push_back(client);
-
-  // TODO: Define the duration for which the loop should run
   do {
-    // here by default we're receiving all packets designated to us
-    ssize_t bytes_recv = Network::receive_packet(server_sockfd, syn_req.get(),
-                                                 REQUEST_SIZE, server_addr);
+    // backlog holds packets designated to us that belong to no connection
+    syn_req = backlog.pop();
     // and here we check if it's a new client
-    // or just communication on another  thread
-    ip_header = reinterpret_cast<struct iphdr *>(syn_req.get());
-    tcp_header = reinterpret_cast<struct tcphdr *>(
-        (reinterpret_cast<char *>(syn_req.get()) + (ip_header->ihl * 4)));
-    // check if source port is equal to already known client
-    syn = (tcp_header->syn);
+    view = PacketView(syn_req);
+    syn = view.valid() && view.tcp()->syn;
   } while (!syn);
 
-  std::cout << "\n\nSYN-RECEIVED:" << syn << std::endl;
-
   // Parse packet to acknowledge new client adress
-  clients.back().sin_port = (tcp_header->source);
-  clients.back().sin_addr.s_addr = (ip_header->saddr);
+  client = view.source();
+  LOG_INFO("SYN-RECEIVED from {}", log_addr(client));
 
   //  Parse packet contents
-  Network::parse_packet(syn_req, &seq_num, &ack_num, clients.back());
+  Network::parse_packet(syn_req, &seq_num, &ack_num, client, &options);
   return true;
 }
 
+/**
+ * @brief Nothing is logged per SYN, just its options read, its cookie
+ * computed and sent back: a SYN flood costs one hash and one send per
+ * packet. ACK numbers minus one give client's ISN and the cookie to check;
+ * any ACK segment qualifies (as in Linux), so a first request whose bare
+ * ACK got lost still establishes the connection and is handed back
+ */
+bool Network::listen_stateless(int &server_sockfd, PacketQueue &backlog,
+                               struct sockaddr_in &server_addr,
+                               const SynCookies &cookies,
+                               struct sockaddr_in &client, tcp_options &syn,
+                               Packet &data) {
+  unsigned char ACK[REQUEST_SIZE];
+  for (;;) {
+    Packet packet = backlog.pop();
+    PacketView view(packet);
+    if (!view.valid())
+      continue;
+    flow_key key = packet_flow_key(packet.data.get());
+    struct sockaddr_in peer = view.source();
+    if (view.tcp()->syn) {
+      tcp_options options = parse_options(view.options());
+      size_t packet_size = build_packet<syn_layout>(
+          ACK, sizeof(ACK), &server_addr, &peer,
+          cookies.make(key, view.seq(), options.mss), view.seq() + 1,
+          TH_SYN | TH_ACK, SynCookies::answer(options), TCP_WINDOW_MAX,
+          nullptr, 0);
+      send_packet(server_sockfd, ACK, packet_size, peer);
+      continue;
+    }
+    if (view.tcp()->ack &&
+        cookies.check(key, view.seq() - 1, view.ack_seq() - 1) &&
+        view.checksums_valid()) {
+      client = peer;
+      syn = SynCookies::restore(view.ack_seq() - 1,
+                                parse_options(view.options()));
+      LOG_INFO("ESTABLISHED with {} (SYN cookie)", log_addr(client));
+      if (!view.payload().empty())
+        data = std::move(packet);
+      return true;
+    }
+  }
+}
+
 // Send SYN wait for SYN-ACK
 bool Network::connect_to_server(int &client_sockfd,
                                 struct sockaddr_in &client_addr,
                                 struct sockaddr_in &server_addr, const char *ip,
                                 int port, uint32_t *seq_num,
-                                uint32_t *ack_num) {
+                                uint32_t *ack_num, tcp_session &session) {
   //  Set server's ip and port number
   memset(&server_addr, 0, sizeof(server_addr));
   server_addr.sin_family = AF_INET;
@@ -534,70 +762,108 @@ bool Network::connect_to_server(int &client_sockfd,
     return -1;
   }
   std::cout << "\n\nConnection adress: " << ip << ":" << port << std::endl;
-  // Try to connect to server
-  // TODO: send SYN until received SYN-ACK or TIMEOUT
-  //  sleep_for = 5; // in seconds
-  std::unique_ptr<unsigned char[]> SYN;
-  auto response = std::make_unique<unsigned char[]>(REQUEST_SIZE);
-  int packet_size{0};
-  Network::create_syn_packet(&client_addr, &server_addr, SYN, &packet_size);
-
-  Network::send_packet(client_sockfd, SYN.get(), packet_size, server_addr);
-  packet_size = 0;
-
-  std::cout << "\n\nSYN-SENT" << std::endl;
-
-  Network::receive_packet(client_sockfd, response.get(), DATAGRAM_SIZE,
-                          client_addr);
-  std::cout << "\n\nESTABLISHED:" << std::endl;
-  Network::parse_packet(response, seq_num, ack_num, server_addr);
-
-  std::unique_ptr<unsigned char[]> ACK;
+  // only the server's packets to our port wake us up
+  if (!attach_port_filter(client_sockfd, ntohs(client_addr.sin_port),
+                          {server_addr}))
+    return false;
+  unsigned char SYN[REQUEST_SIZE];
+  Packet response;
+  response.data = Network::BufferPool::instance().acquire();
+  size_t packet_size = Network::build_packet<syn_layout>(
+      SYN, sizeof(SYN), &client_addr, &server_addr, 100, 0, TH_SYN,
+      tcp_session::offer(), TCP_WINDOW_MAX, nullptr, 0);
+
+  // send SYN until answered, waiting twice as long every time
+  RttEstimator rtt;
+  bool answered = false;
+  for (int sent = 0; !answered && sent <= RETRIES_MAX; ++sent) {
+    if (sent > 0) {
+      std::cout << "no answer in " << rtt.rto_ms() << " ms, resending SYN"
+                << std::endl;
+      rtt.backoff();
+    }
+    Network::send_packet(client_sockfd, SYN, packet_size, server_addr);
+    std::cout << "\n\nSYN-SENT" << std::endl;
+    struct pollfd pfd {};
+    pfd.fd = client_sockfd;
+    pfd.events = POLLIN;
+    answered = poll(&pfd, 1, rtt.rto_ms()) > 0;
+  }
+  if (!answered) {
+    std::cerr << "server didn't answer " << RETRIES_MAX + 1 << " SYNs"
+              << std::endl;
+    return false;
+  }
 
-  Network::create_ack_packet(&client_addr, &server_addr, 101, 201, ACK,
-                             &packet_size);
-  Network::send_packet(client_sockfd, ACK.get(), packet_size, server_addr);
+  ssize_t received = Network::receive_packet(
+      client_sockfd, response.data.get(), DATAGRAM_SIZE, client_addr);
+  if (received < 0)
+    return false;
+  response.size = received;
+  tcp_options syn_ack;
+  uint32_t server_isn, acked;
+  Network::parse_packet(response, &server_isn, &acked, server_addr, &syn_ack);
+  session.negotiate(syn_ack);
+  std::cout << "\n\nESTABLISHED: mss " << session.mss << ", window scale "
+            << +session.snd_wscale << "/" << +session.rcv_wscale
+            << (session.timestamps ? ", timestamps" : "") << std::endl;
+
+  // acknowledges server's sequence number, whatever it picked (cookie),
+  // echoes its TSval (cookie mode restores window scale from it)
+  unsigned char ACK[REQUEST_SIZE];
+  packet_size = Network::build_segment(ACK, sizeof(ACK), &client_addr,
+                                       &server_addr, 101, server_isn + 1,
+                                       TH_ACK, session, nullptr, 0);
+  Network::send_packet(client_sockfd, ACK, packet_size, server_addr);
+  // first request goes out as seq 101 acknowledging server's SYN, the
+  // numbers a cookie is checked with, should this ACK get lost
+  *seq_num = 100;
+  *ack_num = server_isn + 1;
   return true;
 }
 
 // Send SYN-ACK
-int Network::accept_connection(int &server_sockfd,
+void Network::answer_syn(int &server_sockfd, struct sockaddr_in &server_addr,
+                         struct sockaddr_in &client, const tcp_options &syn) {
+  unsigned char ACK[REQUEST_SIZE];
+  size_t packet_size = Network::build_packet<syn_layout>(
+      ACK, sizeof(ACK), &server_addr, &client, 200, 101, TH_SYN | TH_ACK,
+      tcp_session::offer(&syn), TCP_WINDOW_MAX, nullptr, 0);
+  Network::send_packet(server_sockfd, ACK, packet_size, client);
+  LOG_INFO("SYN-ACK to {}", log_addr(client));
+}
+
+int Network::accept_connection(int &server_sockfd, PacketQueue &flow,
                                struct sockaddr_in &server_addr,
-                               std::vector<struct sockaddr_in> &clients) {
-  // send ACK packet
-  std::unique_ptr<unsigned char[]> ACK;
-  int packet_size{0};
+                               struct sockaddr_in &client,
+                               const tcp_options &syn, bool answered) {
   uint32_t seq_num, ack_num;
-  struct iphdr *ip_header;
-  struct tcphdr *tcp_header;
-  int src_port{0};
-  uint32_t src_ack;
-  Network::create_ack_packet(&server_addr, &clients.back(), 200, 101, ACK,
-                             &packet_size);
-
-  /*char source_ip[INET_ADDRSTRLEN];
-  inet_ntop(AF_INET, &(client_addr.sin_addr), source_ip, INET_ADDRSTRLEN);
-  std::cout << "\n\nclient address: " << source_ip << ":"
-            << ntohs(client_addr.sin_port) << std::endl;*/
-
-  Network::send_packet(server_sockfd, ACK.get(), packet_size, clients.back());
-  std::cout << "\n\nSYN-ACK " << std::endl;
-
-  auto established = std::make_unique<unsigned char[]>(REQUEST_SIZE);
-
-  do {
-    Network::receive_packet(server_sockfd, established.get(), REQUEST_SIZE,
-                            server_addr);
-    ip_header = reinterpret_cast<struct iphdr *>(established.get());
-    tcp_header = reinterpret_cast<struct tcphdr *>(
-        (reinterpret_cast<char *>(established.get() + ip_header->ihl * 4)));
-
-    src_port = tcp_header->source;
-    src_ack = tcp_header->ack;
-  } while (src_ack != 1);
+  bool src_ack = false;
+  Packet established;
+  RttEstimator rtt;
+
+  // only this client's packets are routed to flow, SYN ACK is resent
+  // whenever nothing came for RTO (client's SYN is resent as well)
+  for (int sent = 0; !src_ack; ++sent) {
+    if (sent > RETRIES_MAX) {
+      LOG_WARN("no ACK from {}, giving up", log_addr(client));
+      return false;
+    }
+    if (sent > 0)
+      rtt.backoff();
+    if (sent > 0 || !answered)
+      answer_syn(server_sockfd, server_addr, client, syn);
+    uint64_t deadline = Metrics::now() + rtt.rto;
+    uint64_t now;
+    while (!src_ack && (now = Metrics::now()) < deadline &&
+           flow.pop_for(established, (deadline - now) / 1000000 + 1)) {
+      PacketView view(established);
+      src_ack = view.valid() && view.tcp()->ack;
+    }
+  }
 
-  std::cout << "\n\nESTABLISHED: " << std::endl;
-  Network::parse_packet(established, &seq_num, &ack_num, clients.back());
+  Network::parse_packet(established, &seq_num, &ack_num, client);
+  LOG_INFO("ESTABLISHED with {}", log_addr(client));
   return true;
 }
 
@@ -607,8 +873,11 @@ ssize_t Network::send_packet(int sockfd, void *packet, size_t packet_len,
                               reinterpret_cast<struct sockaddr *>(&dest),
                               sizeof(struct sockaddr_in));
   if (bytes_sent < 0) {
-    std::cerr << "Error sending  packet: " << strerror(errno) << std::endl;
+    LOG_ERROR("sending packet failed: {}", strerror(errno));
+    return bytes_sent;
   }
+  metric::packets_out.add();
+  metric::bytes_out.add(bytes_sent);
   return bytes_sent;
 }
 
@@ -625,19 +894,106 @@ ssize_t Network::receive_packet(int sockfd, void *buffer, size_t buffer_len,
   do {
     bytes_recv = recvfrom(sockfd, buffer, buffer_len, 0, NULL, NULL);
     if (bytes_recv < 0) {
-      std::cerr << "Error receiving packet: " << strerror(errno) << std::endl;
+      LOG_ERROR("receiving packet failed: {}", strerror(errno));
       return -1;
     }
+    metric::packets_in.add();
+    metric::bytes_in.add(bytes_recv);
 
     ip_header = reinterpret_cast<struct iphdr *>(buffer);
     tcp_header = reinterpret_cast<struct tcphdr *>(
         (reinterpret_cast<char *>(buffer)) + (ip_header->ihl * 4));
     dst_port = ntohs(tcp_header->dest);
-
+    if (dst_port != ntohs(dest.sin_port))
+      metric::filtered_out.add();
   } while (dst_port != ntohs(dest.sin_port));
   return bytes_recv;
 }
 
+/**
+ * @brief One kernel crossing for a burst of packets.
+ * MSG_WAITFORONE (default) blocks for the first packet only,
+ * then returns whatever else is already queued
+ */
+int Network::receive_batch(int sockfd, unsigned char **buffers,
+                           size_t buffer_len, size_t *lengths,
+                           struct sockaddr_in *sources, unsigned count,
+                           int flags) {
+  struct mmsghdr msgs[BATCH_SIZE];
+  struct iovec iovecs[BATCH_SIZE];
+  if (count > BATCH_SIZE)
+    count = BATCH_SIZE;
+  memset(msgs, 0, sizeof(struct mmsghdr) * count);
+  for (unsigned i = 0; i < count; ++i) {
+    iovecs[i].iov_base = buffers[i];
+    iovecs[i].iov_len = buffer_len;
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    if (sources) {
+      msgs[i].msg_hdr.msg_name = &sources[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+  }
+  int received = recvmmsg(sockfd, msgs, count, flags, nullptr);
+  if (received < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+      LOG_ERROR("receiving packets failed: {}", strerror(errno));
+    return -1;
+  }
+  size_t bytes = 0;
+  for (int i = 0; i < received; ++i)
+    bytes += lengths[i] = msgs[i].msg_len;
+  metric::packets_in.add(received);
+  metric::bytes_in.add(bytes);
+  return received;
+}
+
+int Network::send_batch(int sockfd, unsigned char **packets,
+                        const size_t *lengths, struct sockaddr_in *dests,
+                        unsigned count) {
+  struct mmsghdr msgs[BATCH_SIZE];
+  struct iovec iovecs[BATCH_SIZE];
+  unsigned sent = 0;
+  while (sent < count) {
+    unsigned chunk = std::min<unsigned>(count - sent, BATCH_SIZE);
+    memset(msgs, 0, sizeof(struct mmsghdr) * chunk);
+    for (unsigned i = 0; i < chunk; ++i) {
+      iovecs[i].iov_base = packets[sent + i];
+      iovecs[i].iov_len = lengths[sent + i];
+      msgs[i].msg_hdr.msg_iov = &iovecs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &dests[sent + i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
+    int n = sendmmsg(sockfd, msgs, chunk, 0);
+    if (n <= 0) {
+      LOG_ERROR("sending packets failed: {}", strerror(errno));
+      break;
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < n; ++i)
+      bytes += msgs[i].msg_len;
+    metric::packets_out.add(n);
+    metric::bytes_out.add(bytes);
+    sent += n;
+  }
+  return sent;
+}
+
+bool Network::attach_drop_filter(int sockfd) {
+  struct sock_filter drop_all = BPF_STMT(BPF_RET | BPF_K, 0);
+  struct sock_fprog fprog;
+  fprog.len = 1;
+  fprog.filter = &drop_all;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog,
+                 sizeof(fprog)) < 0) {
+    std::cerr << "setsockopt(SO_ATTACH_FILTER) failed " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
 void Network::close_socket(int socket_fd) {
   close(socket_fd);
   // std::cout << "Socket was closed" << std::endl;
@@ -0,0 +1,172 @@
+#include "../include/packet_ring.hpp"
+#include "../include/metrics.hpp"
+#include <linux/if_ether.h> // for ETH_P_IP
+#include <net/if.h>         // for if_nametoindex
+#include <poll.h>
+#include <sys/mman.h>
+
+Network::PacketRing::~PacketRing() {
+  if (map)
+    munmap(map, map_size);
+  if (sockfd >= 0)
+    Network::close_socket(sockfd);
+}
+
+/**
+ * @brief Create AF_PACKET,SOCK_DGRAM socket (packet data starts at ip
+ * header, same as on raw socket, so the port filter applies as is)
+ * switch it to TPACKET_V3, set up and map the block ring
+ * bind to interface
+ */
+bool Network::PacketRing::open(const char *ifname, int port) {
+  unsigned ifindex = if_nametoindex(ifname);
+  if (ifindex == 0) {
+    std::cerr << "Error: Unknown interface " << ifname << std::endl;
+    return false;
+  }
+  sockfd = Network::create_socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+  if (sockfd < 0)
+    return false;
+  if (!Network::attach_port_filter(sockfd, port))
+    return false;
+
+  int version = TPACKET_V3;
+  if (setsockopt(sockfd, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) < 0) {
+    std::cerr << "setsockopt(PACKET_VERSION) failed " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  struct tpacket_req3 req;
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size = RING_BLOCK_SIZE;
+  req.tp_block_nr = RING_BLOCK_NR;
+  req.tp_frame_size = RING_FRAME_SIZE;
+  req.tp_frame_nr = (RING_BLOCK_SIZE * RING_BLOCK_NR) / RING_FRAME_SIZE;
+  req.tp_retire_blk_tov = RING_RETIRE_TOV;
+  req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+  if (setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+    std::cerr << "setsockopt(PACKET_RX_RING) failed " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  map_size = static_cast<size_t>(RING_BLOCK_SIZE) * RING_BLOCK_NR;
+  void *ring = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, sockfd, 0);
+  if (ring == MAP_FAILED) {
+    std::cerr << "Error: Failed to map packet ring " << strerror(errno)
+              << std::endl;
+    map_size = 0;
+    return false;
+  }
+  map = static_cast<unsigned char *>(ring);
+  refs.reset(new std::atomic<unsigned>[RING_BLOCK_NR]());
+
+  struct sockaddr_ll ll;
+  memset(&ll, 0, sizeof(ll));
+  ll.sll_family = AF_PACKET;
+  ll.sll_protocol = htons(ETH_P_IP);
+  ll.sll_ifindex = ifindex;
+  if (bind(sockfd, reinterpret_cast<struct sockaddr *>(&ll), sizeof(ll)) < 0) {
+    std::cerr << "Error: Failed to bind packet ring " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  std::cout << "\n\nPacket ring on " << ifname << ": " << RING_BLOCK_NR
+            << " x " << RING_BLOCK_SIZE << " bytes" << std::endl;
+  return true;
+}
+
+bool Network::PacketRing::join_fanout(uint16_t group) {
+  int fanout = group | (PACKET_FANOUT_HASH << 16);
+  if (setsockopt(sockfd, SOL_PACKET, PACKET_FANOUT, &fanout,
+                 sizeof(fanout)) < 0) {
+    std::cerr << "setsockopt(PACKET_FANOUT) failed " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int Network::PacketRing::fd() const { return sockfd; }
+
+struct tpacket_block_desc *Network::PacketRing::block(unsigned index) const {
+  return reinterpret_cast<struct tpacket_block_desc *>(
+      map + static_cast<size_t>(index) * RING_BLOCK_SIZE);
+}
+
+/**
+ * @brief Drop one reference of block, last one hands it back to the kernel
+ */
+void Network::PacketRing::put_block(unsigned index) {
+  if (refs[index].fetch_sub(1, std::memory_order_acq_rel) == 1)
+    __atomic_store_n(&block(index)->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+}
+
+void Network::PacketRing::release(const unsigned char *data) {
+  put_block(static_cast<unsigned>((data - map) / RING_BLOCK_SIZE));
+}
+
+/**
+ * @brief Walk ring blocks owned by user space, hand out views of
+ * incoming packets (on lo every packet shows up once more as outgoing,
+ * those are skipped). Wait for the kernel only if nothing was found yet.
+ * A block is only taken once its previous views are all released
+ */
+int Network::PacketRing::receive(Packet *out, int max, int timeout_ms) {
+  int count = 0;
+  while (count < max) {
+    if (remaining == 0) {
+      if (next) {
+        // reader is done with the block
+        next = nullptr;
+        put_block(current);
+        current = (current + 1) % RING_BLOCK_NR;
+      }
+      struct tpacket_block_desc *bd = block(current);
+      if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+            TP_STATUS_USER)) {
+        if (count > 0 || timeout_ms == 0)
+          break;
+        struct pollfd pfd {};
+        pfd.fd = sockfd;
+        pfd.events = POLLIN | POLLERR;
+        poll(&pfd, 1, timeout_ms);
+        timeout_ms = 0;
+        continue;
+      }
+      // wrapped around to a block whose views are still held: it was
+      // never handed back, so it is not new data. Stop until released
+      if (refs[current].load(std::memory_order_acquire) != 0)
+        break;
+      refs[current].store(1, std::memory_order_relaxed);
+      remaining = bd->hdr.bh1.num_pkts;
+      next = reinterpret_cast<struct tpacket3_hdr *>(
+          reinterpret_cast<unsigned char *>(bd) +
+          bd->hdr.bh1.offset_to_first_pkt);
+      continue;
+    }
+
+    struct tpacket3_hdr *hdr = next;
+    remaining--;
+    next = reinterpret_cast<struct tpacket3_hdr *>(
+        reinterpret_cast<unsigned char *>(hdr) + hdr->tp_next_offset);
+    const struct sockaddr_ll *ll = reinterpret_cast<const struct sockaddr_ll *>(
+        reinterpret_cast<unsigned char *>(hdr) +
+        TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+    if (ll->sll_pkttype == PACKET_OUTGOING)
+      continue;
+
+    refs[current].fetch_add(1, std::memory_order_relaxed);
+    out[count].data = packet_ptr(
+        reinterpret_cast<unsigned char *>(hdr) + hdr->tp_net,
+        packet_release(this));
+    out[count].size = hdr->tp_snaplen;
+    metric::bytes_in.add(hdr->tp_snaplen);
+    count++;
+  }
+  metric::packets_in.add(count);
+  return count;
+}
@@ -0,0 +1,217 @@
+#include "../include/session_table.hpp"
+#include <chrono>
+
+Network::SessionTable::SessionTable(uint16_t first_port, uint16_t count)
+    : first(first_port), count(count), clients(new std::atomic<uint64_t>[count]),
+      states(new std::atomic<State>[count]),
+      seen(new std::atomic<uint32_t>[count]) {
+  // index at most half full with every port taken
+  size_t slots = 1;
+  while (slots < 2 * static_cast<size_t>(count))
+    slots <<= 1;
+  mask = slots - 1;
+  for (auto &buffer : buffers) {
+    buffer.reset(new std::atomic<uint64_t>[slots]);
+    for (size_t i = 0; i < slots; ++i)
+      buffer[i].store(EMPTY, std::memory_order_relaxed);
+  }
+  index.store(buffers[0].get(), std::memory_order_release);
+  for (uint16_t offset = 0; offset < count; ++offset) {
+    clients[offset].store(0, std::memory_order_relaxed);
+    states[offset].store(State::Free, std::memory_order_relaxed);
+    seen[offset].store(0, std::memory_order_relaxed);
+    free_ports.push_back(offset);
+  }
+}
+
+// ip << 16 | port, both as they are on the wire (never 0 for a real peer)
+uint64_t Network::SessionTable::pack(const struct sockaddr_in &client) {
+  return (static_cast<uint64_t>(client.sin_addr.s_addr) << 16) |
+         client.sin_port;
+}
+
+size_t Network::SessionTable::hash(uint64_t key) {
+  // murmur3 finalizer, same mix as flow_key_hash
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  key ^= key >> 33;
+  return static_cast<size_t>(key);
+}
+
+uint32_t Network::SessionTable::now() {
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+bool Network::SessionTable::owns(uint16_t port) const {
+  return port >= first && port - first < count;
+}
+
+/**
+ * @brief Probe index for client, confirm hit against clients[]
+ * (index may be a stale buffer, or the port already reused)
+ */
+uint16_t Network::SessionTable::upstream(const struct sockaddr_in &client) const {
+  uint64_t key = pack(client);
+  const std::atomic<uint64_t> *slots = index.load(std::memory_order_acquire);
+  for (size_t i = hash(key) & mask, probes = 0; probes <= mask;
+       i = (i + 1) & mask, ++probes) {
+    uint64_t entry = slots[i].load(std::memory_order_acquire);
+    if (entry == EMPTY)
+      return 0;
+    if (entry != DELETED && entry >> 16 == key) {
+      uint16_t offset = static_cast<uint16_t>(entry);
+      return clients[offset].load(std::memory_order_acquire) == key
+                 ? first + offset
+                 : 0;
+    }
+  }
+  return 0;
+}
+
+bool Network::SessionTable::client(uint16_t port,
+                                   struct sockaddr_in &client) const {
+  if (!owns(port))
+    return false;
+  uint64_t key = clients[port - first].load(std::memory_order_acquire);
+  if (key == 0)
+    return false;
+  memset(&client, 0, sizeof(client));
+  client.sin_family = AF_INET;
+  client.sin_addr.s_addr = static_cast<uint32_t>(key >> 16);
+  client.sin_port = static_cast<uint16_t>(key);
+  return true;
+}
+
+Network::SessionTable::State Network::SessionTable::state(uint16_t port) const {
+  if (!owns(port))
+    return State::Free;
+  return states[port - first].load(std::memory_order_acquire);
+}
+
+bool Network::SessionTable::connected(uint16_t port) {
+  if (!owns(port))
+    return false;
+  State expected = State::Connecting;
+  return states[port - first].compare_exchange_strong(
+      expected, State::Ready, std::memory_order_acq_rel);
+}
+
+void Network::SessionTable::touch(uint16_t port) {
+  if (owns(port))
+    seen[port - first].store(now(), std::memory_order_relaxed);
+}
+
+uint16_t Network::SessionTable::open(const struct sockaddr_in &client,
+                                     bool &created) {
+  created = false;
+  std::unique_lock<std::mutex> lock(writeMutex);
+  if (uint16_t port = upstream(client))
+    return port;
+  if (free_ports.empty())
+    return 0;
+  uint16_t offset = free_ports.front();
+  free_ports.pop_front();
+  uint64_t key = pack(client);
+  // index first: a rebuild inside insert must not see the key yet
+  insert(key, offset);
+  seen[offset].store(now(), std::memory_order_relaxed);
+  states[offset].store(State::Connecting, std::memory_order_relaxed);
+  clients[offset].store(key, std::memory_order_release);
+  live.fetch_add(1, std::memory_order_relaxed);
+  created = true;
+  return first + offset;
+}
+
+void Network::SessionTable::close(uint16_t port) {
+  if (!owns(port))
+    return;
+  std::unique_lock<std::mutex> lock(writeMutex);
+  release(port - first);
+}
+
+size_t Network::SessionTable::expire(uint32_t idle_seconds) {
+  uint32_t cutoff = now() - idle_seconds;
+  size_t expired = 0;
+  std::unique_lock<std::mutex> lock(writeMutex);
+  for (uint16_t offset = 0; offset < count; ++offset) {
+    if (clients[offset].load(std::memory_order_relaxed) != 0 &&
+        static_cast<int32_t>(seen[offset].load(std::memory_order_relaxed) -
+                             cutoff) < 0) {
+      release(offset);
+      expired++;
+    }
+  }
+  return expired;
+}
+
+// Unpublish from index first, then free the port (readers check clients[])
+void Network::SessionTable::release(uint16_t offset) {
+  uint64_t key = clients[offset].load(std::memory_order_relaxed);
+  if (key == 0)
+    return;
+  erase(key);
+  clients[offset].store(0, std::memory_order_release);
+  states[offset].store(State::Free, std::memory_order_release);
+  free_ports.push_back(offset);
+  live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Put key (known to be absent) into the first empty or deleted
+ * slot of its probe sequence, rebuild once slots in use pass 3/4
+ */
+void Network::SessionTable::insert(uint64_t key, uint16_t offset) {
+  if (used + 1 > (mask + 1) / 4 * 3)
+    rebuild();
+  std::atomic<uint64_t> *slots = index.load(std::memory_order_relaxed);
+  for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+    uint64_t entry = slots[i].load(std::memory_order_relaxed);
+    if (entry == EMPTY || entry == DELETED) {
+      if (entry == EMPTY)
+        used++;
+      slots[i].store(key << 16 | offset, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+void Network::SessionTable::erase(uint64_t key) {
+  std::atomic<uint64_t> *slots = index.load(std::memory_order_relaxed);
+  for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+    uint64_t entry = slots[i].load(std::memory_order_relaxed);
+    if (entry == EMPTY)
+      return;
+    if (entry != DELETED && entry >> 16 == key) {
+      slots[i].store(DELETED, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+// Fill the spare buffer with live sessions only and swap it in
+void Network::SessionTable::rebuild() {
+  std::atomic<uint64_t> *current = index.load(std::memory_order_relaxed);
+  std::atomic<uint64_t> *spare =
+      current == buffers[0].get() ? buffers[1].get() : buffers[0].get();
+  for (size_t i = 0; i <= mask; ++i)
+    spare[i].store(EMPTY, std::memory_order_relaxed);
+  used = 0;
+  for (uint16_t offset = 0; offset < count; ++offset) {
+    uint64_t key = clients[offset].load(std::memory_order_relaxed);
+    if (key == 0)
+      continue;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+      if (spare[i].load(std::memory_order_relaxed) == EMPTY) {
+        spare[i].store(key << 16 | offset, std::memory_order_relaxed);
+        used++;
+        break;
+      }
+    }
+  }
+  index.store(spare, std::memory_order_release);
+}
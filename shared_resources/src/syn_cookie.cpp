@@ -0,0 +1,126 @@
+#include "../include/syn_cookie.hpp"
+#include "../include/metrics.hpp"
+#include <random>
+
+#define COOKIE_HASH_BITS 25
+#define COOKIE_HASH_MASK ((1u << COOKIE_HASH_BITS) - 1)
+#define COOKIE_MSS_BITS 2
+#define COOKIE_DATA_BITS (COOKIE_HASH_BITS + COOKIE_MSS_BITS) // under time
+#define TS_WSCALE_NONE 0xf // TSval bits 0-3: window scale
+#define TS_OPTION_MASK 0xf
+
+// MSS a cookie can carry, ascending (Linux' IPv4 table)
+static const uint16_t cookie_mss[1 << COOKIE_MSS_BITS] = {536, 1300, 1440,
+                                                          1460};
+
+Network::SynCookies::SynCookies() {
+  std::random_device random; // getrandom() on Linux
+  for (uint64_t &word : secret)
+    word = (static_cast<uint64_t>(random()) << 32) | random();
+}
+
+uint32_t Network::SynCookies::period_now() {
+  return static_cast<uint32_t>(Metrics::now() /
+                               (COOKIE_PERIOD_S * 1000000000ULL));
+}
+
+uint32_t Network::SynCookies::make(const flow_key &key, uint32_t client_isn,
+                                   uint16_t mss) const {
+  uint32_t period = period_now();
+  uint32_t index = (1 << COOKIE_MSS_BITS) - 1;
+  while (index > 0 && cookie_mss[index] > mss)
+    --index;
+  return (period << COOKIE_DATA_BITS) | (index << COOKIE_HASH_BITS) |
+         hash(key, client_isn, period, index);
+}
+
+// Timestamp is kept mod 32: latest period with those low bits is the one
+bool Network::SynCookies::check(const flow_key &key, uint32_t client_isn,
+                                uint32_t cookie) const {
+  uint32_t now = period_now();
+  uint32_t index = (cookie >> COOKIE_HASH_BITS) & ((1 << COOKIE_MSS_BITS) - 1);
+  for (uint32_t age = 0; age < COOKIE_AGE_MAX && age <= now; ++age) {
+    uint32_t period = now - age;
+    if ((period & (0xffffffffu >> COOKIE_DATA_BITS)) ==
+            cookie >> COOKIE_DATA_BITS &&
+        hash(key, client_isn, period, index) == (cookie & COOKIE_HASH_MASK))
+      return true;
+  }
+  return false;
+}
+
+Network::tcp_options
+Network::SynCookies::answer(const tcp_options &syn) {
+  tcp_options options = tcp_session::offer(&syn);
+  if (!options.timestamps) {
+    options.wscale = -1;
+    return options;
+  }
+  options.tsval = (options.tsval & ~TS_OPTION_MASK) |
+                  (syn.wscale >= 0 ? syn.wscale : TS_WSCALE_NONE);
+  return options;
+}
+
+Network::tcp_options Network::SynCookies::restore(uint32_t cookie,
+                                                  const tcp_options &ack) {
+  tcp_options syn;
+  syn.mss = cookie_mss[(cookie >> COOKIE_HASH_BITS) &
+                       ((1 << COOKIE_MSS_BITS) - 1)];
+  if (!ack.timestamps)
+    return syn;
+  uint32_t wscale = ack.tsecr & TS_WSCALE_NONE;
+  syn.wscale = wscale != TS_WSCALE_NONE ? wscale : -1;
+  syn.timestamps = true;
+  syn.tsval = ack.tsval;
+  return syn;
+}
+
+static inline uint64_t rotl(uint64_t x, int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+static inline void sip_round(uint64_t &v0, uint64_t &v1, uint64_t &v2,
+                             uint64_t &v3) {
+  v0 += v1;
+  v1 = rotl(v1, 13);
+  v1 ^= v0;
+  v0 = rotl(v0, 32);
+  v2 += v3;
+  v3 = rotl(v3, 16);
+  v3 ^= v2;
+  v0 += v3;
+  v3 = rotl(v3, 21);
+  v3 ^= v0;
+  v2 += v1;
+  v1 = rotl(v1, 17);
+  v1 ^= v2;
+  v2 = rotl(v2, 32);
+}
+
+/**
+ * @brief SipHash-2-4 (Aumasson & Bernstein) over 21 bytes: addresses,
+ * ports + ISN, then period and MSS index in the final word with the
+ * length on top
+ */
+uint32_t Network::SynCookies::hash(const flow_key &key, uint32_t client_isn,
+                                   uint32_t period, uint32_t mss_index) const {
+  const uint64_t words[3] = {
+      (static_cast<uint64_t>(key.saddr) << 32) | key.daddr,
+      (static_cast<uint64_t>(key.sport) << 48) |
+          (static_cast<uint64_t>(key.dport) << 32) | client_isn,
+      (21ULL << 56) | (static_cast<uint64_t>(mss_index) << 32) | period};
+  uint64_t v0 = secret[0] ^ 0x736f6d6570736575ULL;
+  uint64_t v1 = secret[1] ^ 0x646f72616e646f6dULL;
+  uint64_t v2 = secret[0] ^ 0x6c7967656e657261ULL;
+  uint64_t v3 = secret[1] ^ 0x7465646279746573ULL;
+  for (uint64_t m : words) {
+    v3 ^= m;
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    v0 ^= m;
+  }
+  v2 ^= 0xff;
+  for (int i = 0; i < 4; ++i)
+    sip_round(v0, v1, v2, v3);
+  return static_cast<uint32_t>(v0 ^ v1 ^ v2 ^ v3) & COOKIE_HASH_MASK;
+}
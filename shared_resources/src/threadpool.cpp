@@ -1,36 +1,312 @@
 #include "../include/threadpool.hpp"
 
-ThreadPool::ThreadPool(int numThr) : stop(false) {
-  for (int i = 0; i < numThr; ++i) {
-    threads.emplace_back([this]() {
-      while (true) {
-        std::function<void()> task;
-        {
-          std::unique_lock<std::mutex> lock(qMutex);
-          cond.wait(lock, [this] { return stop || !tasks.empty(); });
-          if (stop && tasks.empty())
-            return;
-
-          task = std::move(tasks.front());
-          tasks.pop();
-        }
-        task();
-      }
-    });
-  }
-}
-
-void ThreadPool::enqueue(std::function<void()> task) {
+namespace {
+// Worker identity of the calling thread (nullptr on non-worker threads)
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local unsigned current_worker = 0;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#else
+  std::this_thread::yield();
+#endif
+}
+
+inline uint64_t next_random(uint64_t &state) {
+  // xorshift64, picks the first victim to steal from
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+} // namespace
+
+/*---------------------------- WORK DEQUE ----------------------------*/
+
+WorkDeque::WorkDeque() : buffer(new std::atomic<task_node *>[POOL_DEQUE_SIZE]) {}
+
+bool WorkDeque::push(task_node *node) {
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  if (b - t >= POOL_DEQUE_SIZE)
+    return false;
+  buffer[b & (POOL_DEQUE_SIZE - 1)].store(node, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+task_node *WorkDeque::pop() {
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+  if (t > b) {
+    // empty
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  task_node *node = buffer[b & (POOL_DEQUE_SIZE - 1)].load(
+      std::memory_order_relaxed);
+  if (t == b) {
+    // last one, race thieves for it
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      node = nullptr;
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+  return node;
+}
+
+task_node *WorkDeque::steal() {
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
+  if (t >= b)
+    return nullptr;
+  task_node *node = buffer[t & (POOL_DEQUE_SIZE - 1)].load(
+      std::memory_order_relaxed);
+  if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                   std::memory_order_relaxed))
+    return nullptr; // lost to owner or another thief
+  return node;
+}
+
+bool WorkDeque::empty() const {
+  return top.load(std::memory_order_acquire) >=
+         bottom.load(std::memory_order_acquire);
+}
+
+/*--------------------------- INJECT QUEUE ---------------------------*/
+
+InjectQueue::InjectQueue() : cells(new cell[POOL_INJECT_SIZE]) {
+  for (size_t i = 0; i < POOL_INJECT_SIZE; ++i)
+    cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+bool InjectQueue::push(task_node *node) {
+  size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  cell *c;
+  for (;;) {
+    c = &cells[pos & (POOL_INJECT_SIZE - 1)];
+    size_t seq = c->seq.load(std::memory_order_acquire);
+    intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (dif == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return false; // full
+    } else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  c->node = node;
+  c->seq.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+task_node *InjectQueue::pop() {
+  size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+  cell *c;
+  for (;;) {
+    c = &cells[pos & (POOL_INJECT_SIZE - 1)];
+    size_t seq = c->seq.load(std::memory_order_acquire);
+    intptr_t dif =
+        static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+    if (dif == 0) {
+      if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed))
+        break;
+    } else if (dif < 0) {
+      return nullptr; // empty
+    } else {
+      pos = dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+  task_node *node = c->node;
+  c->seq.store(pos + POOL_INJECT_SIZE, std::memory_order_release);
+  return node;
+}
+
+bool InjectQueue::empty() const {
+  return dequeue_pos.load(std::memory_order_acquire) >=
+         enqueue_pos.load(std::memory_order_acquire);
+}
+
+/*---------------------------- THREAD POOL ---------------------------*/
+
+ThreadPool::ThreadPool(int numThr)
+    : numThreads(static_cast<unsigned>(numThr)), deques(new WorkDeque[numThr]),
+      nodes(new task_node[POOL_TASK_NODES]) {
+  maxSearching = std::thread::hardware_concurrency() / 2;
+  spinRounds = maxSearching > 0 ? POOL_SPIN_ROUNDS : 0;
+  // chain every node into the free list
+  for (uint32_t i = 0; i < POOL_TASK_NODES; ++i) {
+    nodes[i].index = i + 1;
+    nodes[i].next_free.store(i + 1 < POOL_TASK_NODES ? i + 2 : 0,
+                             std::memory_order_relaxed);
+  }
+  free_head.store(1, std::memory_order_relaxed);
+  for (int i = 0; i < numThr; ++i)
+    threads.emplace_back([this, i]() { worker(static_cast<unsigned>(i)); });
+}
+
+/**
+ * @brief Pop node off the tagged free list (tag defeats ABA),
+ * heap node if all of them are in flight
+ */
+task_node *ThreadPool::acquire_node() {
+  uint64_t head = free_head.load(std::memory_order_acquire);
+  for (;;) {
+    uint32_t index = static_cast<uint32_t>(head);
+    if (index == 0)
+      return new task_node();
+    uint32_t next = nodes[index - 1].next_free.load(std::memory_order_relaxed);
+    uint64_t tagged = (((head >> 32) + 1) << 32) | next;
+    if (free_head.compare_exchange_weak(head, tagged,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire))
+      return &nodes[index - 1];
+  }
+}
+
+void ThreadPool::release_node(task_node *node) {
+  node->task.reset();
+  if (node->index == 0) {
+    delete node;
+    return;
+  }
+  uint64_t head = free_head.load(std::memory_order_relaxed);
+  for (;;) {
+    node->next_free.store(static_cast<uint32_t>(head),
+                          std::memory_order_relaxed);
+    uint64_t tagged = (((head >> 32) + 1) << 32) | node->index;
+    if (free_head.compare_exchange_weak(head, tagged,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed))
+      return;
+  }
+}
+
+/**
+ * @brief Worker threads push to their own deque, everyone else to the
+ * inject queue (backs off while it is full). Sleeping worker is woken
+ * only if there is one
+ */
+void ThreadPool::submit(Task task) {
+  task_node *node = acquire_node();
+  node->task = std::move(task);
+  if (current_pool != this || !deques[current_worker].push(node)) {
+    while (!injected.push(node))
+      std::this_thread::yield();
+  }
+  // pairs with the fence in park(): either we see the sleeper
+  // (and the end of its search) or it sees the task
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (searching.load(std::memory_order_relaxed) == 0 &&
+      sleepers.load(std::memory_order_relaxed) > 0)
+    wake();
+}
+
+// Hands a wakeup to one parked worker, so a worker that is notified but
+// not running yet is not notified again by every following submit
+void ThreadPool::wake() {
   {
-    std::unique_lock<std::mutex> lock(qMutex);
-    tasks.push(std::move(task));
+    std::unique_lock<std::mutex> lock(parkMutex);
+    if (sleepers.load(std::memory_order_relaxed) == 0)
+      return;
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+    searching.fetch_add(1); // counts as searching until it finds work
+    wakeups++;
   }
   cond.notify_one();
 }
 
+// Own deque first (LIFO, cache warm), then injected, then steal
+task_node *ThreadPool::find_work(unsigned self, uint64_t &seed) {
+  if (task_node *node = deques[self].pop())
+    return node;
+  if (task_node *node = injected.pop())
+    return node;
+  unsigned start = static_cast<unsigned>(next_random(seed) % numThreads);
+  for (unsigned i = 0; i < numThreads; ++i) {
+    unsigned victim = (start + i) % numThreads;
+    if (victim == self)
+      continue;
+    if (task_node *node = deques[victim].steal())
+      return node;
+  }
+  return nullptr;
+}
+
+bool ThreadPool::has_work() const {
+  if (!injected.empty())
+    return true;
+  for (unsigned i = 0; i < numThreads; ++i)
+    if (!deques[i].empty())
+      return true;
+  return false;
+}
+
+bool ThreadPool::park() {
+  std::unique_lock<std::mutex> lock(parkMutex);
+  sleepers.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (has_work() || stop.load(std::memory_order_relaxed)) {
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  cond.wait(lock, [this] {
+    return wakeups > 0 || stop.load(std::memory_order_relaxed);
+  });
+  if (wakeups > 0) {
+    wakeups--; // waker already moved us from sleepers to searching
+    return true;
+  }
+  sleepers.fetch_sub(1, std::memory_order_relaxed);
+  return false;
+}
+
+void ThreadPool::worker(unsigned self) {
+  current_pool = this;
+  current_worker = self;
+  uint64_t seed = 0x9e3779b97f4a7c15ULL * (self + 1);
+  bool searcher = false; // counted in searching
+  for (;;) {
+    task_node *node = find_work(self, seed);
+    if (node == nullptr && !searcher) {
+      searcher = searching.fetch_add(1) < maxSearching;
+      if (!searcher)
+        searching.fetch_sub(1);
+    }
+    for (int round = 0; node == nullptr && searcher && round < spinRounds;
+         ++round) {
+      cpu_relax();
+      node = find_work(self, seed);
+    }
+    if (searcher) {
+      searcher = false;
+      // submit skipped the wakeup while we searched, last searcher
+      // to find work hands the search over to a sleeper
+      if (searching.fetch_sub(1) == 1 && node != nullptr && has_work())
+        wake();
+    }
+    if (node == nullptr) {
+      if (stop.load(std::memory_order_acquire) && !has_work())
+        return;
+      searcher = park();
+      continue;
+    }
+    node->task();
+    release_node(node);
+  }
+}
+
 void ThreadPool::stopped() {
   {
-    std::unique_lock<std::mutex> lock(qMutex);
+    std::unique_lock<std::mutex> lock(parkMutex);
     stop = true;
   }
   cond.notify_all();
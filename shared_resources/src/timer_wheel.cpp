@@ -0,0 +1,143 @@
+#include "../include/timer_wheel.hpp"
+#include <algorithm>
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) // ticks ahead
+
+Network::Timer::~Timer() {
+  if (wheel)
+    wheel->cancel(*this);
+}
+
+Network::TimerWheel::TimerWheel(uint64_t now_ns) : start_ns(now_ns) {}
+
+// Timers outliving the wheel are just left unarmed
+Network::TimerWheel::~TimerWheel() {
+  for (auto &level : slots)
+    for (Timer &head : level)
+      while (head.next != &head)
+        unlink(*head.next);
+}
+
+void Network::TimerWheel::arm(Timer &timer, uint64_t delay_ns) {
+  if (timer.wheel)
+    timer.wheel->unlink(timer);
+  uint64_t ticks = (delay_ns + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+  timer.expires = current + std::min<uint64_t>(std::max<uint64_t>(ticks, 1),
+                                               WHEEL_SPAN - 1);
+  place(timer);
+}
+
+void Network::TimerWheel::cancel(Timer &timer) {
+  if (timer.wheel == this)
+    unlink(timer);
+}
+
+/**
+ * @brief Lowest level whose span still covers expiry, slot by the
+ * expiry's digit (base 256) of that level
+ */
+void Network::TimerWheel::place(Timer &timer) {
+  uint64_t delta = timer.expires - current;
+  unsigned level = 0;
+  while (level + 1 < WHEEL_LEVELS &&
+         delta >= (1ULL << (WHEEL_BITS * (level + 1))))
+    ++level;
+  Timer &head =
+      slots[level][(timer.expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+  timer.prev = head.prev;
+  timer.next = &head;
+  head.prev->next = &timer;
+  head.prev = &timer;
+  timer.wheel = this;
+  ++count;
+}
+
+void Network::TimerWheel::unlink(Timer &timer) {
+  timer.prev->next = timer.next;
+  timer.next->prev = timer.prev;
+  timer.prev = timer.next = &timer;
+  timer.wheel = nullptr;
+  --count;
+}
+
+// Slot of an upper level came around: its timers move closer to expiry
+void Network::TimerWheel::cascade(unsigned level, unsigned slot) {
+  Timer &head = slots[level][slot];
+  while (head.next != &head) {
+    Timer &timer = *head.next;
+    unlink(timer);
+    place(timer);
+  }
+}
+
+size_t Network::TimerWheel::advance(uint64_t now_ns) {
+  if (now_ns < start_ns)
+    return 0;
+  uint64_t target = (now_ns - start_ns) / WHEEL_TICK_NS;
+  if (count == 0) {
+    current = std::max(current, target); // nothing to run on the way
+    return 0;
+  }
+  size_t fired = 0;
+  while (current < target) {
+    ++current;
+    for (unsigned level = 1; level < WHEEL_LEVELS; ++level) {
+      if (current & ((1ULL << (WHEEL_BITS * level)) - 1))
+        break;
+      cascade(level, (current >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    }
+    Timer &head = slots[0][current & WHEEL_MASK];
+    while (head.next != &head) {
+      Timer &timer = *head.next;
+      unlink(timer);
+      std::function<void()> callback = timer.callback;
+      ++fired;
+      if (callback)
+        callback();
+    }
+    if (count == 0) {
+      current = target;
+      break;
+    }
+  }
+  return fired;
+}
+
+/**
+ * @brief Nearest non-empty slot of level 0; with level 0 empty the
+ * next cascade (end of its round) is when anything can come due
+ */
+int Network::TimerWheel::timeout_ms() const {
+  if (count == 0)
+    return -1;
+  uint64_t ticks = WHEEL_SLOTS - (current & WHEEL_MASK);
+  for (uint64_t ahead = 1; ahead < WHEEL_SLOTS; ++ahead) {
+    const Timer &head = slots[0][(current + ahead) & WHEEL_MASK];
+    if (head.next != &head) {
+      ticks = ahead;
+      break;
+    }
+  }
+  uint64_t ms = (ticks * WHEEL_TICK_NS + 999999) / 1000000;
+  return static_cast<int>(std::min<uint64_t>(ms, RTO_MAX_MS));
+}
+
+/*-------------------------- RTO ESTIMATION --------------------------*/
+
+void Network::RttEstimator::sample(uint64_t rtt_ns) {
+  if (srtt == 0) {
+    srtt = rtt_ns;
+    rttvar = rtt_ns / 2;
+  } else {
+    uint64_t delta = srtt > rtt_ns ? srtt - rtt_ns : rtt_ns - srtt;
+    rttvar = (3 * rttvar + delta) / 4; // beta 1/4
+    srtt = (7 * srtt + rtt_ns) / 8;    // alpha 1/8
+  }
+  rto = std::clamp<uint64_t>(srtt + 4 * rttvar, RTO_MIN_MS * 1000000ULL,
+                             RTO_MAX_MS * 1000000ULL);
+}
+
+void Network::RttEstimator::backoff() {
+  rto = std::min<uint64_t>(rto * 2, RTO_MAX_MS * 1000000ULL);
+}
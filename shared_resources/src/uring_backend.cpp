@@ -0,0 +1,342 @@
+#include "../include/uring_backend.hpp"
+#include "../include/buffer_pool.hpp"
+#include "../include/logger.hpp"
+#include "../include/metrics.hpp"
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// user_data of entries that are not sends (sends carry their slot index)
+#define URING_RECV_TAG (1ULL << 62)
+#define URING_CANCEL_TAG (URING_RECV_TAG + 1)
+
+Network::UringBackend::~UringBackend() { teardown(); }
+
+int Network::UringBackend::enter(unsigned to_submit, unsigned min_complete,
+                                 unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, ringfd, to_submit,
+                                  min_complete, flags, nullptr, 0));
+}
+
+/**
+ * @brief io_uring_setup, map submission/completion rings,
+ * register socket as fixed file and a ring of pool buffers for receives,
+ * post multishot recv
+ */
+bool Network::UringBackend::open(int sockfd) {
+  this->sockfd = sockfd;
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ringfd = static_cast<int>(
+      syscall(__NR_io_uring_setup, URING_ENTRIES, &params));
+  if (ringfd < 0) {
+    std::cerr << "io_uring_setup failed " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_map_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+  sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+  if (sq_map == MAP_FAILED) {
+    sq_map = nullptr;
+    std::cerr << "Error: Failed to map io_uring " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  cq_map = single_mmap ? sq_map
+                       : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, ringfd,
+                              IORING_OFF_CQ_RING);
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqe_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES);
+  if (cq_map == MAP_FAILED || sqe_map == MAP_FAILED) {
+    if (cq_map == MAP_FAILED)
+      cq_map = nullptr;
+    std::cerr << "Error: Failed to map io_uring " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  sqes = static_cast<struct io_uring_sqe *>(sqe_map);
+
+  unsigned char *sq = static_cast<unsigned char *>(sq_map);
+  sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_entries = params.sq_entries;
+  unsigned char *cq = static_cast<unsigned char *>(cq_map);
+  cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // socket as fixed file: no fd lookup per request
+  if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_FILES, &sockfd,
+              1) < 0) {
+    std::cerr << "io_uring register files failed " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+
+  // receive buffers: kernel picks them from this ring as data arrives
+  buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+  void *ring = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED) {
+    std::cerr << "Error: Failed to map buffer ring " << strerror(errno)
+              << std::endl;
+    return false;
+  }
+  buf_ring = static_cast<struct io_uring_buf_ring *>(ring);
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = URING_BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_PBUF_RING, &reg,
+              1) < 0) {
+    std::cerr << "io_uring buffer ring registration failed "
+              << strerror(errno) << std::endl;
+    munmap(buf_ring, buf_ring_size);
+    buf_ring = nullptr;
+    return false;
+  }
+  for (unsigned short bid = 0; bid < URING_BUFFERS; ++bid) {
+    buffers[bid] = BufferPool::instance().acquire().release();
+    provide(bid);
+  }
+
+  slots.reset(new send_slot[URING_SEND_SLOTS]);
+  for (unsigned i = URING_SEND_SLOTS; i > 0; --i)
+    free_slots.push_back(i - 1);
+
+  arm_receive();
+  flush();
+  std::cout << "\n\nio_uring backend: " << URING_BUFFERS << " x "
+            << POOL_BUFFER_SIZE << " byte receive buffers" << std::endl;
+  return true;
+}
+
+int Network::UringBackend::fd() const { return ringfd; }
+
+int Network::UringBackend::filter_fd() const { return sockfd; }
+
+struct io_uring_sqe *Network::UringBackend::next_sqe() {
+  unsigned tail = *sq_tail;
+  // queue full: hand what is there to the kernel first
+  if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+    flush();
+  struct io_uring_sqe *sqe = &sqes[tail & sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void Network::UringBackend::queue() {
+  unsigned tail = *sq_tail;
+  sq_array[tail & sq_mask] = tail & sq_mask;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+  pending++;
+}
+
+void Network::UringBackend::flush() {
+  if (pending == 0)
+    return;
+  int submitted = enter(pending, 0, 0);
+  if (submitted < 0) {
+    std::cerr << "io_uring_enter failed " << strerror(errno) << std::endl;
+    return;
+  }
+  pending -= std::min<unsigned>(pending, submitted);
+}
+
+// Multishot recv: one entry keeps producing completions until it fails
+void Network::UringBackend::arm_receive() {
+  struct io_uring_sqe *sqe = next_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = 0; // fixed file index
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = URING_RECV_TAG;
+  queue();
+  receiving = true;
+}
+
+void Network::UringBackend::provide(unsigned short bid) {
+  // entries indexed by hand: in C++ the header's flex array member sits
+  // behind an empty struct and ends up 8 bytes off
+  struct io_uring_buf *bufs = reinterpret_cast<struct io_uring_buf *>(buf_ring);
+  struct io_uring_buf *buf = &bufs[buf_tail & (URING_BUFFERS - 1)];
+  buf->addr = reinterpret_cast<uint64_t>(buffers[bid]);
+  buf->len = POOL_BUFFER_SIZE;
+  buf->bid = bid;
+  buf_tail++;
+  __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Received buffer leaves the ring as pool packet, fresh pool
+ * buffer takes its place. Finished sends free their slot.
+ * Returns true if a packet was written to out
+ */
+bool Network::UringBackend::complete(const struct io_uring_cqe *cqe,
+                                     Packet *out) {
+  if (cqe->user_data == URING_CANCEL_TAG)
+    return false;
+  if (cqe->user_data != URING_RECV_TAG) {
+    if (cqe->res < 0) {
+      LOG_ERROR("io_uring send failed: {}", strerror(-cqe->res));
+    } else {
+      metric::packets_out.add();
+      metric::bytes_out.add(cqe->res);
+    }
+    free_slots.push_back(static_cast<unsigned>(cqe->user_data));
+    return false;
+  }
+  if (!(cqe->flags & IORING_CQE_F_MORE))
+    receiving = false; // rearmed by receive()
+  if (cqe->res <= 0 || !(cqe->flags & IORING_CQE_F_BUFFER)) {
+    if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+      LOG_ERROR("io_uring recv failed: {}", strerror(-cqe->res));
+    return false;
+  }
+  unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  if (out == nullptr) {
+    provide(bid); // shutting down, buffer stays ours
+    return false;
+  }
+  BufferPool &pool = BufferPool::instance();
+  out->data = packet_ptr(buffers[bid], packet_release(&pool));
+  out->size = static_cast<size_t>(cqe->res);
+  metric::packets_in.add();
+  metric::bytes_in.add(out->size);
+  buffers[bid] = pool.acquire().release();
+  provide(bid);
+  return true;
+}
+
+/**
+ * @brief Reap completions (sends included), hand out up to max packets.
+ * Wait on the ring for at most timeout_ms only if nothing is there yet
+ */
+int Network::UringBackend::receive(Packet *out, int max, int timeout_ms) {
+  int count = 0;
+  while (count < max) {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      if (count > 0 || timeout_ms == 0)
+        break;
+      if (!receiving) {
+        arm_receive();
+        flush();
+      }
+      struct pollfd pfd {};
+      pfd.fd = ringfd;
+      pfd.events = POLLIN;
+      poll(&pfd, 1, timeout_ms);
+      timeout_ms = 0;
+      continue;
+    }
+    while (head != tail && count < max) {
+      if (complete(&cqes[head & cq_mask], &out[count]))
+        count++;
+      head++;
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  }
+  if (!receiving)
+    arm_receive();
+  flush();
+  return count;
+}
+
+/**
+ * @brief Copy each packet into a free send slot and queue SENDMSG,
+ * nothing reaches the kernel before flush(). Without a free slot
+ * (completions not reaped yet) fall back to plain sendto
+ */
+int Network::UringBackend::send(unsigned char **packets, size_t *lengths,
+                                struct sockaddr_in *dests, unsigned count) {
+  for (unsigned i = 0; i < count; ++i) {
+    if (free_slots.empty() || lengths[i] > POOL_BUFFER_SIZE) {
+      Network::send_packet(sockfd, packets[i], lengths[i], dests[i]);
+      continue;
+    }
+    unsigned index = free_slots.back();
+    free_slots.pop_back();
+    send_slot &slot = slots[index];
+    if (!slot.buffer)
+      slot.buffer = BufferPool::instance().acquire();
+    memcpy(slot.buffer.get(), packets[i], lengths[i]);
+    slot.iov.iov_base = slot.buffer.get();
+    slot.iov.iov_len = lengths[i];
+    slot.dest = dests[i];
+    memset(&slot.msg, 0, sizeof(slot.msg));
+    slot.msg.msg_name = &slot.dest;
+    slot.msg.msg_namelen = sizeof(slot.dest);
+    slot.msg.msg_iov = &slot.iov;
+    slot.msg.msg_iovlen = 1;
+
+    struct io_uring_sqe *sqe = next_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = 0; // fixed file index
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = reinterpret_cast<uint64_t>(&slot.msg);
+    sqe->len = 1;
+    sqe->user_data = index;
+    queue();
+  }
+  return static_cast<int>(count);
+}
+
+/**
+ * @brief Cancel multishot recv, wait for it and for sends in flight,
+ * so the kernel no longer touches any buffer, then unmap and give
+ * buffers back to the pool
+ */
+void Network::UringBackend::teardown() {
+  if (ringfd < 0)
+    return;
+  if (cqes != nullptr && buf_ring != nullptr) {
+    if (receiving) {
+      struct io_uring_sqe *sqe = next_sqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = URING_RECV_TAG;
+      sqe->user_data = URING_CANCEL_TAG;
+      queue();
+    }
+    for (int tries = 0;
+         tries < 100 && (receiving || free_slots.size() < URING_SEND_SLOTS);
+         ++tries) {
+      if (enter(pending, 1, IORING_ENTER_GETEVENTS) >= 0)
+        pending = 0;
+      unsigned head = *cq_head;
+      unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head)
+        complete(&cqes[head & cq_mask], nullptr);
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+  }
+  close(ringfd);
+  ringfd = -1;
+  if (sqes)
+    munmap(sqes, sqes_size);
+  if (cq_map && cq_map != sq_map)
+    munmap(cq_map, cq_map_size);
+  if (sq_map)
+    munmap(sq_map, sq_map_size);
+  if (buf_ring)
+    munmap(buf_ring, buf_ring_size);
+  for (unsigned char *&buffer : buffers) {
+    if (buffer)
+      BufferPool::instance().release(buffer);
+    buffer = nullptr;
+  }
+}